@@ -0,0 +1,160 @@
+// Queries per second of KnnSearch against checking every particle, for a
+// block of fluid at the rest spacing of the dam break scene. Every query point
+// lies in the block, as for surface detection on the particles themselves.
+// The batched query runs on all cores, the others on one.
+
+#include "knnsearch.h"
+#include "particlepool.h"
+#include "spatialhash.h"
+#include "threadpool.h"
+
+#include <glm/geometric.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+static const int NUM_PARTICLES = 40000;
+static const int NUM_QUERIES = 20000;
+// Queries of the brute force runs, which are too slow for all of them
+static const int NUM_BRUTE_FORCE_QUERIES = 500;
+static const float SPACING = 0.11f;
+// Density radius of the dam break scene, the cell size of its hash
+static const float CELL_SIZE = 0.35f;
+static const int KS[] = {1, 8, 32, 128};
+
+// Sorted (cell key, particle) pairs and the first pair of every key, as the
+// editor builds them every step
+static void buildHash(const std::vector<glm::vec3> &positions,
+                      std::vector<std::pair<int, int>> &hash,
+                      std::vector<int> &startIndices) {
+  hash.resize(positions.size());
+  startIndices.assign(positions.size(), INT_MAX);
+  for (int i = 0; i < (int)positions.size(); i++) {
+    unsigned int key = hashCell(positionToCell(positions[i], CELL_SIZE)) %
+                       (unsigned int)hash.size();
+    hash[i] = std::make_pair(key, i);
+  }
+  std::sort(hash.begin(), hash.end(),
+            [](auto &left, auto &right) { return left.first < right.first; });
+  for (int i = 0; i < (int)hash.size(); i++) {
+    if (i == 0 || hash[i].first != hash[i - 1].first) {
+      startIndices[hash[i].first] = i;
+    }
+  }
+}
+
+// k closest particles by checking every one of them
+static int bruteForce(const std::vector<glm::vec3> &positions, glm::vec3 pos,
+                      int k, std::vector<std::pair<float, int>> &candidates,
+                      int *indices, float *distances) {
+  candidates.clear();
+  for (int i = 0; i < (int)positions.size(); i++) {
+    candidates.push_back(std::make_pair(glm::distance(positions[i], pos), i));
+  }
+  int found = std::min(k, (int)candidates.size());
+  std::partial_sort(candidates.begin(), candidates.begin() + found,
+                    candidates.end());
+  for (int i = 0; i < found; i++) {
+    indices[i] = candidates[i].second;
+    distances[i] = candidates[i].first;
+  }
+  return found;
+}
+
+static double seconds(std::chrono::steady_clock::time_point start) {
+  std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+  return time.count();
+}
+
+int main() {
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> jitter(-0.01f, 0.01f);
+  std::vector<glm::vec3> positions;
+  int columns = 200;
+  for (int i = 0; i < NUM_PARTICLES; i++) {
+    positions.push_back(glm::vec3((i % columns - columns / 2) * SPACING,
+                                  (i / columns - 100) * SPACING, 0) +
+                        glm::vec3(jitter(rng), jitter(rng), 0));
+  }
+  std::vector<glm::vec3> queries;
+  std::uniform_int_distribution<int> particle(0, NUM_PARTICLES - 1);
+  for (int i = 0; i < NUM_QUERIES; i++) {
+    queries.push_back(positions[particle(rng)] +
+                      glm::vec3(jitter(rng), jitter(rng), 0) * 5.f);
+  }
+
+  std::vector<std::pair<int, int>> hash;
+  std::vector<int> startIndices;
+  buildHash(positions, hash, startIndices);
+  // Every particle is alive
+  ParticlePool particles;
+  particles.reset(positions.size(), positions.size());
+  KnnSearch search(hash, hash.size(), startIndices, CELL_SIZE,
+                   positions.data(), particles);
+  ThreadPool pool;
+
+  std::printf("%6s %14s %14s %14s %10s %10s\n", "k", "brute q/s", "grid q/s",
+              "batched q/s", "speedup", "mismatch");
+  for (int k : KS) {
+    std::vector<int> indices(k);
+    std::vector<float> distances(k);
+    std::vector<int> expected(k);
+    std::vector<float> expectedDistances(k);
+    std::vector<std::pair<float, int>> candidates;
+
+    // Compare on the farthest neighbor's distance, ties may pick either
+    int mismatches = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < NUM_BRUTE_FORCE_QUERIES; i++) {
+      bruteForce(positions, queries[i], k, candidates, expected.data(),
+                 expectedDistances.data());
+    }
+    double bruteSeconds = seconds(start);
+    for (int i = 0; i < NUM_BRUTE_FORCE_QUERIES; i++) {
+      int found = bruteForce(positions, queries[i], k, candidates,
+                             expected.data(), expectedDistances.data());
+      if (search.nearest(queries[i], k, indices.data(), distances.data()) !=
+              found ||
+          std::abs(distances[found - 1] - expectedDistances[found - 1]) >
+              1e-5f) {
+        mismatches++;
+      }
+    }
+
+    float checksum = 0;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < NUM_QUERIES; i++) {
+      search.nearest(queries[i], k, indices.data(), distances.data());
+      checksum += distances[0];
+    }
+    double gridSeconds = seconds(start);
+
+    std::vector<int> offsets;
+    std::vector<int> batchIndices;
+    std::vector<float> batchDistances;
+    // The first batch sizes the arrays, the timed one reuses them
+    search.nearest(queries, k, pool, offsets, batchIndices, batchDistances);
+    start = std::chrono::steady_clock::now();
+    search.nearest(queries, k, pool, offsets, batchIndices, batchDistances);
+    double batchSeconds = seconds(start);
+    for (int i = 0; i < NUM_QUERIES; i++) {
+      if (offsets[i + 1] - offsets[i] != k) {
+        mismatches++;
+      }
+    }
+
+    double bruteRate = NUM_BRUTE_FORCE_QUERIES / bruteSeconds;
+    double gridRate = NUM_QUERIES / gridSeconds;
+    std::printf("%6d %14.0f %14.0f %14.0f %10.1f %10d\n", k, bruteRate,
+                gridRate, NUM_QUERIES / batchSeconds, gridRate / bruteRate,
+                mismatches);
+    if (checksum < 0) {
+      std::printf("%f\n", checksum);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,94 @@
+// Queries per second of SegmentBvh against the number of obstacle segments.
+// Every query is what one particle costs in BVH obstacle mode, a raycast along
+// its motion over a step plus a closest segment lookup around it.
+
+#include "segmentbvh.h"
+
+#include <glm/geometric.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+// Half extents of the box the outlines and queries are spread over
+static const glm::vec2 BOUNDS(7.5f, 4.0f);
+static const int NUM_QUERIES = 1000000;
+static const float PARTICLE_RADIUS = 0.02f;
+// Distance a fast particle travels in one step
+static const float STEP_LENGTH = 0.1f;
+
+// Jagged closed outlines in the style of imported CAD drawings. More
+// segments make the outlines more detailed, not more numerous, so only the
+// depth of the hierarchy changes between runs.
+static void makeOutlines(int segmentCount, std::mt19937 &rng,
+                         std::vector<glm::vec2> &points,
+                         std::vector<float> &radii) {
+  std::uniform_real_distribution<float> unit(0, 1);
+  const int numOutlines = 20;
+  for (int outline = 0; outline < numOutlines; outline++) {
+    int sides = segmentCount / numOutlines;
+    glm::vec2 center((unit(rng) * 2 - 1) * BOUNDS.x,
+                     (unit(rng) * 2 - 1) * BOUNDS.y);
+    float radius = 0.5f + unit(rng);
+    std::vector<glm::vec2> corners;
+    for (int i = 0; i < sides; i++) {
+      float angle = 2 * 3.14159265f * i / sides;
+      float r = radius * (0.95f + 0.05f * unit(rng));
+      corners.push_back(center +
+                        r * glm::vec2(std::cos(angle), std::sin(angle)));
+    }
+    for (int i = 0; i < sides; i++) {
+      points.push_back(corners[i]);
+      points.push_back(corners[(i + 1) % sides]);
+      radii.push_back(0);
+    }
+  }
+}
+
+int main() {
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> unit(0, 1);
+
+  std::vector<glm::vec2> queries;
+  std::vector<glm::vec2> motions;
+  for (int i = 0; i < NUM_QUERIES; i++) {
+    queries.push_back(glm::vec2((unit(rng) * 2 - 1) * BOUNDS.x,
+                                (unit(rng) * 2 - 1) * BOUNDS.y));
+    float angle = unit(rng) * 2 * 3.14159265f;
+    motions.push_back(STEP_LENGTH *
+                      glm::vec2(std::cos(angle), std::sin(angle)));
+  }
+
+  std::printf("%10s %8s %10s %14s %8s\n", "segments", "nodes", "build ms",
+              "queries/sec", "hits");
+  for (int segmentCount : {100, 1000, 10000, 100000, 1000000}) {
+    std::vector<glm::vec2> points;
+    std::vector<float> radii;
+    makeOutlines(segmentCount, rng, points, radii);
+
+    SegmentBvh bvh;
+    auto buildStart = std::chrono::steady_clock::now();
+    bvh.build(points, radii);
+    std::chrono::duration<double, std::milli> buildTime =
+        std::chrono::steady_clock::now() - buildStart;
+
+    int hits = 0;
+    auto queryStart = std::chrono::steady_clock::now();
+    for (int i = 0; i < NUM_QUERIES; i++) {
+      float t;
+      glm::vec2 normal;
+      hits += bvh.raycast(queries[i] - motions[i], queries[i], t, normal);
+      hits += bvh.closest(queries[i], PARTICLE_RADIUS, normal) <
+              PARTICLE_RADIUS;
+    }
+    std::chrono::duration<double> queryTime =
+        std::chrono::steady_clock::now() - queryStart;
+
+    std::printf("%10d %8d %10.2f %14.0f %8d\n", bvh.segmentCount(),
+                bvh.nodeCount(), buildTime.count(),
+                NUM_QUERIES / queryTime.count(), hits);
+  }
+  return 0;
+}
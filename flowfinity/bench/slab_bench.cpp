@@ -0,0 +1,134 @@
+// Step time of a fluid layer split into slabs over 1 to 8 local processes.
+// Strong scaling keeps the scene and cuts it into more slabs, weak scaling
+// widens the box with every process so each one keeps the same number of
+// particles. The particles cover the whole floor so the slabs are evenly
+// loaded, and the layer is released from rest so it sloshes while timed.
+
+#include "slabsimulation.h"
+#include "sockettransport.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+static const int MAX_PROCESSES = 8;
+static const int STRONG_PARTICLES = 8000;
+static const int WEAK_PARTICLES = 4000;
+// Half width of the box per process in the weak scaling runs
+static const float WEAK_WIDTH = 4.0f;
+static const float HEIGHT = 4.0f;
+static const int WARMUP_STEPS = 10;
+static const int STEPS = 100;
+static const float DT = 1 / 120.f;
+
+// What every rank measured, summed or maxed over the ranks
+struct RunResult {
+  double seconds;
+  int particles;
+  int ghosts;
+};
+
+// Combine the results of all ranks on rank 0, from the last rank down the
+// chain
+static bool gatherResult(Transport &transport, RunResult &result) {
+  std::vector<char> none;
+  std::vector<char> message;
+  int rank = transport.rank();
+  if (rank + 1 < transport.size()) {
+    if (!transport.exchange(rank + 1, none, message) ||
+        message.size() != sizeof(RunResult)) {
+      return false;
+    }
+    RunResult right;
+    std::memcpy(&right, message.data(), sizeof(RunResult));
+    result.seconds = std::max(result.seconds, right.seconds);
+    result.particles += right.particles;
+    result.ghosts += right.ghosts;
+  }
+  if (rank > 0) {
+    std::vector<char> send(sizeof(RunResult));
+    std::memcpy(send.data(), &result, sizeof(RunResult));
+    return transport.exchange(rank - 1, send, message);
+  }
+  return true;
+}
+
+// Run the scene over processes ranks, only the calling process returns
+static bool run(const SceneConfig &scene, int processes, RunResult &result) {
+  std::unique_ptr<SocketTransport> transport =
+      SocketTransport::spawn(processes);
+  if (!transport) {
+    return false;
+  }
+  SlabSimulation simulation(scene, *transport);
+  simulation.reset();
+  bool success = true;
+  for (int i = 0; i < WARMUP_STEPS && success; i++) {
+    success = simulation.step(DT);
+  }
+  // The steps keep the ranks in lockstep, so the slowest rank's time is the
+  // time of the whole run
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < STEPS && success; i++) {
+    success = simulation.step(DT);
+  }
+  std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+  result = RunResult{time.count(), simulation.particleCount(),
+                     simulation.ghostCount()};
+  success = success && gatherResult(*transport, result);
+  if (transport->rank() != 0) {
+    transport.reset();
+    std::exit(success ? 0 : 1);
+  }
+  return transport->wait() && success;
+}
+
+static SceneConfig makeScene(float halfWidth, int particles) {
+  SceneConfig scene;
+  scene.bounds = glm::vec2(halfWidth, HEIGHT);
+  // Pack the particles at about the rest spacing of the dam break scene
+  float spacing = 0.11f;
+  float depth = particles * spacing * spacing / (2 * halfWidth - 0.2f);
+  scene.blocks.push_back(ParticleBlock{
+      glm::vec2(-halfWidth + 0.1f, -HEIGHT + 0.1f),
+      glm::vec2(halfWidth - 0.1f, -HEIGHT + 0.1f + depth), particles, 0});
+  return scene;
+}
+
+int main() {
+  std::printf("%8s %10s %10s %8s %12s %10s %10s\n", "scaling", "processes",
+              "particles", "ghosts", "ms/step", "speedup", "efficiency");
+  double baseStrong = 0;
+  double baseWeak = 0;
+  for (int processes = 1; processes <= MAX_PROCESSES; processes++) {
+    RunResult result;
+    if (!run(makeScene(8.0f, STRONG_PARTICLES), processes, result)) {
+      std::fprintf(stderr, "Strong scaling run on %d processes failed\n",
+                   processes);
+      return 1;
+    }
+    double ms = result.seconds * 1000 / STEPS;
+    baseStrong = processes == 1 ? ms : baseStrong;
+    std::printf("%8s %10d %10d %8d %12.2f %10.2f %10.2f\n", "strong",
+                processes, result.particles, result.ghosts, ms,
+                baseStrong / ms, baseStrong / ms / processes);
+  }
+  for (int processes = 1; processes <= MAX_PROCESSES; processes++) {
+    RunResult result;
+    if (!run(makeScene(WEAK_WIDTH * processes, WEAK_PARTICLES * processes),
+             processes, result)) {
+      std::fprintf(stderr, "Weak scaling run on %d processes failed\n",
+                   processes);
+      return 1;
+    }
+    double ms = result.seconds * 1000 / STEPS;
+    baseWeak = processes == 1 ? ms : baseWeak;
+    std::printf("%8s %10d %10d %8d %12.2f %10s %10.2f\n", "weak", processes,
+                result.particles, result.ghosts, ms, "-", baseWeak / ms);
+  }
+  return 0;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+
+#include <atomic>
+#include <vector>
+
+/**
+ * Grid of cells over the simulation box that fall asleep once nothing in them
+ * has moved for a number of steps. Particles in sleeping cells are skipped by
+ * the simulation until a restless particle nearby or the mouse wakes the cell.
+ * Cells can be woken from several threads at once.
+ */
+class ActivityTracker {
+public:
+  ActivityTracker();
+  ~ActivityTracker();
+
+  // Cover the box from min to max with square cells, every cell starts awake
+  void reset(glm::vec2 min, glm::vec2 max, float cellSize);
+  // Wake every cell again
+  void wakeAll();
+
+  // Cell a position falls into, positions outside the box use the edge cells
+  int cellOf(glm::vec3 pos) const;
+  // Keep a cell and its 8 neighbors awake for another sleepSteps steps
+  void wakeCell(int cell);
+  // Wake every cell a circle touches
+  void wakeRadius(glm::vec2 center, float radius);
+  // Count one more quiet step for every cell
+  void endStep();
+  bool isAwake(int cell) const;
+
+  // Setters
+  void setSleepSteps(int sleepSteps);
+
+private:
+  // Lower left corner of the grid
+  glm::vec2 m_min;
+  float m_cellSize;
+  int m_cols;
+  int m_rows;
+  // Steps since each cell was last woken, atomic so threads waking the same
+  // cell don't race
+  std::vector<std::atomic<int>> m_quietSteps;
+  // Quiet steps after which a cell falls asleep
+  int m_sleepSteps;
+};
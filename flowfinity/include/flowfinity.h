@@ -1,9 +1,26 @@
 #pragma once
 
+#include "particlearray.h"
+
 #include <glm/vec3.hpp>
 
 #include <vector>
 
+/**
+ * Pressure solver used to keep the fluid from compressing
+ */
+enum class SolverMode {
+  // Weakly compressible, pressure follows from the density error directly
+  WCSPH,
+  // Predictive-corrective, iterates pressures until the predicted density
+  // error is below the tolerance
+  PCISPH,
+  // Divergence-free, corrects both the density error and its rate of change
+  DFSPH,
+  // Position based, moves the particles onto the density constraint directly
+  PBF,
+};
+
 /**
  * Class representing a crowd simulation instance
  */
@@ -16,12 +33,22 @@ public:
   static float smoothingKernel(float r, float dst);
   static float smoothingKernelDerivative(float r, float dst);
   static float smoothingViscosityKernel(float r, float dst);
+  // Sharper kernel of the near density, it grows steeply as particles close
+  // in on each other
+  static float nearSmoothingKernel(float r, float dst);
+  static float nearSmoothingKernelDerivative(float r, float dst);
+  // Gradient of the smoothing kernel with respect to the first particle, offset
+  // points from the second particle to the first one and is dst long
+  static glm::vec3 smoothingKernelGradient(float r, glm::vec3 offset,
+                                           float dst);
 
   // Instance Functions for calculating simulation properties
   float calculateDensity(int posIndex, float smoothingRadius,
                          std::vector<int> &neighbors);
   float calculateDensity(glm::vec3 pos, int neighborIndex,
                          float smoothingRadius);
+  float calculateNearDensity(glm::vec3 pos, int neighborIndex,
+                             float smoothingRadius);
 
   glm::vec3 CalulatePressureForce(int posIndex, int neighborIndex,
                                   float smoothingRadius);
@@ -29,14 +56,19 @@ public:
                                   std::vector<int> &neighbors);
 
   // Setters
-  void setPositions(std::vector<glm::vec3> *positions);
-  void setDensities(std::vector<float> *densities);
+  void setPositions(ParticleArray<glm::vec3> *positions);
+  void setDensities(ParticleArray<float> *densities);
+  void setNearDensities(ParticleArray<float> *nearDensities);
   void setTargetDensity(float targetDensity);
   void setPressureMultiplier(float pressureMultiplier);
+  void setNearPressureMultiplier(float nearPressureMultiplier);
 
 private:
-  std::vector<glm::vec3> *m_positions;
-  std::vector<float> *m_densities;
+  ParticleArray<glm::vec3> *m_positions;
+  ParticleArray<float> *m_densities;
+  ParticleArray<float> *m_nearDensities;
   float m_targetDensity;
   float m_pressureMultiplier;
+  // Near pressure keeps particles from clumping, 0 turns it off
+  float m_nearPressureMultiplier;
 };
\ No newline at end of file
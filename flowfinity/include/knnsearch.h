@@ -0,0 +1,55 @@
+#pragma once
+
+#include "particlepool.h"
+#include "threadpool.h"
+
+#include <glm/vec3.hpp>
+
+#include <utility>
+#include <vector>
+
+/**
+ * k nearest neighbor queries over a spatial hash of particles, the (cell key,
+ * particle) pairs sorted by key that the solvers build every step. A query
+ * walks rings of cells around its position, keeping the k closest particles
+ * seen so far in a max-heap, until no unvisited cell can hold a closer one.
+ * Queries far from every particle, or with more neighbors requested than
+ * the surrounding cells hold, fall back to checking every particle. Free
+ * slots of the pool are never returned.
+ *
+ * The search only refers to the hash, positions and pool, which have to
+ * outlive it and stay unchanged while it is used.
+ */
+class KnnSearch {
+public:
+  // The hash is keyed by hashCell of every particle's cell modulo the hash
+  // size, and only its first hashCount pairs are in use. startIndices holds
+  // the first pair of every key, the positions are the ones the hash was
+  // built from and the pool tells which of their slots are alive
+  KnnSearch(const std::vector<std::pair<int, int>> &hash, int hashCount,
+            const std::vector<int> &startIndices, float cellSize,
+            const glm::vec3 *positions, const ParticlePool &pool);
+
+  // Up to k live particles closest to pos, closest first, with their
+  // distances. Returns how many were found, fewer than k only if there are
+  // fewer particles
+  int nearest(glm::vec3 pos, int k, int *indices, float *distances) const;
+  // nearest for every point, in parallel. The neighbors of point i end up in
+  // [offsets[i], offsets[i + 1]) of indices and distances. The arrays keep
+  // their storage between calls, so only a larger batch allocates
+  void nearest(const std::vector<glm::vec3> &points, int k, ThreadPool &pool,
+               std::vector<int> &offsets, std::vector<int> &indices,
+               std::vector<float> &distances) const;
+
+private:
+  // Check every particle, for queries the rings would take too long to reach
+  int nearestBruteForce(glm::vec3 pos, int k, int *indices,
+                        float *distances) const;
+
+  const std::vector<std::pair<int, int>> &m_hash;
+  int m_hashCount;
+  const std::vector<int> &m_startIndices;
+  float m_cellSize;
+  const glm::vec3 *m_positions;
+  const ParticlePool &m_pool;
+};
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+/**
+ * Allocator that leaves new elements of a resize uninitialized instead of
+ * zeroing them. Large arrays come straight from the operating system, so
+ * their pages stay untouched until the threads that own the particles write
+ * them first, which places every page on the NUMA node of its owner.
+ */
+template <typename T> class FirstTouchAllocator : public std::allocator<T> {
+public:
+  template <typename U> struct rebind {
+    typedef FirstTouchAllocator<U> other;
+  };
+
+  FirstTouchAllocator() noexcept {}
+  template <typename U>
+  FirstTouchAllocator(const FirstTouchAllocator<U> &) noexcept {}
+
+  // Default initialization, a no-op for the plain values particles are made of
+  template <typename U> void construct(U *p) { ::new ((void *)p) U; }
+  template <typename U, typename... Args>
+  void construct(U *p, Args &&...args) {
+    ::new ((void *)p) U(std::forward<Args>(args)...);
+  }
+};
+
+// Per-particle array, every element has to be written before it is read
+template <typename T>
+using ParticleArray = std::vector<T, FirstTouchAllocator<T>>;
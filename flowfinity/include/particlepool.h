@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+
+/**
+ * Fixed capacity pool of particle slots. Released slots go on a free list and
+ * are handed out again by the next allocation, so particles can be spawned and
+ * drained every step without touching the heap.
+ */
+class ParticlePool {
+public:
+  ParticlePool();
+  ~ParticlePool();
+
+  // Reserve room for capacity particles, the first count slots start alive
+  void reset(int capacity, int count);
+  // Take a free slot, returns -1 when the pool is full
+  int allocate();
+  // Put a slot back on the free list
+  void release(int index);
+
+  // Move live particles down into the free slots so they are packed at the
+  // front again. move(from, to) is called for every particle that changes slot
+  template <typename F> void compact(F &&move);
+
+  bool isAlive(int index) const;
+  int capacity() const;
+  int liveCount() const;
+  // One past the highest slot in use, loops over particles stop here
+  int highWater() const;
+  // Fraction of the slots below the high water mark that are free
+  float fragmentation() const;
+
+private:
+  // Alive flag per slot
+  std::vector<char> m_alive;
+  // Free slots below the high water mark
+  std::vector<int> m_freeList;
+  int m_highWater;
+  int m_liveCount;
+};
+
+template <typename F> void ParticlePool::compact(F &&move) {
+  int lo = 0;
+  int hi = m_highWater - 1;
+  while (true) {
+    // Find the first hole from the front and the last particle from the back
+    while (lo < hi && m_alive[lo]) {
+      lo++;
+    }
+    while (hi > lo && !m_alive[hi]) {
+      hi--;
+    }
+    if (lo >= hi) {
+      break;
+    }
+    move(hi, lo);
+    m_alive[lo] = 1;
+    m_alive[hi] = 0;
+  }
+  // Everything past the live particles is free now, which the high water mark
+  // already covers
+  m_highWater = m_liveCount;
+  m_freeList.clear();
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "sceneconfig.h"
+
+#include <glm/vec2.hpp>
+
+#include <vector>
+
+/**
+ * Dynamic circle or polygon the fluid pushes around and that pushes back. The
+ * fluid sees the body through boundary samples along its outline, the forces
+ * between the fluid and the samples add up to a force and torque on the body.
+ */
+class RigidBody {
+public:
+  // Body with the shape of a circle, box or polygon obstacle and the given
+  // mass per area
+  RigidBody(const Obstacle &shape, float density);
+  ~RigidBody();
+
+  // Spread boundary samples over the outline. Every sample gets the volume
+  // that makes a layer of samples as dense as the fluid at restDensity for
+  // the smoothing radius.
+  void sampleBoundary(float spacing, float radius, float restDensity);
+
+  // World position of a point given relative to the center of mass
+  glm::vec2 toWorld(glm::vec2 local) const;
+  // Velocity of the body at a world position
+  glm::vec2 velocityAt(glm::vec2 pos) const;
+  // Signed distance from a world position to the outline, negative inside.
+  // The normal points out of the body.
+  float signedDistance(glm::vec2 pos, glm::vec2 &normal) const;
+  // Effective mass of the body against a push at pos along direction
+  float effectiveMass(glm::vec2 pos, glm::vec2 direction) const;
+
+  // Forces are gathered until the next integrate, impulses act right away
+  void applyForce(glm::vec2 pos, glm::vec2 force);
+  void applyImpulse(glm::vec2 pos, glm::vec2 impulse);
+  // Advance the body under the gathered forces and gravity
+  void integrate(float dt, float gravity);
+  // Keep the outline inside the box with the given half extents
+  void collideWithBounds(glm::vec2 bounds, float restitution);
+
+  glm::vec2 position() const;
+  float angle() const;
+  float mass() const;
+  // Distance from the center of mass to the farthest point of the outline
+  float boundingRadius() const;
+  // Boundary samples and their volumes, relative to the center of mass
+  const std::vector<glm::vec2> &samples() const;
+  const std::vector<float> &sampleVolumes() const;
+  // Closed outline relative to the center of mass, circles as a polygon
+  std::vector<glm::vec2> outline() const;
+
+private:
+  // Radius of a circle, 0 for polygons
+  float m_radius;
+  // Counterclockwise corners of a polygon relative to the center of mass
+  std::vector<glm::vec2> m_corners;
+
+  glm::vec2 m_position;
+  float m_angle;
+  glm::vec2 m_velocity;
+  float m_angularVelocity;
+  float m_mass;
+  float m_inertia;
+  // Force and torque gathered since the last integrate
+  glm::vec2 m_force;
+  float m_torque;
+
+  std::vector<glm::vec2> m_samples;
+  std::vector<float> m_sampleVolumes;
+};
@@ -0,0 +1,219 @@
+#pragma once
+
+#include "flowfinity.h"
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+
+#include <string>
+#include <vector>
+
+/**
+ * A rectangular block of particles placed in a grid at startup
+ */
+struct ParticleBlock {
+  // Lower left corner of the block
+  glm::vec2 min;
+  // Upper right corner of the block
+  glm::vec2 max;
+  // Number of particles spread over the block
+  int count;
+  // Fluid phase of the particles, 0 for the base fluid
+  int phase;
+};
+
+/**
+ * Region that continuously spawns new particles
+ */
+struct ParticleEmitter {
+  // Lower left corner of the spawn region
+  glm::vec2 min;
+  // Upper right corner of the spawn region
+  glm::vec2 max;
+  // Particles spawned per second
+  float rate;
+  // Initial velocity of spawned particles
+  glm::vec2 velocity;
+  // Fluid phase of spawned particles, 0 for the base fluid
+  int phase;
+};
+
+/**
+ * Region that removes every particle entering it
+ */
+struct ParticleSink {
+  // Lower left corner of the drain region
+  glm::vec2 min;
+  // Upper right corner of the drain region
+  glm::vec2 max;
+};
+
+/**
+ * Fluid that shares the box with the base fluid but has its own rest density,
+ * viscosity and color, like oil over water
+ */
+struct FluidPhase {
+  // Rest density relative to the base fluid, lighter phases rise
+  float density;
+  // Viscosity Strength
+  float viscosity;
+  // Color the particles of the phase are drawn with
+  glm::vec3 color;
+};
+
+/**
+ * Shape of a static obstacle
+ */
+enum class ObstacleShape { Circle, Box, Polygon, Polyline };
+
+/**
+ * How the particles collide with the obstacles
+ */
+enum class ObstacleMode {
+  // Look up a signed distance grid, constant cost per particle
+  SDF,
+  // Query a hierarchy of the outline segments with the particle's motion, for
+  // outlines with more detail than a grid can hold
+  BVH,
+};
+
+/**
+ * Static obstacle the particles collide with
+ */
+struct Obstacle {
+  ObstacleShape shape;
+  // Center of a circle, lower left and upper right corner of a box or the
+  // corners of a polygon or polyline
+  std::vector<glm::vec2> points;
+  // Radius of a circle or thickness of a polyline
+  float size;
+};
+
+/**
+ * Rigid body pushed around by the fluid
+ */
+struct DynamicBody {
+  // Circle, box or polygon at its starting position
+  Obstacle shape;
+  // Mass per area relative to the fluid, bodies below 1 float
+  float density;
+};
+
+/**
+ * Simulation parameters and initial state of a scene, loaded from a plain text
+ * scene file. Every line is a key followed by its values, '#' starts a comment.
+ */
+struct SceneConfig {
+  SceneConfig();
+
+  // Load a scene file, keys that are not present keep their current value.
+  // A file that fails to load leaves the scene unchanged. includeDepth counts
+  // the obstacle files being loaded on the way here
+  bool load(const std::string &path, int includeDepth = 0);
+  // Write every parameter of the scene back out to a scene file
+  bool save(const std::string &path) const;
+
+  // Number of instances (ignored when blocks are given)
+  int numInstances;
+  // Maximum number of live particles, 0 to only fit the initial particles
+  int capacity;
+  // Particle Size
+  float particleSize;
+  // Particle Damping Factor
+  float particleDamping;
+  // Particle Spacing
+  float particleSpacing;
+  // Density Radius
+  float densityRadius;
+  // Target Density
+  float targetDensity;
+  // Pressure Multiplier
+  float pressureMultiplier;
+  // Near Pressure Multiplier, pushes apart particles that clump
+  float nearPressureMultiplier;
+  // Gravity
+  float gravity;
+  // Input radius
+  float inputRadius;
+  // Input strength Multiplier
+  float inputStrengthMultiplier;
+  // Viscosity Strength
+  float viscosityStrength;
+  // Random Location
+  bool randomLocation;
+  // Start the simulation as soon as the scene is loaded
+  bool autoStart;
+  // Pick the step size from the CFL condition instead of the frame time
+  bool adaptiveTimestep;
+  // Fraction of the density radius the fastest particle may travel per step
+  float cflFactor;
+  // Scale of the acceleration step limit
+  float forceFactor;
+  // Scale of the viscosity step limit
+  float viscosityFactor;
+  // Smallest and largest adaptive step in seconds
+  float minTimestep;
+  float maxTimestep;
+  // Most steps taken per frame
+  int maxSubsteps;
+  // Pressure solver
+  SolverMode solverMode;
+  // Relative density error the iterative solvers stop at
+  float solverTolerance;
+  // Most iterations per pressure solve
+  int solverIterations;
+  // Start each pressure solve from the pressures of the last step
+  bool warmStart;
+  // Constraint iterations per position based step
+  int pbfIterations;
+  // Softens the position based density constraint
+  float pbfRelaxation;
+  // XSPH velocity smoothing of the position based solver, 0 turns it off
+  float xsphViscosity;
+  // Let cells of resting fluid fall asleep
+  bool sleeping;
+  // Speed below which a particle counts as resting
+  float sleepVelocity;
+  // Relative density change per step below which a particle counts as resting
+  float sleepDensityChange;
+  // Resting steps after which a cell falls asleep
+  int sleepSteps;
+  // Obstacle collision mode
+  ObstacleMode obstacleMode;
+  // Cell size of the grid the obstacle distances are sampled on
+  float obstacleCellSize;
+  // Draw every particle as one quad with the circle cut out by the fragment
+  // shader instead of as a circle mesh
+  bool particleSprites;
+  // Draw the fluid as a surface of its density instead of as particles
+  bool surfaceRendering;
+  // Cells across the width of the density grid the surface is drawn from
+  int surfaceResolution;
+  // Density the surface is drawn at, relative to the mean particle density
+  float surfaceThreshold;
+  // Draw the outline of the fluid at the surface threshold
+  bool surfaceOutline;
+  // Distance a particle moves before the outline around it is extracted again
+  float outlineTolerance;
+  // Half extents of the simulation box
+  glm::vec2 bounds;
+  // Velocity color gradient
+  std::vector<glm::vec3> colors;
+  // Initial particle blocks
+  std::vector<ParticleBlock> blocks;
+  // Particle sources
+  std::vector<ParticleEmitter> emitters;
+  // Particle drains
+  std::vector<ParticleSink> sinks;
+  // Fluid phases after the base fluid, blocks and emitters refer to them by
+  // their position in the list starting at 1
+  std::vector<FluidPhase> phases;
+  // Static obstacles
+  std::vector<Obstacle> obstacles;
+  // Rigid bodies
+  std::vector<DynamicBody> bodies;
+
+private:
+  // Read a scene file into this scene, stopping at the first error
+  bool parse(const std::string &path, int includeDepth);
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <glm/vec2.hpp>
+
+#include <vector>
+
+/**
+ * Signed distance to a set of static obstacles, sampled on a regular grid once
+ * when the obstacles change. Distances are negative inside an obstacle. A
+ * lookup is one bilinear interpolation no matter how many obstacles there are.
+ */
+class SdfGrid {
+public:
+  SdfGrid();
+  ~SdfGrid();
+
+  // Cover the box from min to max with square cells and remove every obstacle
+  void reset(glm::vec2 min, glm::vec2 max, float cellSize);
+
+  // Obstacles are merged into the grid as they are added
+  void addCircle(glm::vec2 center, float radius);
+  void addBox(glm::vec2 min, glm::vec2 max);
+  // Closed polygon, the points may wind either way
+  void addPolygon(const std::vector<glm::vec2> &points);
+  // Open chain of segments with the given thickness
+  void addPolyline(const std::vector<glm::vec2> &points, float thickness);
+
+  // True while no obstacle has been added
+  bool empty() const;
+  // Interpolated distance at a position and its gradient, which points away
+  // from the closest obstacle. Positions outside the grid are far from
+  // everything.
+  float sample(glm::vec2 pos, glm::vec2 &gradient) const;
+
+private:
+  // Merge the distance of every grid node to a shape into the grid
+  template <typename F> void merge(const F &distance);
+
+  // Position of the lower left grid node
+  glm::vec2 m_min;
+  float m_cellSize;
+  // Grid nodes along each axis, one more than there are cells
+  int m_cols;
+  int m_rows;
+  // Signed distance at every node, row by row
+  std::vector<float> m_distances;
+  bool m_empty;
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <glm/vec2.hpp>
+
+#include <vector>
+
+/**
+ * Bounding volume hierarchy over static line segments, built with the surface
+ * area heuristic and stored as a flat array of nodes. Meant for obstacle sets
+ * with too many segments for a distance grid of useful resolution.
+ */
+class SegmentBvh {
+public:
+  SegmentBvh();
+  ~SegmentBvh();
+
+  // Rebuild the hierarchy from pairs of segment end points, every segment has
+  // the matching entry of radii as its half thickness
+  void build(const std::vector<glm::vec2> &points,
+             const std::vector<float> &radii);
+
+  bool empty() const;
+  int segmentCount() const;
+  int nodeCount() const;
+
+  // First segment crossed moving from one position to another. Returns false
+  // if there is none, otherwise the fraction of the way at which it is hit
+  // and the segment normal facing the start.
+  bool raycast(glm::vec2 from, glm::vec2 to, float &t,
+               glm::vec2 &normal) const;
+  // Distance from a position to the surface of the closest segment, or
+  // maxDistance if none is closer. The normal points from the segment to the
+  // position.
+  float closest(glm::vec2 pos, float maxDistance, glm::vec2 &normal) const;
+
+private:
+  struct Segment {
+    glm::vec2 a;
+    glm::vec2 b;
+    // Half thickness
+    float radius;
+  };
+
+  struct Node {
+    glm::vec2 min;
+    glm::vec2 max;
+    // First segment of a leaf, or the second child of an inner node whose
+    // first child follows right after it
+    int index;
+    // Segments of a leaf, 0 for inner nodes
+    int count;
+  };
+
+  // Build the subtree over segments [begin, end) and return its node
+  int buildNode(int begin, int end, int depth);
+  glm::vec2 segmentMin(const Segment &segment) const;
+  glm::vec2 segmentMax(const Segment &segment) const;
+
+  std::vector<Segment> m_segments;
+  // Nodes in depth first order, the root is the first one
+  std::vector<Node> m_nodes;
+};
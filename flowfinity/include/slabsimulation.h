@@ -0,0 +1,93 @@
+#pragma once
+
+#include "flowfinity.h"
+#include "sceneconfig.h"
+#include "transport.h"
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+
+#include <utility>
+#include <vector>
+
+/**
+ * Weakly compressible fluid in one slab of a scene split over several
+ * processes. The box is cut into as many equally wide slabs along x as the
+ * transport has ranks, and every rank owns the particles in its slab. Each
+ * step hands the particles that left the slab to the neighboring rank and
+ * copies in the neighbors' particles within one density radius of the slab's
+ * edges as ghosts, so the owned particles see the same neighborhood as in one
+ * big box.
+ */
+class SlabSimulation {
+public:
+  // The transport has to outlive the simulation
+  SlabSimulation(const SceneConfig &scene, Transport &transport);
+
+  // Place the particles of the scene's blocks that fall into this slab
+  void reset();
+  // Add a particle if it lies in this slab, returns whether it was added
+  bool addParticle(glm::vec3 position, glm::vec3 velocity);
+  // Advance the slab by dt, every rank has to step together. Returns false if
+  // a neighbor could not be reached
+  bool step(float dt);
+
+  // Left and right edge of the slab
+  float slabMin() const;
+  float slabMax() const;
+  // Owned particles, the ghosts of the last step are not included
+  int particleCount() const;
+  // Ghost particles copied in from the neighbors in the last step
+  int ghostCount() const;
+  const std::vector<glm::vec3> &positions() const;
+  const std::vector<glm::vec3> &velocities() const;
+
+private:
+  // Send the particles that left the slab to the neighbor they moved towards
+  bool migrateParticles();
+  // Copy in the neighbors' particles close to the slab's edges
+  bool exchangeGhosts();
+  // Copy in the densities of the ghosts once the neighbors have found them
+  bool exchangeGhostDensities();
+  // Send m_sendLeft and m_sendRight to the neighbors and receive theirs. Even
+  // ranks talk to the right first and odd ranks to the left, so every pair of
+  // neighbors talks at once
+  bool exchangeWithNeighbors();
+  // Remove the owned particle at index, the last owned particle takes its place
+  void removeParticle(int index);
+
+  void updateSpatialHash();
+  template <typename F> void forEachNeighbor(glm::vec3 pos, const F &fn);
+  void resolveCollisions(int index);
+
+  Transport &m_transport;
+  SceneConfig m_scene;
+  FlowFinity m_flowFinity;
+  float m_slabMin;
+  float m_slabMax;
+
+  // Owned particles first, then the ghosts of the current step
+  std::vector<glm::vec3> m_positions;
+  std::vector<glm::vec3> m_velocities;
+  ParticleArray<glm::vec3> m_predictedPositions;
+  ParticleArray<float> m_densities;
+  ParticleArray<float> m_nearDensities;
+  int m_numOwned;
+  int m_numLeftGhosts;
+  int m_numRightGhosts;
+  // Owned particles sent to the neighbors as ghosts, in the order they were
+  // sent
+  std::vector<int> m_sentLeft;
+  std::vector<int> m_sentRight;
+  // Messages to and from the neighbors, kept so their storage is reused every
+  // step
+  std::vector<char> m_sendLeft;
+  std::vector<char> m_sendRight;
+  std::vector<char> m_receiveLeft;
+  std::vector<char> m_receiveRight;
+
+  // Spatial hash over owned particles and ghosts, (cell key, particle) pairs
+  // sorted by key and the first pair of every key
+  std::vector<std::pair<unsigned int, int>> m_spatialHash;
+  std::vector<int> m_startIndices;
+};
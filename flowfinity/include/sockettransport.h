@@ -0,0 +1,44 @@
+#pragma once
+
+#include "transport.h"
+
+#include <memory>
+#include <vector>
+
+/**
+ * Transport over Unix domain socket pairs between processes on one machine.
+ * Each rank holds one socket to the rank before it and one to the rank after
+ * it, messages are sent with their length in front.
+ */
+class SocketTransport : public Transport {
+public:
+  ~SocketTransport() override;
+
+  // Fork the calling process into count ranks connected in a chain. Every
+  // process returns its own transport, the calling one as rank 0. Returns null
+  // if the sockets or the processes can't be created
+  static std::unique_ptr<SocketTransport> spawn(int count);
+
+  // Wait for every other rank to exit, only rank 0 may call it. Returns false
+  // if one of them failed
+  bool wait();
+
+  int rank() const override;
+  int size() const override;
+  bool exchange(int peer, const std::vector<char> &send,
+                std::vector<char> &receive) override;
+
+private:
+  SocketTransport(int rank, int size, int left, int right);
+
+  static bool sendAll(int socket, const char *data, size_t size);
+  static bool receiveAll(int socket, char *data, size_t size);
+
+  int m_rank;
+  int m_size;
+  // Sockets to the previous and the next rank, -1 at the ends of the chain
+  int m_left;
+  int m_right;
+  // Process ids of the other ranks, only rank 0 keeps them
+  std::vector<int> m_children;
+};
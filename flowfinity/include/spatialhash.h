@@ -0,0 +1,10 @@
+#pragma once
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+
+// Cell of a position in a grid of the given cell size, rounded down so every
+// cell is the same size on both sides of the origin
+glm::vec2 positionToCell(glm::vec3 pos, float radius);
+// Hash of a cell, taken modulo the size of a spatial hash for the cell's key
+unsigned int hashCell(glm::vec2 cell);
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "threadpool.h"
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+
+#include <vector>
+
+/**
+ * Outline of the fluid by marching squares over its SPH density. The grid is
+ * split into square tiles and only tiles with particles within one radius
+ * are extracted, in parallel. A tile is only extracted again once a particle
+ * near it moved more than the tolerance, otherwise its segments of the last
+ * extraction are kept.
+ */
+class SurfaceExtractor {
+public:
+  SurfaceExtractor();
+
+  // Grid over the box from min to max with square cells, the density is the
+  // sum of the smoothing kernel of the given radius over the particles
+  void setGrid(glm::vec2 min, glm::vec2 max, float cellSize, float radius);
+  // Density the outline is drawn at
+  void setThreshold(float threshold);
+  // Distance a particle may move before the tiles around it are extracted
+  // again
+  void setTolerance(float tolerance);
+
+  // Update the outline of the particles, positions outside of the grid are
+  // left out. Returns whether any tile was extracted again
+  bool extract(const glm::vec3 *positions, int count, ThreadPool &pool);
+
+  // Pairs of segment end points
+  const std::vector<glm::vec2> &segments() const;
+  // The segments joined into polylines, closed ones end on their first point
+  void polylines(std::vector<std::vector<glm::vec2>> &lines) const;
+
+  int tileCount() const;
+  // Tiles with particles near them and tiles extracted in the last call
+  int activeTiles() const;
+  int extractedTiles() const;
+
+private:
+  /**
+   * Segments of one tile, kept until the tile is extracted again
+   */
+  struct Tile {
+    std::vector<glm::vec2> points;
+    // Grid edge every point lies on, which neighboring segments share
+    std::vector<long long> edges;
+    bool active;
+    bool dirty;
+  };
+
+  // Tile of a position, -1 outside of the grid
+  int tileOf(glm::vec2 pos) const;
+  // Mark the tile and its neighbors for extraction
+  void markAround(int tile);
+  // Sum the densities at the tile's grid points and march its cells
+  void extractTile(int tile, const glm::vec3 *positions,
+                   std::vector<float> &densities);
+
+  glm::vec2 m_min;
+  float m_cellSize;
+  float m_radius;
+  float m_threshold;
+  float m_tolerance;
+  int m_cellsX;
+  int m_cellsY;
+  // Cells along each side of a tile, at least one radius
+  int m_tileCells;
+  int m_tilesX;
+  int m_tilesY;
+  // Every tile is extracted in the next call
+  bool m_resetAll;
+
+  std::vector<Tile> m_tiles;
+  // Particles of every tile, the ones of tile t in [m_tileStart[t],
+  // m_tileStart[t + 1]) of m_tileParticles
+  std::vector<int> m_tileStart;
+  std::vector<int> m_tileParticles;
+  std::vector<int> m_particleTiles;
+  // Where every particle was when the tiles around it were last extracted
+  std::vector<glm::vec2> m_references;
+  std::vector<int> m_dirtyTiles;
+  int m_activeTiles;
+  // Grid point densities of a tile, one array per thread
+  std::vector<std::vector<float>> m_threadDensities;
+
+  std::vector<glm::vec2> m_segments;
+  std::vector<long long> m_segmentEdges;
+};
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Persistent worker threads that split index ranges between them. The calling
+ * thread works on the range too and parallelFor only returns once every index
+ * has been processed. Jobs are passed by pointer so no call allocates.
+ * parallelFor must not be called from inside another parallelFor.
+ *
+ * On machines with several NUMA nodes the threads are pinned to the nodes in
+ * equal groups and every node owns one block of each range. A node's threads
+ * finish their own block before they help out on the blocks of other nodes.
+ */
+class ThreadPool {
+public:
+  // 0 threads uses one thread per hardware core
+  explicit ThreadPool(int numThreads = 0);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  // Number of threads working on a range, including the calling thread
+  int numThreads() const;
+  // Number of NUMA nodes the threads are spread over, 1 without NUMA
+  int numNodes() const;
+
+  // Give every node the same block of [0, size) in every range, instead of
+  // splitting each range anew, so a node keeps working on the particles whose
+  // memory its threads touched first. 0 splits every range anew
+  void setPartition(int size);
+  // Size the blocks are cut from, 0 without a fixed partition
+  int partitionSize() const;
+  // First index of the node's block of [0, size)
+  int partitionBegin(int node, int size) const;
+
+  /**
+   * Work a NUMA node did since the stats were last taken
+   */
+  struct NodeStats {
+    // Indices processed by the node's threads
+    long long indices;
+    // Indices of them that belonged to the blocks of other nodes
+    long long stolen;
+    // Time the node's threads spent on ranges, averaged over the threads
+    double seconds;
+  };
+  // Fill in the work of every node and start counting anew
+  void takeNodeStats(std::vector<NodeStats> &stats);
+
+  // Call fn(i) for every i in [begin, end)
+  template <typename F> void parallelFor(int begin, int end, const F &fn);
+  // Call fn(chunkBegin, chunkEnd, thread) for consecutive chunks of
+  // [begin, end), thread is in [0, numThreads()) and unique per running chunk
+  template <typename F>
+  void parallelForChunks(int begin, int end, const F &fn);
+
+private:
+  typedef void (*ChunkFn)(const void *context, int begin, int end, int thread);
+
+  /**
+   * Block of the current range owned by one node, on its own cache line so
+   * the nodes don't contend for it
+   */
+  struct alignas(64) NodeRange {
+    std::atomic<int> next;
+    int end;
+  };
+
+  /**
+   * Work counters of one thread, only ever written by that thread
+   */
+  struct alignas(64) ThreadStats {
+    long long indices;
+    long long stolen;
+    double seconds;
+  };
+
+  // Spread the threads over the NUMA nodes and pin them to their node
+  void assignNodes(int numThreads,
+                   const std::vector<std::vector<int>> &nodeCpus);
+  void run(ChunkFn fn, const void *context, int begin, int end);
+  void workOn(int thread);
+  void workerLoop(int thread);
+
+  std::vector<std::thread> m_workers;
+  // NUMA node of every thread
+  std::vector<int> m_threadNodes;
+  // Number of threads on every node
+  std::vector<int> m_nodeThreads;
+  std::unique_ptr<NodeRange[]> m_nodeRanges;
+  std::unique_ptr<ThreadStats[]> m_threadStats;
+  int m_partitionSize;
+  std::mutex m_mutex;
+  // Signals workers that a new job was posted
+  std::condition_variable m_wake;
+  // Signals the caller that every worker finished the job
+  std::condition_variable m_done;
+
+  // Current job
+  ChunkFn m_fn;
+  const void *m_context;
+  int m_chunkSize;
+  // Workers that have not finished the current job yet
+  int m_pending;
+  // Incremented for every job so workers can tell a new one was posted
+  unsigned int m_generation;
+  bool m_stop;
+};
+
+template <typename F>
+void ThreadPool::parallelFor(int begin, int end, const F &fn) {
+  parallelForChunks(begin, end, [&fn](int chunkBegin, int chunkEnd, int) {
+    for (int i = chunkBegin; i < chunkEnd; i++) {
+      fn(i);
+    }
+  });
+}
+
+template <typename F>
+void ThreadPool::parallelForChunks(int begin, int end, const F &fn) {
+  run(
+      [](const void *context, int chunkBegin, int chunkEnd, int thread) {
+        (*static_cast<const F *>(context))(chunkBegin, chunkEnd, thread);
+      },
+      &fn, begin, end);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+/**
+ * Picks the largest stable step size from the current state of the fluid. The
+ * step is limited by the CFL condition on the fastest particle, by the largest
+ * acceleration and by the explicit viscosity, then clamped to [minDt, maxDt].
+ */
+class TimestepController {
+public:
+  TimestepController();
+  ~TimestepController();
+
+  // Largest stable step. viscosityRate is the fraction of the relative
+  // velocity the viscosity removes per second (strength * density)
+  float computeDt(float smoothingRadius, float maxVelocity,
+                  float maxAcceleration, float viscosityRate) const;
+  // Step size that splits the remaining frame time into equal steps no larger
+  // than stableDt, so frames don't end on a tiny leftover step
+  float nextSubstep(float remaining, float stableDt) const;
+
+  // Setters
+  void setCflFactor(float cflFactor);
+  void setForceFactor(float forceFactor);
+  void setViscosityFactor(float viscosityFactor);
+  void setDtLimits(float minDt, float maxDt);
+  void setMaxSubsteps(int maxSubsteps);
+
+  // Getters
+  int getMaxSubsteps() const;
+
+private:
+  // Fraction of the smoothing radius the fastest particle may travel per step
+  float m_cflFactor;
+  // Scale of the acceleration limit sqrt(h / a)
+  float m_forceFactor;
+  // Scale of the viscosity limit 1 / rate
+  float m_viscosityFactor;
+  float m_minDt;
+  float m_maxDt;
+  // Upper bound on steps per frame, the simulation slows down past it
+  int m_maxSubsteps;
+};
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <vector>
+
+/**
+ * Message passing between the processes of a simulation split over several
+ * processes. Every process is a rank, and ranks only ever talk to the ranks
+ * right before and after them.
+ */
+class Transport {
+public:
+  virtual ~Transport() {}
+
+  // Position of this process among all of them, starting at 0
+  virtual int rank() const = 0;
+  // Number of processes
+  virtual int size() const = 0;
+  // Send a message to a neighboring rank and receive the one it sends back.
+  // Both ranks have to call it for each other, returns false if the peer is
+  // not a neighbor or has gone away
+  virtual bool exchange(int peer, const std::vector<char> &send,
+                        std::vector<char> &receive) = 0;
+};
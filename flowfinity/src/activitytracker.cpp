@@ -0,0 +1,77 @@
+#include "activitytracker.h"
+
+#include <algorithm>
+#include <cmath>
+
+ActivityTracker::ActivityTracker()
+    : m_min(0), m_cellSize(1), m_cols(1), m_rows(1), m_quietSteps(1),
+      m_sleepSteps(30) {
+  wakeAll();
+}
+
+ActivityTracker::~ActivityTracker() {}
+
+void ActivityTracker::reset(glm::vec2 min, glm::vec2 max, float cellSize) {
+  m_min = min;
+  m_cellSize = std::max(cellSize, 1e-3f);
+  m_cols = std::max(1, (int)std::ceil((max.x - min.x) / m_cellSize));
+  m_rows = std::max(1, (int)std::ceil((max.y - min.y) / m_cellSize));
+  // Atomics can't be copied, so the cells are only reallocated when their
+  // number changes
+  if ((int)m_quietSteps.size() != m_cols * m_rows) {
+    m_quietSteps = std::vector<std::atomic<int>>(m_cols * m_rows);
+  }
+  wakeAll();
+}
+
+void ActivityTracker::wakeAll() {
+  for (std::atomic<int> &quietSteps : m_quietSteps) {
+    quietSteps.store(0, std::memory_order_relaxed);
+  }
+}
+
+int ActivityTracker::cellOf(glm::vec3 pos) const {
+  int x = std::clamp((int)std::floor((pos.x - m_min.x) / m_cellSize), 0,
+                     m_cols - 1);
+  int y = std::clamp((int)std::floor((pos.y - m_min.y) / m_cellSize), 0,
+                     m_rows - 1);
+  return y * m_cols + x;
+}
+
+void ActivityTracker::wakeCell(int cell) {
+  int x = cell % m_cols;
+  int y = cell / m_cols;
+  for (int ny = std::max(0, y - 1); ny <= std::min(m_rows - 1, y + 1); ny++) {
+    for (int nx = std::max(0, x - 1); nx <= std::min(m_cols - 1, x + 1);
+         nx++) {
+      m_quietSteps[ny * m_cols + nx].store(0, std::memory_order_relaxed);
+    }
+  }
+}
+
+void ActivityTracker::wakeRadius(glm::vec2 center, float radius) {
+  int first = cellOf(glm::vec3(center - glm::vec2(radius), 0));
+  int last = cellOf(glm::vec3(center + glm::vec2(radius), 0));
+  for (int y = first / m_cols; y <= last / m_cols; y++) {
+    for (int x = first % m_cols; x <= last % m_cols; x++) {
+      m_quietSteps[y * m_cols + x].store(0, std::memory_order_relaxed);
+    }
+  }
+}
+
+void ActivityTracker::endStep() {
+  for (std::atomic<int> &quietSteps : m_quietSteps) {
+    // Stop counting once asleep so the counters never overflow
+    int steps = quietSteps.load(std::memory_order_relaxed);
+    quietSteps.store(std::min(steps + 1, m_sleepSteps),
+                     std::memory_order_relaxed);
+  }
+}
+
+bool ActivityTracker::isAwake(int cell) const {
+  return m_quietSteps[cell].load(std::memory_order_relaxed) < m_sleepSteps;
+}
+
+void ActivityTracker::setSleepSteps(int sleepSteps) {
+  m_sleepSteps = std::max(1, sleepSteps);
+}
@@ -5,8 +5,9 @@
 #include <glm/geometric.hpp>
 
 FlowFinity::FlowFinity()
-    : m_densities(nullptr), m_positions(nullptr), m_targetDensity(2.75),
-      m_pressureMultiplier(2) {}
+    : m_positions(nullptr), m_densities(nullptr), m_nearDensities(nullptr),
+      m_targetDensity(2.75), m_pressureMultiplier(2),
+      m_nearPressureMultiplier(0) {}
 
 FlowFinity::~FlowFinity() {}
 
@@ -28,11 +29,35 @@ float FlowFinity::smoothingKernelDerivative(float r, float dst) {
   return scale * (dst - r);
 }
 
+glm::vec3 FlowFinity::smoothingKernelGradient(float r, glm::vec3 offset,
+                                              float dst) {
+  if (dst <= 0) {
+    return glm::vec3(0);
+  }
+  return offset * (smoothingKernelDerivative(r, dst) / dst);
+}
+
 float FlowFinity::smoothingViscosityKernel(float r, float dst) {
   float value = r * r - dst * dst;
   return value * value * value;
 }
 
+float FlowFinity::nearSmoothingKernel(float r, float dst) {
+  if (dst >= r) {
+    return 0;
+  }
+  float volume = M_PI * std::pow(r, 5) / 10;
+  return (r - dst) * (r - dst) * (r - dst) / volume;
+}
+
+float FlowFinity::nearSmoothingKernelDerivative(float r, float dst) {
+  if (dst >= r) {
+    return 0;
+  }
+  float scale = 30 / (M_PI * std::pow(r, 5));
+  return -scale * (r - dst) * (r - dst);
+}
+
 float FlowFinity::calculateDensity(int posIndex, float smoothingRadius,
                                    std::vector<int> &neighbors) {
   float density = 0;
@@ -55,6 +80,14 @@ float FlowFinity::calculateDensity(glm::vec3 pos, int neighborIndex,
   return mass * influence;
 }
 
+float FlowFinity::calculateNearDensity(glm::vec3 pos, int neighborIndex,
+                                       float smoothingRadius) {
+  const float mass = 1;
+
+  float dst = glm::distance(pos, (*m_positions)[neighborIndex]);
+  return mass * nearSmoothingKernel(smoothingRadius, dst);
+}
+
 glm::vec3 getRandomDir() {
   float x = (rand() % 100) / 100.0f;
   float y = (rand() % 100) / 100.0f;
@@ -81,8 +114,19 @@ glm::vec3 FlowFinity::CalulatePressureForce(int posIndex, int neighborIndex,
       m_pressureMultiplier * ((*m_densities)[posIndex] - m_targetDensity);
 
   float sharedPressure = pressureA + pressureB / 2.f;
-
-  return -sharedPressure * dir * slope * mass / density;
+  glm::vec3 force = -sharedPressure * dir * slope * mass / density;
+
+  // Near pressure only ever pushes apart, and the closer the harder
+  if (m_nearPressureMultiplier > 0 && m_nearDensities) {
+    float nearDensity = (*m_nearDensities)[neighborIndex];
+    float sharedNearPressure =
+        m_nearPressureMultiplier *
+        (nearDensity + (*m_nearDensities)[posIndex]) / 2.f;
+    force -= sharedNearPressure * dir *
+             nearSmoothingKernelDerivative(smoothingRadius, dst) * mass /
+             nearDensity;
+  }
+  return force;
 }
 
 glm::vec3 FlowFinity::CalulatePressureForce(int posIndex, float smoothingRadius,
@@ -112,14 +156,18 @@ glm::vec3 FlowFinity::CalulatePressureForce(int posIndex, float smoothingRadius,
   return pressureForce;
 }
 
-void FlowFinity::setPositions(std::vector<glm::vec3> *positions) {
+void FlowFinity::setPositions(ParticleArray<glm::vec3> *positions) {
   m_positions = positions;
 }
 
-void FlowFinity::setDensities(std::vector<float> *densities) {
+void FlowFinity::setDensities(ParticleArray<float> *densities) {
   m_densities = densities;
 }
 
+void FlowFinity::setNearDensities(ParticleArray<float> *nearDensities) {
+  m_nearDensities = nearDensities;
+}
+
 void FlowFinity::setTargetDensity(float targetDensity) {
   m_targetDensity = targetDensity;
 }
@@ -127,3 +175,7 @@ void FlowFinity::setTargetDensity(float targetDensity) {
 void FlowFinity::setPressureMultiplier(float pressureMultiplier) {
   m_pressureMultiplier = pressureMultiplier;
 }
+
+void FlowFinity::setNearPressureMultiplier(float nearPressureMultiplier) {
+  m_nearPressureMultiplier = nearPressureMultiplier;
+}
@@ -0,0 +1,189 @@
+#include "knnsearch.h"
+#include "spatialhash.h"
+
+#include <glm/geometric.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+// Most cells a query walks before it checks every particle instead
+static const int MAX_RING_CELLS = 1024;
+
+// The candidates of a query are a max-heap in its output arrays, with the
+// squared distances in place of the distances until the query is done
+static void siftDown(int *indices, float *sqrDistances, int i, int size) {
+  while (true) {
+    int largest = i;
+    int left = 2 * i + 1;
+    int right = left + 1;
+    if (left < size && sqrDistances[left] > sqrDistances[largest]) {
+      largest = left;
+    }
+    if (right < size && sqrDistances[right] > sqrDistances[largest]) {
+      largest = right;
+    }
+    if (largest == i) {
+      return;
+    }
+    std::swap(indices[i], indices[largest]);
+    std::swap(sqrDistances[i], sqrDistances[largest]);
+    i = largest;
+  }
+}
+
+// Add a candidate to a heap of up to k, replacing the farthest one if full
+static void pushCandidate(int *indices, float *sqrDistances, int &size, int k,
+                          int index, float sqrDst) {
+  if (size < k) {
+    int i = size++;
+    indices[i] = index;
+    sqrDistances[i] = sqrDst;
+    while (i > 0) {
+      int parent = (i - 1) / 2;
+      if (sqrDistances[parent] >= sqrDistances[i]) {
+        break;
+      }
+      std::swap(indices[i], indices[parent]);
+      std::swap(sqrDistances[i], sqrDistances[parent]);
+      i = parent;
+    }
+  } else if (sqrDst < sqrDistances[0]) {
+    indices[0] = index;
+    sqrDistances[0] = sqrDst;
+    siftDown(indices, sqrDistances, 0, size);
+  }
+}
+
+// Turn the heap into the result, closest first and with real distances
+static void finishCandidates(int *indices, float *sqrDistances, int size) {
+  for (int end = size - 1; end > 0; end--) {
+    std::swap(indices[0], indices[end]);
+    std::swap(sqrDistances[0], sqrDistances[end]);
+    siftDown(indices, sqrDistances, 0, end);
+  }
+  for (int i = 0; i < size; i++) {
+    sqrDistances[i] = std::sqrt(sqrDistances[i]);
+  }
+}
+
+KnnSearch::KnnSearch(const std::vector<std::pair<int, int>> &hash,
+                     int hashCount, const std::vector<int> &startIndices,
+                     float cellSize, const glm::vec3 *positions,
+                     const ParticlePool &pool)
+    : m_hash(hash), m_hashCount(hashCount), m_startIndices(startIndices),
+      m_cellSize(cellSize), m_positions(positions), m_pool(pool) {}
+
+int KnnSearch::nearest(glm::vec3 pos, int k, int *indices,
+                       float *distances) const {
+  if (k <= 0 || m_pool.liveCount() == 0 || m_hashCount == 0) {
+    return 0;
+  }
+  unsigned int numKeys = m_hash.size();
+  glm::vec2 center = positionToCell(pos, m_cellSize);
+  // Keys walked so far, sorted. Cells whose keys collide share a bucket,
+  // which must only be walked once
+  unsigned int visited[MAX_RING_CELLS];
+  int numVisited = 0;
+  int size = 0;
+  auto walkCell = [&](glm::vec2 cell) {
+    unsigned int key = hashCell(cell) % numKeys;
+    unsigned int *slot = std::lower_bound(visited, visited + numVisited, key);
+    if (slot != visited + numVisited && *slot == key) {
+      return;
+    }
+    std::copy_backward(slot, visited + numVisited, visited + numVisited + 1);
+    *slot = key;
+    numVisited++;
+    for (int i = m_startIndices[key]; i < m_hashCount; i++) {
+      if ((unsigned int)m_hash[i].first != key) {
+        break;
+      }
+      int particle = m_hash[i].second;
+      // Particles freed since the hash was built
+      if (!m_pool.isAlive(particle)) {
+        continue;
+      }
+      glm::vec3 offset = m_positions[particle] - pos;
+      pushCandidate(indices, distances, size, k, particle,
+                    glm::dot(offset, offset));
+    }
+  };
+
+  for (int ring = 0;; ring++) {
+    // Every cell up to this ring could be a new key
+    int side = 2 * ring + 1;
+    if (side * side > MAX_RING_CELLS) {
+      return nearestBruteForce(pos, k, indices, distances);
+    }
+    if (ring == 0) {
+      walkCell(center);
+    } else {
+      for (int d = -ring; d <= ring; d++) {
+        walkCell(center + glm::vec2(d, -ring));
+        walkCell(center + glm::vec2(d, ring));
+      }
+      for (int d = -ring + 1; d < ring; d++) {
+        walkCell(center + glm::vec2(-ring, d));
+        walkCell(center + glm::vec2(ring, d));
+      }
+    }
+    // Cells past this ring are at least ring cells away, and once every key
+    // has been walked there is nothing left to find
+    float reach = ring * m_cellSize;
+    if ((size == k && distances[0] <= reach * reach) ||
+        (unsigned int)numVisited == numKeys) {
+      break;
+    }
+  }
+  finishCandidates(indices, distances, size);
+  return size;
+}
+
+int KnnSearch::nearestBruteForce(glm::vec3 pos, int k, int *indices,
+                                 float *distances) const {
+  int size = 0;
+  for (int i = 0; i < m_pool.highWater(); i++) {
+    if (!m_pool.isAlive(i)) {
+      continue;
+    }
+    glm::vec3 offset = m_positions[i] - pos;
+    pushCandidate(indices, distances, size, k, i, glm::dot(offset, offset));
+  }
+  finishCandidates(indices, distances, size);
+  return size;
+}
+
+void KnnSearch::nearest(const std::vector<glm::vec3> &points, int k,
+                        ThreadPool &pool, std::vector<int> &offsets,
+                        std::vector<int> &indices,
+                        std::vector<float> &distances) const {
+  int count = points.size();
+  k = std::max(k, 0);
+  offsets.resize(count + 1);
+  indices.resize((size_t)count * k);
+  distances.resize((size_t)count * k);
+  // Every point fills its own block of k, the counts go after the offsets
+  // they will be summed into
+  offsets[0] = 0;
+  pool.parallelFor(0, count, [&](int i) {
+    offsets[i + 1] = nearest(points[i], k, indices.data() + (size_t)i * k,
+                             distances.data() + (size_t)i * k);
+  });
+  // Close the gaps of points with fewer than k neighbors. Blocks only ever
+  // move towards the front, so no block is overwritten before it is moved
+  int total = 0;
+  for (int i = 0; i < count; i++) {
+    int found = offsets[i + 1];
+    size_t block = (size_t)i * k;
+    if (total != (int)block) {
+      std::copy(indices.begin() + block, indices.begin() + block + found,
+                indices.begin() + total);
+      std::copy(distances.begin() + block, distances.begin() + block + found,
+                distances.begin() + total);
+    }
+    total += found;
+    offsets[i + 1] = total;
+  }
+  indices.resize(total);
+  distances.resize(total);
+}
@@ -0,0 +1,58 @@
+#include "particlepool.h"
+
+#include <algorithm>
+
+ParticlePool::ParticlePool()
+    : m_alive(), m_freeList(), m_highWater(0), m_liveCount(0) {}
+
+ParticlePool::~ParticlePool() {}
+
+void ParticlePool::reset(int capacity, int count) {
+  m_alive.assign(capacity, 0);
+  std::fill(m_alive.begin(), m_alive.begin() + count, 1);
+  // The free list can never hold more than every slot, reserving it up front
+  // keeps release() from allocating
+  m_freeList.clear();
+  m_freeList.reserve(capacity);
+  m_highWater = count;
+  m_liveCount = count;
+}
+
+int ParticlePool::allocate() {
+  int index;
+  if (!m_freeList.empty()) {
+    index = m_freeList.back();
+    m_freeList.pop_back();
+  } else if (m_highWater < (int)m_alive.size()) {
+    index = m_highWater++;
+  } else {
+    return -1;
+  }
+  m_alive[index] = 1;
+  m_liveCount++;
+  return index;
+}
+
+void ParticlePool::release(int index) {
+  if (!m_alive[index]) {
+    return;
+  }
+  m_alive[index] = 0;
+  m_liveCount--;
+  m_freeList.push_back(index);
+}
+
+bool ParticlePool::isAlive(int index) const { return m_alive[index]; }
+
+int ParticlePool::capacity() const { return (int)m_alive.size(); }
+
+int ParticlePool::liveCount() const { return m_liveCount; }
+
+int ParticlePool::highWater() const { return m_highWater; }
+
+float ParticlePool::fragmentation() const {
+  if (m_highWater == 0) {
+    return 0;
+  }
+  return 1 - m_liveCount / (float)m_highWater;
+}
@@ -0,0 +1,253 @@
+#include "rigidbody.h"
+#include "flowfinity.h"
+
+#include <glm/ext/scalar_constants.hpp>
+#include <glm/geometric.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+// Sides of the polygon circles are drawn with
+static const int CIRCLE_SIDES = 40;
+// Coulomb friction of the bodies against the walls
+static const float WALL_FRICTION = 0.3f;
+
+static float cross(glm::vec2 a, glm::vec2 b) { return a.x * b.y - a.y * b.x; }
+
+static glm::vec2 rotate(glm::vec2 v, float angle) {
+  float c = std::cos(angle);
+  float s = std::sin(angle);
+  return glm::vec2(c * v.x - s * v.y, s * v.x + c * v.y);
+}
+
+RigidBody::RigidBody(const Obstacle &shape, float density)
+    : m_radius(0), m_corners(), m_position(0), m_angle(0), m_velocity(0),
+      m_angularVelocity(0), m_mass(1), m_inertia(1), m_force(0), m_torque(0),
+      m_samples(), m_sampleVolumes() {
+  if (shape.shape == ObstacleShape::Circle) {
+    m_radius = shape.size;
+    m_position = shape.points[0];
+    m_mass = density * glm::pi<float>() * m_radius * m_radius;
+    m_inertia = m_mass * m_radius * m_radius / 2;
+  } else {
+    std::vector<glm::vec2> corners = shape.points;
+    if (shape.shape == ObstacleShape::Box) {
+      glm::vec2 min = glm::min(shape.points[0], shape.points[1]);
+      glm::vec2 max = glm::max(shape.points[0], shape.points[1]);
+      corners = {min, glm::vec2(max.x, min.y), max, glm::vec2(min.x, max.y)};
+    }
+    // Area and centroid of the polygon
+    float area = 0;
+    glm::vec2 centroid(0);
+    for (size_t i = 0; i < corners.size(); i++) {
+      glm::vec2 a = corners[i];
+      glm::vec2 b = corners[(i + 1) % corners.size()];
+      area += cross(a, b) / 2;
+      centroid += (a + b) * cross(a, b) / 6.f;
+    }
+    if (area < 0) {
+      std::reverse(corners.begin(), corners.end());
+      area = -area;
+      centroid = -centroid;
+    }
+    area = std::max(area, 1e-6f);
+    m_position = centroid / area;
+    // Polar moment of area around the centroid
+    float moment = 0;
+    for (size_t i = 0; i < corners.size(); i++) {
+      glm::vec2 a = corners[i] - m_position;
+      glm::vec2 b = corners[(i + 1) % corners.size()] - m_position;
+      moment += cross(a, b) *
+                (glm::dot(a, a) + glm::dot(a, b) + glm::dot(b, b)) / 12;
+      m_corners.push_back(a);
+    }
+    m_mass = density * area;
+    m_inertia = density * moment;
+  }
+  m_mass = std::max(m_mass, 1e-6f);
+  m_inertia = std::max(m_inertia, 1e-6f);
+}
+
+RigidBody::~RigidBody() {}
+
+void RigidBody::sampleBoundary(float spacing, float radius,
+                               float restDensity) {
+  spacing = std::max(spacing, 1e-3f);
+  m_samples.clear();
+  if (m_corners.empty()) {
+    int count = std::max(
+        3, (int)std::ceil(2 * glm::pi<float>() * m_radius / spacing));
+    for (int i = 0; i < count; i++) {
+      float angle = 2 * glm::pi<float>() * i / count;
+      m_samples.push_back(m_radius *
+                          glm::vec2(std::cos(angle), std::sin(angle)));
+    }
+  } else {
+    for (size_t i = 0; i < m_corners.size(); i++) {
+      glm::vec2 a = m_corners[i];
+      glm::vec2 b = m_corners[(i + 1) % m_corners.size()];
+      int count = std::max(1, (int)std::ceil(glm::length(b - a) / spacing));
+      for (int j = 0; j < count; j++) {
+        m_samples.push_back(a + (b - a) * (j / (float)count));
+      }
+    }
+  }
+
+  // A sample surrounded by many others stands for a smaller part of the wall
+  m_sampleVolumes.resize(m_samples.size());
+  for (size_t i = 0; i < m_samples.size(); i++) {
+    float density = 0;
+    for (const glm::vec2 &sample : m_samples) {
+      density += FlowFinity::smoothingKernel(
+          radius, glm::length(m_samples[i] - sample));
+    }
+    m_sampleVolumes[i] = restDensity / std::max(density, 1e-6f);
+  }
+}
+
+glm::vec2 RigidBody::toWorld(glm::vec2 local) const {
+  return m_position + rotate(local, m_angle);
+}
+
+glm::vec2 RigidBody::velocityAt(glm::vec2 pos) const {
+  glm::vec2 arm = pos - m_position;
+  return m_velocity + m_angularVelocity * glm::vec2(-arm.y, arm.x);
+}
+
+float RigidBody::signedDistance(glm::vec2 pos, glm::vec2 &normal) const {
+  glm::vec2 local = rotate(pos - m_position, -m_angle);
+  if (m_corners.empty()) {
+    float length = glm::length(local);
+    normal = length > 0 ? rotate(local / length, m_angle) : glm::vec2(0, 1);
+    return length - m_radius;
+  }
+
+  float closest = INFINITY;
+  glm::vec2 closestPoint(0);
+  glm::vec2 closestEdge(1, 0);
+  bool inside = false;
+  for (size_t i = 0, j = m_corners.size() - 1; i < m_corners.size(); j = i++) {
+    glm::vec2 a = m_corners[j];
+    glm::vec2 b = m_corners[i];
+    glm::vec2 edge = b - a;
+    float lengthSq = std::max(glm::dot(edge, edge), 1e-12f);
+    float t = glm::clamp(glm::dot(local - a, edge) / lengthSq, 0.f, 1.f);
+    glm::vec2 point = a + t * edge;
+    float distance = glm::length(local - point);
+    if (distance < closest) {
+      closest = distance;
+      closestPoint = point;
+      closestEdge = edge;
+    }
+    // Count the edges a ray to the right of the position crosses
+    if ((a.y > local.y) != (b.y > local.y) &&
+        local.x < a.x + (local.y - a.y) / (b.y - a.y) * (b.x - a.x)) {
+      inside = !inside;
+    }
+  }
+  glm::vec2 outward =
+      closest > 1e-6f
+          ? (local - closestPoint) / closest
+          : glm::normalize(glm::vec2(closestEdge.y, -closestEdge.x));
+  if (inside) {
+    outward = -outward;
+    closest = -closest;
+  }
+  normal = rotate(outward, m_angle);
+  return closest;
+}
+
+float RigidBody::effectiveMass(glm::vec2 pos, glm::vec2 direction) const {
+  float arm = cross(pos - m_position, direction);
+  return 1 / (1 / m_mass + arm * arm / m_inertia);
+}
+
+void RigidBody::applyForce(glm::vec2 pos, glm::vec2 force) {
+  m_force += force;
+  m_torque += cross(pos - m_position, force);
+}
+
+void RigidBody::applyImpulse(glm::vec2 pos, glm::vec2 impulse) {
+  m_velocity += impulse / m_mass;
+  m_angularVelocity += cross(pos - m_position, impulse) / m_inertia;
+}
+
+void RigidBody::integrate(float dt, float gravity) {
+  m_velocity += (m_force / m_mass + glm::vec2(0, gravity)) * dt;
+  m_angularVelocity += m_torque / m_inertia * dt;
+  m_position += m_velocity * dt;
+  m_angle += m_angularVelocity * dt;
+  m_force = glm::vec2(0);
+  m_torque = 0;
+}
+
+void RigidBody::collideWithBounds(glm::vec2 bounds, float restitution) {
+  for (int axis = 0; axis < 2; axis++) {
+    for (float side : {-1.f, 1.f}) {
+      // Deepest point of the outline behind this wall
+      glm::vec2 deepest = m_position;
+      deepest[axis] += side * m_radius;
+      for (const glm::vec2 &corner : m_corners) {
+        glm::vec2 point = toWorld(corner);
+        if (side * point[axis] > side * deepest[axis]) {
+          deepest = point;
+        }
+      }
+      float depth = side * deepest[axis] - bounds[axis];
+      if (depth <= 0) {
+        continue;
+      }
+      m_position[axis] -= side * depth;
+      deepest[axis] -= side * depth;
+
+      glm::vec2 normal(0);
+      normal[axis] = -side;
+      float normalVelocity = glm::dot(velocityAt(deepest), normal);
+      if (normalVelocity >= 0) {
+        continue;
+      }
+      float impulse =
+          -(1 + restitution) * normalVelocity * effectiveMass(deepest, normal);
+      applyImpulse(deepest, impulse * normal);
+
+      glm::vec2 tangent(-normal.y, normal.x);
+      float friction = -glm::dot(velocityAt(deepest), tangent) *
+                       effectiveMass(deepest, tangent);
+      friction = glm::clamp(friction, -WALL_FRICTION * impulse,
+                            WALL_FRICTION * impulse);
+      applyImpulse(deepest, friction * tangent);
+    }
+  }
+}
+
+glm::vec2 RigidBody::position() const { return m_position; }
+
+float RigidBody::angle() const { return m_angle; }
+
+float RigidBody::mass() const { return m_mass; }
+
+float RigidBody::boundingRadius() const {
+  float radius = m_radius;
+  for (const glm::vec2 &corner : m_corners) {
+    radius = std::max(radius, glm::length(corner));
+  }
+  return radius;
+}
+
+const std::vector<glm::vec2> &RigidBody::samples() const { return m_samples; }
+
+const std::vector<float> &RigidBody::sampleVolumes() const {
+  return m_sampleVolumes;
+}
+
+std::vector<glm::vec2> RigidBody::outline() const {
+  if (!m_corners.empty()) {
+    return m_corners;
+  }
+  std::vector<glm::vec2> points;
+  for (int i = 0; i < CIRCLE_SIDES; i++) {
+    float angle = 2 * glm::pi<float>() * i / CIRCLE_SIDES;
+    points.push_back(m_radius * glm::vec2(std::cos(angle), std::sin(angle)));
+  }
+  return points;
+}
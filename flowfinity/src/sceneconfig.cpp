@@ -0,0 +1,489 @@
+#include "sceneconfig.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+// Number of colors the velocity gradient in the instanced shader expects
+static const int NUM_COLORS = 6;
+// Names of the solver modes in scene files, in the order of SolverMode
+static const char *SOLVER_NAMES[] = {"wcsph", "pcisph", "dfsph", "pbf"};
+static const int NUM_SOLVERS = 4;
+// Names of the obstacle modes in scene files, in the order of ObstacleMode
+static const char *OBSTACLE_MODE_NAMES[] = {"sdf", "bvh"};
+static const int NUM_OBSTACLE_MODES = 2;
+// Number of phases including the base fluid the instanced shader has colors for
+static const int MAX_PHASES = 8;
+// Deepest chain of obstacle files, so a file including itself fails
+static const int MAX_INCLUDE_DEPTH = 8;
+
+// Read x y pairs up to the end of the line
+static bool readPoints(std::istringstream &values,
+                       std::vector<glm::vec2> &points) {
+  glm::vec2 point;
+  while (values >> point.x) {
+    if (!(values >> point.y)) {
+      return false;
+    }
+    points.push_back(point);
+  }
+  // Only running out of values may end the list
+  if (!values.eof()) {
+    return false;
+  }
+  values.clear();
+  return true;
+}
+
+// Read the phase at the end of a block or emitter line, missing means the base
+// fluid
+static void readPhase(std::istringstream &values, int &phase) {
+  phase = 0;
+  if (!values.fail() && !(values >> phase) && values.eof()) {
+    values.clear();
+    phase = 0;
+  }
+}
+
+// Scene Config Constructor (Default Values)
+SceneConfig::SceneConfig()
+    : numInstances(2000), capacity(0), particleSize(0.04f),
+      particleDamping(0.96f), particleSpacing(0.05f), densityRadius(0.26f),
+      targetDensity(1.2f), pressureMultiplier(19.5f),
+      nearPressureMultiplier(0.0f), gravity(-9.8f),
+      inputRadius(1.0f), inputStrengthMultiplier(6.0f),
+      viscosityStrength(0.075f), randomLocation(false), autoStart(false),
+      adaptiveTimestep(false), cflFactor(0.4f), forceFactor(0.25f),
+      viscosityFactor(0.5f), minTimestep(0.0005f), maxTimestep(1 / 60.f),
+      maxSubsteps(8), solverMode(SolverMode::WCSPH), solverTolerance(0.01f),
+      solverIterations(50), warmStart(true), pbfIterations(4),
+      pbfRelaxation(1.0f), xsphViscosity(0.01f), sleeping(false),
+      sleepVelocity(0.05f), sleepDensityChange(0.002f), sleepSteps(30),
+      obstacleMode(ObstacleMode::SDF), obstacleCellSize(0.05f),
+      particleSprites(true), surfaceRendering(false), surfaceResolution(240),
+      surfaceThreshold(0.5f), surfaceOutline(false), outlineTolerance(0.02f),
+      bounds(7.5f, 4.0f),
+      colors{glm::vec3(0.03f, 0.29f, 0.86f), glm::vec3(0.26f, 0.75f, 0.87f),
+             glm::vec3(0.19f, 0.79f, 0.62f), glm::vec3(0.6f, 0.98f, 0.49f),
+             glm::vec3(0.99f, 0.82f, 0.03f), glm::vec3(0.68f, 0.12f, 0.07f)},
+      blocks(), emitters(), sinks(), phases(), obstacles(), bodies() {}
+
+bool SceneConfig::load(const std::string &path, int includeDepth) {
+  // Parse into a copy, so a bad value halfway through changes nothing
+  SceneConfig scene(*this);
+  if (!scene.parse(path, includeDepth)) {
+    return false;
+  }
+  *this = scene;
+  return true;
+}
+
+bool SceneConfig::parse(const std::string &path, int includeDepth) {
+  std::ifstream file(path);
+  if (file.fail()) {
+    std::cerr << "Failed to open scene file: " << path << std::endl;
+    return false;
+  }
+
+  // Lists in the file replace the defaults instead of appending to them
+  std::vector<glm::vec3> fileColors;
+  std::vector<ParticleBlock> fileBlocks;
+  std::vector<ParticleEmitter> fileEmitters;
+  std::vector<ParticleSink> fileSinks;
+  std::vector<FluidPhase> filePhases;
+  std::vector<Obstacle> fileObstacles;
+  std::vector<DynamicBody> fileBodies;
+
+  std::string line;
+  int lineNumber = 0;
+  while (std::getline(file, line)) {
+    lineNumber++;
+    // Strip comments
+    size_t comment = line.find('#');
+    if (comment != std::string::npos) {
+      line.erase(comment);
+    }
+
+    std::istringstream values(line);
+    std::string key;
+    if (!(values >> key)) {
+      // Empty line
+      continue;
+    }
+
+    if (key == "instances") {
+      values >> numInstances;
+    } else if (key == "capacity") {
+      values >> capacity;
+    } else if (key == "particleSize") {
+      values >> particleSize;
+    } else if (key == "particleDamping") {
+      values >> particleDamping;
+    } else if (key == "particleSpacing") {
+      values >> particleSpacing;
+    } else if (key == "densityRadius") {
+      values >> densityRadius;
+    } else if (key == "targetDensity") {
+      values >> targetDensity;
+    } else if (key == "pressureMultiplier") {
+      values >> pressureMultiplier;
+    } else if (key == "nearPressureMultiplier") {
+      values >> nearPressureMultiplier;
+    } else if (key == "gravity") {
+      values >> gravity;
+    } else if (key == "inputRadius") {
+      values >> inputRadius;
+    } else if (key == "inputStrengthMultiplier") {
+      values >> inputStrengthMultiplier;
+    } else if (key == "viscosity") {
+      values >> viscosityStrength;
+    } else if (key == "randomLocation") {
+      values >> randomLocation;
+    } else if (key == "autoStart") {
+      values >> autoStart;
+    } else if (key == "adaptiveTimestep") {
+      values >> adaptiveTimestep;
+    } else if (key == "cflFactor") {
+      values >> cflFactor;
+    } else if (key == "forceFactor") {
+      values >> forceFactor;
+    } else if (key == "viscosityFactor") {
+      values >> viscosityFactor;
+    } else if (key == "timestepLimits") {
+      values >> minTimestep >> maxTimestep;
+    } else if (key == "maxSubsteps") {
+      values >> maxSubsteps;
+    } else if (key == "solver") {
+      std::string name;
+      values >> name;
+      int mode = 0;
+      while (mode < NUM_SOLVERS && name != SOLVER_NAMES[mode]) {
+        mode++;
+      }
+      if (mode == NUM_SOLVERS) {
+        values.setstate(std::ios::failbit);
+      } else {
+        solverMode = (SolverMode)mode;
+      }
+    } else if (key == "solverTolerance") {
+      values >> solverTolerance;
+    } else if (key == "solverIterations") {
+      values >> solverIterations;
+    } else if (key == "warmStart") {
+      values >> warmStart;
+    } else if (key == "pbfIterations") {
+      values >> pbfIterations;
+    } else if (key == "pbfRelaxation") {
+      values >> pbfRelaxation;
+    } else if (key == "xsph") {
+      values >> xsphViscosity;
+    } else if (key == "sleeping") {
+      values >> sleeping;
+    } else if (key == "sleepThresholds") {
+      values >> sleepVelocity >> sleepDensityChange;
+    } else if (key == "sleepSteps") {
+      values >> sleepSteps;
+    } else if (key == "obstacleMode") {
+      std::string name;
+      values >> name;
+      int mode = 0;
+      while (mode < NUM_OBSTACLE_MODES && name != OBSTACLE_MODE_NAMES[mode]) {
+        mode++;
+      }
+      if (mode == NUM_OBSTACLE_MODES) {
+        values.setstate(std::ios::failbit);
+      } else {
+        obstacleMode = (ObstacleMode)mode;
+      }
+    } else if (key == "obstacleCellSize") {
+      values >> obstacleCellSize;
+    } else if (key == "particleSprites") {
+      values >> particleSprites;
+    } else if (key == "surface") {
+      values >> surfaceRendering;
+    } else if (key == "surfaceResolution") {
+      values >> surfaceResolution;
+    } else if (key == "surfaceThreshold") {
+      values >> surfaceThreshold;
+    } else if (key == "surfaceOutline") {
+      values >> surfaceOutline;
+    } else if (key == "outlineTolerance") {
+      values >> outlineTolerance;
+    } else if (key == "bounds") {
+      values >> bounds.x >> bounds.y;
+    } else if (key == "color") {
+      glm::vec3 color;
+      values >> color.x >> color.y >> color.z;
+      fileColors.push_back(color);
+    } else if (key == "block") {
+      ParticleBlock block;
+      values >> block.min.x >> block.min.y >> block.max.x >> block.max.y >>
+          block.count;
+      readPhase(values, block.phase);
+      fileBlocks.push_back(block);
+    } else if (key == "emitter") {
+      ParticleEmitter emitter;
+      values >> emitter.min.x >> emitter.min.y >> emitter.max.x >>
+          emitter.max.y >> emitter.rate >> emitter.velocity.x >>
+          emitter.velocity.y;
+      readPhase(values, emitter.phase);
+      fileEmitters.push_back(emitter);
+    } else if (key == "sink") {
+      ParticleSink sink;
+      values >> sink.min.x >> sink.min.y >> sink.max.x >> sink.max.y;
+      fileSinks.push_back(sink);
+    } else if (key == "phase") {
+      FluidPhase phase;
+      values >> phase.density >> phase.viscosity >> phase.color.x >>
+          phase.color.y >> phase.color.z;
+      filePhases.push_back(phase);
+    } else if (key == "circle") {
+      Obstacle circle{ObstacleShape::Circle, {glm::vec2(0)}, 0};
+      values >> circle.points[0].x >> circle.points[0].y >> circle.size;
+      fileObstacles.push_back(circle);
+    } else if (key == "box") {
+      Obstacle box{ObstacleShape::Box, {glm::vec2(0), glm::vec2(0)}, 0};
+      values >> box.points[0].x >> box.points[0].y >> box.points[1].x >>
+          box.points[1].y;
+      fileObstacles.push_back(box);
+    } else if (key == "polygon") {
+      Obstacle polygon{ObstacleShape::Polygon, {}, 0};
+      if (!readPoints(values, polygon.points) || polygon.points.size() < 3) {
+        values.setstate(std::ios::failbit);
+      }
+      fileObstacles.push_back(polygon);
+    } else if (key == "polyline") {
+      Obstacle polyline{ObstacleShape::Polyline, {}, 0};
+      values >> polyline.size;
+      if (!readPoints(values, polyline.points) ||
+          polyline.points.size() < 2) {
+        values.setstate(std::ios::failbit);
+      }
+      fileObstacles.push_back(polyline);
+    } else if (key == "body") {
+      std::string shape;
+      values >> shape;
+      DynamicBody body{{ObstacleShape::Circle, {}, 0}, 1};
+      if (shape == "circle") {
+        body.shape.points.resize(1);
+        values >> body.shape.points[0].x >> body.shape.points[0].y >>
+            body.shape.size >> body.density;
+      } else if (shape == "box") {
+        body.shape.shape = ObstacleShape::Box;
+        body.shape.points.resize(2);
+        values >> body.shape.points[0].x >> body.shape.points[0].y >>
+            body.shape.points[1].x >> body.shape.points[1].y >> body.density;
+      } else if (shape == "polygon") {
+        body.shape.shape = ObstacleShape::Polygon;
+        values >> body.density;
+        if (!readPoints(values, body.shape.points) ||
+            body.shape.points.size() < 3) {
+          values.setstate(std::ios::failbit);
+        }
+      } else {
+        values.setstate(std::ios::failbit);
+      }
+      fileBodies.push_back(body);
+    } else if (key == "obstacles") {
+      // Obstacles from another scene file, relative to this one
+      std::string obstaclePath;
+      values >> obstaclePath;
+      size_t slash = path.find_last_of("/\\");
+      if (obstaclePath[0] != '/' && slash != std::string::npos) {
+        obstaclePath = path.substr(0, slash + 1) + obstaclePath;
+      }
+      if (!values.fail() && includeDepth >= MAX_INCLUDE_DEPTH) {
+        std::cerr << path << ":" << lineNumber
+                  << ": obstacle files nested more than " << MAX_INCLUDE_DEPTH
+                  << " deep, is one including itself?" << std::endl;
+        return false;
+      }
+      SceneConfig obstacleScene;
+      if (!values.fail() &&
+          !obstacleScene.load(obstaclePath, includeDepth + 1)) {
+        return false;
+      }
+      fileObstacles.insert(fileObstacles.end(),
+                           obstacleScene.obstacles.begin(),
+                           obstacleScene.obstacles.end());
+    } else {
+      std::cerr << path << ":" << lineNumber << ": unknown key '" << key
+                << "'" << std::endl;
+      continue;
+    }
+
+    if (values.fail()) {
+      std::cerr << path << ":" << lineNumber << ": bad value for '" << key
+                << "'" << std::endl;
+      return false;
+    }
+  }
+
+  if (!fileColors.empty()) {
+    if (fileColors.size() != NUM_COLORS) {
+      std::cerr << path << ": expected " << NUM_COLORS << " colors, got "
+                << fileColors.size() << std::endl;
+      return false;
+    }
+    colors = fileColors;
+  }
+  if (!filePhases.empty()) {
+    if ((int)filePhases.size() >= MAX_PHASES) {
+      std::cerr << path << ": at most " << MAX_PHASES - 1
+                << " phases besides the base fluid, got " << filePhases.size()
+                << std::endl;
+      return false;
+    }
+    phases = filePhases;
+  }
+  if (!fileBlocks.empty()) {
+    blocks = fileBlocks;
+  }
+  if (!fileEmitters.empty()) {
+    emitters = fileEmitters;
+  }
+  // Blocks and emitters may only use the phases of the scene
+  for (const ParticleBlock &block : blocks) {
+    if (block.phase < 0 || block.phase > (int)phases.size()) {
+      std::cerr << path << ": block uses unknown phase " << block.phase
+                << std::endl;
+      return false;
+    }
+  }
+  for (const ParticleEmitter &emitter : emitters) {
+    if (emitter.phase < 0 || emitter.phase > (int)phases.size()) {
+      std::cerr << path << ": emitter uses unknown phase " << emitter.phase
+                << std::endl;
+      return false;
+    }
+  }
+  if (!fileSinks.empty()) {
+    sinks = fileSinks;
+  }
+  if (!fileObstacles.empty()) {
+    obstacles = fileObstacles;
+  }
+  if (!fileBodies.empty()) {
+    bodies = fileBodies;
+  }
+  return true;
+}
+
+bool SceneConfig::save(const std::string &path) const {
+  std::ofstream file(path);
+  if (file.fail()) {
+    std::cerr << "Failed to write scene file: " << path << std::endl;
+    return false;
+  }
+
+  file << "instances " << numInstances << "\n";
+  file << "capacity " << capacity << "\n";
+  file << "particleSize " << particleSize << "\n";
+  file << "particleDamping " << particleDamping << "\n";
+  file << "particleSpacing " << particleSpacing << "\n";
+  file << "densityRadius " << densityRadius << "\n";
+  file << "targetDensity " << targetDensity << "\n";
+  file << "pressureMultiplier " << pressureMultiplier << "\n";
+  file << "nearPressureMultiplier " << nearPressureMultiplier << "\n";
+  file << "gravity " << gravity << "\n";
+  file << "inputRadius " << inputRadius << "\n";
+  file << "inputStrengthMultiplier " << inputStrengthMultiplier << "\n";
+  file << "viscosity " << viscosityStrength << "\n";
+  file << "randomLocation " << randomLocation << "\n";
+  file << "autoStart " << autoStart << "\n";
+  file << "adaptiveTimestep " << adaptiveTimestep << "\n";
+  file << "cflFactor " << cflFactor << "\n";
+  file << "forceFactor " << forceFactor << "\n";
+  file << "viscosityFactor " << viscosityFactor << "\n";
+  file << "timestepLimits " << minTimestep << " " << maxTimestep << "\n";
+  file << "maxSubsteps " << maxSubsteps << "\n";
+  file << "solver " << SOLVER_NAMES[(int)solverMode] << "\n";
+  file << "solverTolerance " << solverTolerance << "\n";
+  file << "solverIterations " << solverIterations << "\n";
+  file << "warmStart " << warmStart << "\n";
+  file << "pbfIterations " << pbfIterations << "\n";
+  file << "pbfRelaxation " << pbfRelaxation << "\n";
+  file << "xsph " << xsphViscosity << "\n";
+  file << "sleeping " << sleeping << "\n";
+  file << "sleepThresholds " << sleepVelocity << " " << sleepDensityChange
+       << "\n";
+  file << "sleepSteps " << sleepSteps << "\n";
+  file << "obstacleMode " << OBSTACLE_MODE_NAMES[(int)obstacleMode] << "\n";
+  file << "obstacleCellSize " << obstacleCellSize << "\n";
+  file << "particleSprites " << particleSprites << "\n";
+  file << "surface " << surfaceRendering << "\n";
+  file << "surfaceResolution " << surfaceResolution << "\n";
+  file << "surfaceThreshold " << surfaceThreshold << "\n";
+  file << "surfaceOutline " << surfaceOutline << "\n";
+  file << "outlineTolerance " << outlineTolerance << "\n";
+  file << "bounds " << bounds.x << " " << bounds.y << "\n";
+  for (const glm::vec3 &color : colors) {
+    file << "color " << color.x << " " << color.y << " " << color.z << "\n";
+  }
+  for (const FluidPhase &phase : phases) {
+    file << "phase " << phase.density << " " << phase.viscosity << " "
+         << phase.color.x << " " << phase.color.y << " " << phase.color.z
+         << "\n";
+  }
+  for (const ParticleBlock &block : blocks) {
+    file << "block " << block.min.x << " " << block.min.y << " " << block.max.x
+         << " " << block.max.y << " " << block.count << " " << block.phase
+         << "\n";
+  }
+  for (const ParticleEmitter &emitter : emitters) {
+    file << "emitter " << emitter.min.x << " " << emitter.min.y << " "
+         << emitter.max.x << " " << emitter.max.y << " " << emitter.rate << " "
+         << emitter.velocity.x << " " << emitter.velocity.y << " "
+         << emitter.phase << "\n";
+  }
+  for (const ParticleSink &sink : sinks) {
+    file << "sink " << sink.min.x << " " << sink.min.y << " " << sink.max.x
+         << " " << sink.max.y << "\n";
+  }
+  for (const Obstacle &obstacle : obstacles) {
+    switch (obstacle.shape) {
+    case ObstacleShape::Circle:
+      file << "circle " << obstacle.points[0].x << " " << obstacle.points[0].y
+           << " " << obstacle.size;
+      break;
+    case ObstacleShape::Box:
+      file << "box " << obstacle.points[0].x << " " << obstacle.points[0].y
+           << " " << obstacle.points[1].x << " " << obstacle.points[1].y;
+      break;
+    case ObstacleShape::Polygon:
+      file << "polygon";
+      break;
+    case ObstacleShape::Polyline:
+      file << "polyline " << obstacle.size;
+      break;
+    }
+    if (obstacle.shape == ObstacleShape::Polygon ||
+        obstacle.shape == ObstacleShape::Polyline) {
+      for (const glm::vec2 &point : obstacle.points) {
+        file << " " << point.x << " " << point.y;
+      }
+    }
+    file << "\n";
+  }
+  for (const DynamicBody &body : bodies) {
+    const std::vector<glm::vec2> &points = body.shape.points;
+    switch (body.shape.shape) {
+    case ObstacleShape::Box:
+      file << "body box " << points[0].x << " " << points[0].y << " "
+           << points[1].x << " " << points[1].y << " " << body.density;
+      break;
+    case ObstacleShape::Polygon:
+      file << "body polygon " << body.density;
+      for (const glm::vec2 &point : points) {
+        file << " " << point.x << " " << point.y;
+      }
+      break;
+    default:
+      file << "body circle " << points[0].x << " " << points[0].y << " "
+           << body.shape.size << " " << body.density;
+      break;
+    }
+    file << "\n";
+  }
+  return true;
+}
@@ -0,0 +1,120 @@
+#include "sdfgrid.h"
+
+#include <glm/geometric.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+// Distance of every node before an obstacle is added and of positions outside
+// the grid, finite so interpolating towards it stays well behaved
+static const float FAR_DISTANCE = 1e3f;
+
+// Distance from a point to the segment from a to b
+static float segmentDistance(glm::vec2 p, glm::vec2 a, glm::vec2 b) {
+  glm::vec2 ab = b - a;
+  float lengthSq = glm::dot(ab, ab);
+  float t = lengthSq > 0 ? glm::clamp(glm::dot(p - a, ab) / lengthSq, 0.f, 1.f)
+                         : 0.f;
+  return glm::length(p - (a + t * ab));
+}
+
+SdfGrid::SdfGrid()
+    : m_min(0), m_cellSize(1), m_cols(2), m_rows(2),
+      m_distances(4, FAR_DISTANCE), m_empty(true) {}
+
+SdfGrid::~SdfGrid() {}
+
+void SdfGrid::reset(glm::vec2 min, glm::vec2 max, float cellSize) {
+  m_min = min;
+  m_cellSize = std::max(cellSize, 1e-3f);
+  m_cols = std::max(1, (int)std::ceil((max.x - min.x) / m_cellSize)) + 1;
+  m_rows = std::max(1, (int)std::ceil((max.y - min.y) / m_cellSize)) + 1;
+  m_distances.assign(m_cols * m_rows, FAR_DISTANCE);
+  m_empty = true;
+}
+
+template <typename F> void SdfGrid::merge(const F &distance) {
+  for (int y = 0; y < m_rows; y++) {
+    for (int x = 0; x < m_cols; x++) {
+      glm::vec2 node = m_min + glm::vec2(x, y) * m_cellSize;
+      float &d = m_distances[y * m_cols + x];
+      d = std::min(d, distance(node));
+    }
+  }
+  m_empty = false;
+}
+
+void SdfGrid::addCircle(glm::vec2 center, float radius) {
+  merge([&](glm::vec2 p) { return glm::length(p - center) - radius; });
+}
+
+void SdfGrid::addBox(glm::vec2 min, glm::vec2 max) {
+  glm::vec2 center = (min + max) / 2.f;
+  glm::vec2 halfSize = glm::abs(max - min) / 2.f;
+  merge([&](glm::vec2 p) {
+    glm::vec2 q = glm::abs(p - center) - halfSize;
+    return glm::length(glm::max(q, glm::vec2(0))) +
+           std::min(std::max(q.x, q.y), 0.f);
+  });
+}
+
+void SdfGrid::addPolygon(const std::vector<glm::vec2> &points) {
+  if (points.size() < 3) {
+    return;
+  }
+  merge([&](glm::vec2 p) {
+    float d = FAR_DISTANCE;
+    bool inside = false;
+    for (size_t i = 0, j = points.size() - 1; i < points.size(); j = i++) {
+      const glm::vec2 &a = points[j];
+      const glm::vec2 &b = points[i];
+      d = std::min(d, segmentDistance(p, a, b));
+      // Count the edges a ray to the right of p crosses
+      if ((a.y > p.y) != (b.y > p.y) &&
+          p.x < a.x + (p.y - a.y) / (b.y - a.y) * (b.x - a.x)) {
+        inside = !inside;
+      }
+    }
+    return inside ? -d : d;
+  });
+}
+
+void SdfGrid::addPolyline(const std::vector<glm::vec2> &points,
+                          float thickness) {
+  if (points.size() < 2) {
+    return;
+  }
+  merge([&](glm::vec2 p) {
+    float d = FAR_DISTANCE;
+    for (size_t i = 1; i < points.size(); i++) {
+      d = std::min(d, segmentDistance(p, points[i - 1], points[i]));
+    }
+    return d - thickness / 2.f;
+  });
+}
+
+bool SdfGrid::empty() const { return m_empty; }
+
+float SdfGrid::sample(glm::vec2 pos, glm::vec2 &gradient) const {
+  glm::vec2 cell = (pos - m_min) / m_cellSize;
+  if (cell.x < 0 || cell.y < 0 || cell.x > m_cols - 1 || cell.y > m_rows - 1) {
+    gradient = glm::vec2(0);
+    return FAR_DISTANCE;
+  }
+  int x = std::min((int)cell.x, m_cols - 2);
+  int y = std::min((int)cell.y, m_rows - 2);
+  float tx = cell.x - x;
+  float ty = cell.y - y;
+
+  const float *row = &m_distances[y * m_cols + x];
+  float d00 = row[0];
+  float d10 = row[1];
+  float d01 = row[m_cols];
+  float d11 = row[m_cols + 1];
+
+  // Derivative of the bilinear interpolation
+  gradient.x = ((d10 - d00) * (1 - ty) + (d11 - d01) * ty) / m_cellSize;
+  gradient.y = ((d01 - d00) * (1 - tx) + (d11 - d10) * tx) / m_cellSize;
+  return (d00 * (1 - tx) + d10 * tx) * (1 - ty) +
+         (d01 * (1 - tx) + d11 * tx) * ty;
+}
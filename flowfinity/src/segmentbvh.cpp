@@ -0,0 +1,279 @@
+#include "segmentbvh.h"
+
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+// Leaves with up to this many segments are never split
+static const int MIN_SPLIT_SEGMENTS = 3;
+// Leaves with more segments are split even if the heuristic disagrees
+static const int MAX_LEAF_SEGMENTS = 8;
+// Centroid bins the split candidates are taken from
+static const int NUM_BINS = 16;
+// Nodes deeper than this are split at the median, which bounds the depth of
+// the tree and with it the traversal stack
+static const int MAX_SAH_DEPTH = 32;
+static const int STACK_SIZE = 64;
+
+static float cross(glm::vec2 a, glm::vec2 b) { return a.x * b.y - a.y * b.x; }
+
+// Half the perimeter of a box, the 2D counterpart of its surface area
+static float halfPerimeter(glm::vec2 min, glm::vec2 max) {
+  glm::vec2 size = glm::max(max - min, glm::vec2(0));
+  return size.x + size.y;
+}
+
+SegmentBvh::SegmentBvh() : m_segments(), m_nodes() {}
+
+SegmentBvh::~SegmentBvh() {}
+
+void SegmentBvh::build(const std::vector<glm::vec2> &points,
+                       const std::vector<float> &radii) {
+  m_segments.clear();
+  m_nodes.clear();
+  for (size_t i = 0; i + 1 < points.size(); i += 2) {
+    m_segments.push_back({points[i], points[i + 1], radii[i / 2]});
+  }
+  if (m_segments.empty()) {
+    return;
+  }
+  // A binary tree over n leaves has fewer than 2n nodes
+  m_nodes.reserve(2 * m_segments.size());
+  buildNode(0, m_segments.size(), 0);
+}
+
+bool SegmentBvh::empty() const { return m_segments.empty(); }
+
+int SegmentBvh::segmentCount() const { return m_segments.size(); }
+
+int SegmentBvh::nodeCount() const { return m_nodes.size(); }
+
+glm::vec2 SegmentBvh::segmentMin(const Segment &segment) const {
+  return glm::min(segment.a, segment.b) - glm::vec2(segment.radius);
+}
+
+glm::vec2 SegmentBvh::segmentMax(const Segment &segment) const {
+  return glm::max(segment.a, segment.b) + glm::vec2(segment.radius);
+}
+
+int SegmentBvh::buildNode(int begin, int end, int depth) {
+  int nodeIndex = m_nodes.size();
+  m_nodes.push_back(Node());
+
+  glm::vec2 min(INFINITY), max(-INFINITY);
+  glm::vec2 centroidMin(INFINITY), centroidMax(-INFINITY);
+  for (int i = begin; i < end; i++) {
+    min = glm::min(min, segmentMin(m_segments[i]));
+    max = glm::max(max, segmentMax(m_segments[i]));
+    glm::vec2 centroid = (m_segments[i].a + m_segments[i].b) / 2.f;
+    centroidMin = glm::min(centroidMin, centroid);
+    centroidMax = glm::max(centroidMax, centroid);
+  }
+  Node leaf{min, max, begin, end - begin};
+
+  int count = end - begin;
+  glm::vec2 extent = centroidMax - centroidMin;
+  int axis = extent.x >= extent.y ? 0 : 1;
+  if (count <= MIN_SPLIT_SEGMENTS || extent[axis] <= 0) {
+    m_nodes[nodeIndex] = leaf;
+    return nodeIndex;
+  }
+
+  auto binOf = [&](const Segment &segment) {
+    float centroid = (segment.a[axis] + segment.b[axis]) / 2.f;
+    int bin = (centroid - centroidMin[axis]) / extent[axis] * NUM_BINS;
+    return std::min(bin, NUM_BINS - 1);
+  };
+
+  int mid;
+  if (depth < MAX_SAH_DEPTH) {
+    // Gather the segments into bins along the longest centroid axis
+    int binCounts[NUM_BINS] = {};
+    glm::vec2 binMin[NUM_BINS], binMax[NUM_BINS];
+    std::fill(binMin, binMin + NUM_BINS, glm::vec2(INFINITY));
+    std::fill(binMax, binMax + NUM_BINS, glm::vec2(-INFINITY));
+    for (int i = begin; i < end; i++) {
+      int bin = binOf(m_segments[i]);
+      binCounts[bin]++;
+      binMin[bin] = glm::min(binMin[bin], segmentMin(m_segments[i]));
+      binMax[bin] = glm::max(binMax[bin], segmentMax(m_segments[i]));
+    }
+
+    // Cost of the segments left of every split, swept from the left
+    float leftCosts[NUM_BINS - 1];
+    glm::vec2 sweepMin(INFINITY), sweepMax(-INFINITY);
+    int sweepCount = 0;
+    for (int split = 0; split < NUM_BINS - 1; split++) {
+      sweepMin = glm::min(sweepMin, binMin[split]);
+      sweepMax = glm::max(sweepMax, binMax[split]);
+      sweepCount += binCounts[split];
+      leftCosts[split] = sweepCount * halfPerimeter(sweepMin, sweepMax);
+    }
+    // Add the cost of the right side sweeping back and keep the cheapest
+    float bestCost = INFINITY;
+    int bestSplit = 0;
+    sweepMin = glm::vec2(INFINITY);
+    sweepMax = glm::vec2(-INFINITY);
+    sweepCount = 0;
+    for (int split = NUM_BINS - 2; split >= 0; split--) {
+      sweepMin = glm::min(sweepMin, binMin[split + 1]);
+      sweepMax = glm::max(sweepMax, binMax[split + 1]);
+      sweepCount += binCounts[split + 1];
+      float cost =
+          leftCosts[split] + sweepCount * halfPerimeter(sweepMin, sweepMax);
+      if (cost < bestCost) {
+        bestCost = cost;
+        bestSplit = split;
+      }
+    }
+
+    if (bestCost >= count * halfPerimeter(min, max) &&
+        count <= MAX_LEAF_SEGMENTS) {
+      m_nodes[nodeIndex] = leaf;
+      return nodeIndex;
+    }
+    mid = std::partition(m_segments.begin() + begin,
+                         m_segments.begin() + end,
+                         [&](const Segment &segment) {
+                           return binOf(segment) <= bestSplit;
+                         }) -
+          m_segments.begin();
+  } else {
+    mid = begin + count / 2;
+  }
+
+  // Empty sides happen with heavily clustered centroids, split the middle
+  if (mid == begin || mid == end) {
+    mid = begin + count / 2;
+    std::nth_element(m_segments.begin() + begin, m_segments.begin() + mid,
+                     m_segments.begin() + end,
+                     [axis](const Segment &a, const Segment &b) {
+                       return a.a[axis] + a.b[axis] < b.a[axis] + b.b[axis];
+                     });
+  }
+
+  buildNode(begin, mid, depth + 1);
+  int second = buildNode(mid, end, depth + 1);
+  m_nodes[nodeIndex] = {min, max, second, 0};
+  return nodeIndex;
+}
+
+bool SegmentBvh::raycast(glm::vec2 from, glm::vec2 to, float &t,
+                         glm::vec2 &normal) const {
+  if (m_nodes.empty()) {
+    return false;
+  }
+  glm::vec2 direction = to - from;
+  float best = 1;
+  bool hit = false;
+
+  int stack[STACK_SIZE];
+  int top = 0;
+  stack[top++] = 0;
+  while (top > 0) {
+    const Node &node = m_nodes[stack[--top]];
+
+    // Slab test against the node box, skipping boxes behind the best hit
+    float enter = 0;
+    float exit = best;
+    for (int axis = 0; axis < 2; axis++) {
+      if (std::abs(direction[axis]) < 1e-12f) {
+        if (from[axis] < node.min[axis] || from[axis] > node.max[axis]) {
+          exit = -1;
+        }
+        continue;
+      }
+      float t0 = (node.min[axis] - from[axis]) / direction[axis];
+      float t1 = (node.max[axis] - from[axis]) / direction[axis];
+      enter = std::max(enter, std::min(t0, t1));
+      exit = std::min(exit, std::max(t0, t1));
+    }
+    if (enter > exit) {
+      continue;
+    }
+
+    if (node.count == 0) {
+      stack[top++] = node.index;
+      stack[top++] = &node - m_nodes.data() + 1;
+      continue;
+    }
+
+    for (int i = node.index; i < node.index + node.count; i++) {
+      const Segment &segment = m_segments[i];
+      glm::vec2 edge = segment.b - segment.a;
+      float denominator = cross(direction, edge);
+      if (std::abs(denominator) < 1e-12f) {
+        // Parallel, the closest query handles grazing contacts
+        continue;
+      }
+      glm::vec2 toSegment = segment.a - from;
+      float along = cross(toSegment, edge) / denominator;
+      float onSegment = cross(toSegment, direction) / denominator;
+      if (along >= 0 && along <= best && onSegment >= 0 && onSegment <= 1) {
+        best = along;
+        hit = true;
+        normal = glm::normalize(glm::vec2(-edge.y, edge.x));
+        if (glm::dot(normal, direction) > 0) {
+          normal = -normal;
+        }
+      }
+    }
+  }
+  t = best;
+  return hit;
+}
+
+float SegmentBvh::closest(glm::vec2 pos, float maxDistance,
+                          glm::vec2 &normal) const {
+  if (m_nodes.empty()) {
+    return maxDistance;
+  }
+  float best = maxDistance;
+
+  int stack[STACK_SIZE];
+  int top = 0;
+  stack[top++] = 0;
+  while (top > 0) {
+    const Node &node = m_nodes[stack[--top]];
+
+    // The node box holds the segments with their thickness, nothing inside it
+    // can be closer than the box itself
+    glm::vec2 outside =
+        glm::max(glm::max(node.min - pos, pos - node.max), glm::vec2(0));
+    if (glm::length(outside) >= best) {
+      continue;
+    }
+
+    if (node.count == 0) {
+      stack[top++] = node.index;
+      stack[top++] = &node - m_nodes.data() + 1;
+      continue;
+    }
+
+    for (int i = node.index; i < node.index + node.count; i++) {
+      const Segment &segment = m_segments[i];
+      glm::vec2 edge = segment.b - segment.a;
+      float lengthSq = glm::dot(edge, edge);
+      float along =
+          lengthSq > 0
+              ? glm::clamp(glm::dot(pos - segment.a, edge) / lengthSq, 0.f, 1.f)
+              : 0.f;
+      glm::vec2 offset = pos - (segment.a + along * edge);
+      float centerDistance = glm::length(offset);
+      float distance = centerDistance - segment.radius;
+      if (distance < best) {
+        best = distance;
+        if (centerDistance > 0) {
+          normal = offset / centerDistance;
+        } else if (lengthSq > 0) {
+          normal = glm::normalize(glm::vec2(-edge.y, edge.x));
+        } else {
+          normal = glm::vec2(0, 1);
+        }
+      }
+    }
+  }
+  return best;
+}
@@ -0,0 +1,345 @@
+#include "slabsimulation.h"
+#include "spatialhash.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <glm/geometric.hpp>
+
+// A particle as it travels between ranks
+struct SlabParticle {
+  glm::vec3 position;
+  glm::vec3 velocity;
+};
+
+// Messages between ranks are plain arrays of one kind of value
+template <typename T>
+static void appendValue(std::vector<char> &message, const T &value) {
+  size_t offset = message.size();
+  message.resize(offset + sizeof(T));
+  std::memcpy(message.data() + offset, &value, sizeof(T));
+}
+
+template <typename T> static int valueCount(const std::vector<char> &message) {
+  return (int)(message.size() / sizeof(T));
+}
+
+// The message's bytes aren't aligned for T, so values are copied out
+template <typename T>
+static T readValue(const std::vector<char> &message, int index) {
+  T value;
+  std::memcpy(&value, message.data() + index * sizeof(T), sizeof(T));
+  return value;
+}
+
+static const glm::vec2 cellOffsets[] = {
+    glm::vec2(-1, 1),  glm::vec2(0, 1),  glm::vec2(1, 1),
+    glm::vec2(-1, 0),  glm::vec2(0, 0),  glm::vec2(1, 0),
+    glm::vec2(-1, -1), glm::vec2(0, -1), glm::vec2(1, -1),
+};
+
+SlabSimulation::SlabSimulation(const SceneConfig &scene, Transport &transport)
+    : m_transport(transport), m_scene(scene), m_flowFinity(), m_slabMin(0),
+      m_slabMax(0), m_positions(), m_velocities(), m_predictedPositions(),
+      m_densities(), m_nearDensities(), m_numOwned(0), m_numLeftGhosts(0),
+      m_numRightGhosts(0), m_sentLeft(), m_sentRight(), m_sendLeft(),
+      m_sendRight(), m_receiveLeft(), m_receiveRight(), m_spatialHash(),
+      m_startIndices() {
+  float width = 2 * scene.bounds.x / transport.size();
+  m_slabMin = -scene.bounds.x + transport.rank() * width;
+  m_slabMax = transport.rank() == transport.size() - 1 ? scene.bounds.x
+                                                       : m_slabMin + width;
+
+  m_flowFinity.setTargetDensity(scene.targetDensity);
+  m_flowFinity.setPressureMultiplier(scene.pressureMultiplier);
+  m_flowFinity.setNearPressureMultiplier(scene.nearPressureMultiplier);
+  m_flowFinity.setPositions(&m_predictedPositions);
+  m_flowFinity.setDensities(&m_densities);
+  m_flowFinity.setNearDensities(&m_nearDensities);
+}
+
+void SlabSimulation::reset() {
+  m_positions.clear();
+  m_velocities.clear();
+  m_numOwned = 0;
+  m_numLeftGhosts = 0;
+  m_numRightGhosts = 0;
+  // Same grid per block as the editor, every rank walks all of it and keeps
+  // its own part
+  for (const ParticleBlock &block : m_scene.blocks) {
+    glm::vec2 size = block.max - block.min;
+    float aspect = size.x / std::max(size.y, 1e-4f);
+    int cols = std::max(1, (int)std::round(std::sqrt(block.count * aspect)));
+    int rows = (block.count - 1) / cols + 1;
+    glm::vec2 cellSize = size / glm::vec2(cols, rows);
+    for (int i = 0; i < block.count; i++) {
+      addParticle(glm::vec3(block.min.x + (i % cols + 0.5f) * cellSize.x,
+                            block.min.y + (i / cols + 0.5f) * cellSize.y, 0),
+                  glm::vec3(0));
+    }
+  }
+}
+
+bool SlabSimulation::addParticle(glm::vec3 position, glm::vec3 velocity) {
+  bool first = m_transport.rank() == 0;
+  bool last = m_transport.rank() == m_transport.size() - 1;
+  if ((!first && position.x < m_slabMin) ||
+      (!last && position.x >= m_slabMax)) {
+    return false;
+  }
+  // Ghosts only live during a step, so owned particles are always at the end
+  m_positions.resize(m_numOwned);
+  m_velocities.resize(m_numOwned);
+  m_positions.push_back(position);
+  m_velocities.push_back(velocity);
+  m_numOwned++;
+  return true;
+}
+
+bool SlabSimulation::step(float dt) {
+  const float h = m_scene.densityRadius;
+  const glm::vec3 gravity(0, m_scene.gravity, 0);
+  if (!migrateParticles()) {
+    return false;
+  }
+
+  // Leapfrog Step 1: the forces are found at the predicted positions
+  m_predictedPositions.resize(m_numOwned);
+  for (int i = 0; i < m_numOwned; i++) {
+    glm::vec3 halfStepVelocity = m_velocities[i] + gravity * 0.5f * dt;
+    m_predictedPositions[i] = m_positions[i] + halfStepVelocity * (1 / 120.f);
+  }
+  if (!exchangeGhosts()) {
+    return false;
+  }
+  int total = (int)m_predictedPositions.size();
+  m_densities.assign(total, 0);
+  m_nearDensities.assign(total, 0);
+  updateSpatialHash();
+
+  for (int i = 0; i < m_numOwned; i++) {
+    glm::vec3 pos = m_predictedPositions[i];
+    forEachNeighbor(pos, [&](int neighbor, float) {
+      m_densities[i] += m_flowFinity.calculateDensity(pos, neighbor, h);
+      m_nearDensities[i] += m_flowFinity.calculateNearDensity(pos, neighbor, h);
+    });
+  }
+  // The pressure of a ghost follows from its density on its own rank
+  if (!exchangeGhostDensities()) {
+    return false;
+  }
+
+  for (int i = 0; i < m_numOwned; i++) {
+    glm::vec3 pos = m_predictedPositions[i];
+    glm::vec3 force(0);
+    glm::vec3 viscosity(0);
+    forEachNeighbor(pos, [&](int neighbor, float) {
+      force += m_flowFinity.CalulatePressureForce(i, neighbor, h);
+    });
+    // Leapfrog Step 2: full step velocity
+    m_velocities[i] += force / m_densities[i] * dt + gravity * 0.5f * dt;
+    forEachNeighbor(pos, [&](int neighbor, float dst) {
+      viscosity += (m_velocities[neighbor] - m_velocities[i]) *
+                   FlowFinity::smoothingKernel(h, dst);
+    });
+    m_velocities[i] += viscosity * m_scene.viscosityStrength * dt;
+  }
+
+  // The ghosts are only borrowed for the step
+  m_positions.resize(m_numOwned);
+  m_velocities.resize(m_numOwned);
+  for (int i = 0; i < m_numOwned; i++) {
+    m_positions[i] += m_velocities[i] * dt;
+    resolveCollisions(i);
+  }
+  return true;
+}
+
+bool SlabSimulation::migrateParticles() {
+  m_sendLeft.clear();
+  m_sendRight.clear();
+  bool first = m_transport.rank() == 0;
+  bool last = m_transport.rank() == m_transport.size() - 1;
+  for (int i = m_numOwned - 1; i >= 0; i--) {
+    bool left = !first && m_positions[i].x < m_slabMin;
+    bool right = !last && m_positions[i].x >= m_slabMax;
+    if (left || right) {
+      appendValue(left ? m_sendLeft : m_sendRight,
+                  SlabParticle{m_positions[i], m_velocities[i]});
+      removeParticle(i);
+    }
+  }
+  if (!exchangeWithNeighbors()) {
+    return false;
+  }
+  // A particle fast enough to skip a whole slab moves on next step
+  for (const std::vector<char> *message : {&m_receiveLeft, &m_receiveRight}) {
+    for (int i = 0; i < valueCount<SlabParticle>(*message); i++) {
+      SlabParticle particle = readValue<SlabParticle>(*message, i);
+      m_positions.push_back(particle.position);
+      m_velocities.push_back(particle.velocity);
+      m_numOwned++;
+    }
+  }
+  return true;
+}
+
+bool SlabSimulation::exchangeGhosts() {
+  const float h = m_scene.densityRadius;
+  m_sendLeft.clear();
+  m_sendRight.clear();
+  bool first = m_transport.rank() == 0;
+  bool last = m_transport.rank() == m_transport.size() - 1;
+  m_sentLeft.clear();
+  m_sentRight.clear();
+  for (int i = 0; i < m_numOwned; i++) {
+    glm::vec3 pos = m_predictedPositions[i];
+    if (!first && pos.x < m_slabMin + h) {
+      appendValue(m_sendLeft, SlabParticle{pos, m_velocities[i]});
+      m_sentLeft.push_back(i);
+    }
+    if (!last && pos.x >= m_slabMax - h) {
+      appendValue(m_sendRight, SlabParticle{pos, m_velocities[i]});
+      m_sentRight.push_back(i);
+    }
+  }
+  if (!exchangeWithNeighbors()) {
+    return false;
+  }
+  m_numLeftGhosts = valueCount<SlabParticle>(m_receiveLeft);
+  m_numRightGhosts = valueCount<SlabParticle>(m_receiveRight);
+  for (const std::vector<char> *message : {&m_receiveLeft, &m_receiveRight}) {
+    for (int i = 0; i < valueCount<SlabParticle>(*message); i++) {
+      SlabParticle ghost = readValue<SlabParticle>(*message, i);
+      m_predictedPositions.push_back(ghost.position);
+      m_velocities.push_back(ghost.velocity);
+    }
+  }
+  return true;
+}
+
+bool SlabSimulation::exchangeGhostDensities() {
+  m_sendLeft.clear();
+  m_sendRight.clear();
+  for (int i : m_sentLeft) {
+    appendValue(m_sendLeft, glm::vec2(m_densities[i], m_nearDensities[i]));
+  }
+  for (int i : m_sentRight) {
+    appendValue(m_sendRight, glm::vec2(m_densities[i], m_nearDensities[i]));
+  }
+  if (!exchangeWithNeighbors()) {
+    return false;
+  }
+  if (valueCount<glm::vec2>(m_receiveLeft) != m_numLeftGhosts ||
+      valueCount<glm::vec2>(m_receiveRight) != m_numRightGhosts) {
+    return false;
+  }
+  int ghost = m_numOwned;
+  for (const std::vector<char> *message : {&m_receiveLeft, &m_receiveRight}) {
+    for (int i = 0; i < valueCount<glm::vec2>(*message); i++) {
+      glm::vec2 density = readValue<glm::vec2>(*message, i);
+      m_densities[ghost] = density.x;
+      m_nearDensities[ghost] = density.y;
+      ghost++;
+    }
+  }
+  return true;
+}
+
+bool SlabSimulation::exchangeWithNeighbors() {
+  int rank = m_transport.rank();
+  bool hasLeft = rank > 0;
+  bool hasRight = rank < m_transport.size() - 1;
+  m_receiveLeft.clear();
+  m_receiveRight.clear();
+  auto left = [&]() {
+    return !hasLeft ||
+           m_transport.exchange(rank - 1, m_sendLeft, m_receiveLeft);
+  };
+  auto right = [&]() {
+    return !hasRight ||
+           m_transport.exchange(rank + 1, m_sendRight, m_receiveRight);
+  };
+  return rank % 2 == 0 ? right() && left() : left() && right();
+}
+
+void SlabSimulation::removeParticle(int index) {
+  m_positions[index] = m_positions[m_numOwned - 1];
+  m_velocities[index] = m_velocities[m_numOwned - 1];
+  m_positions.pop_back();
+  m_velocities.pop_back();
+  m_numOwned--;
+}
+
+void SlabSimulation::updateSpatialHash() {
+  const float h = m_scene.densityRadius;
+  int total = (int)m_predictedPositions.size();
+  unsigned int tableSize = std::max(1, total);
+  m_spatialHash.resize(total);
+  for (int i = 0; i < total; i++) {
+    glm::vec2 cell = positionToCell(m_predictedPositions[i], h);
+    m_spatialHash[i] = std::make_pair(hashCell(cell) % tableSize, i);
+  }
+  std::sort(m_spatialHash.begin(), m_spatialHash.end(),
+            [](auto &left, auto &right) { return left.first < right.first; });
+  m_startIndices.assign(tableSize, INT_MAX);
+  for (int i = total - 1; i >= 0; i--) {
+    m_startIndices[m_spatialHash[i].first] = i;
+  }
+}
+
+// Call fn(neighbor, dst) for every owned particle and ghost within the density
+// radius of a position
+template <typename F>
+void SlabSimulation::forEachNeighbor(glm::vec3 pos, const F &fn) {
+  const float h = m_scene.densityRadius;
+  unsigned int tableSize = (unsigned int)m_startIndices.size();
+  glm::vec2 cell = positionToCell(pos, h);
+  for (glm::vec2 offset : cellOffsets) {
+    unsigned int key = hashCell(cell + offset) % tableSize;
+    for (int i = m_startIndices[key]; i < (int)m_spatialHash.size(); i++) {
+      if (m_spatialHash[i].first != key) {
+        break;
+      }
+      int neighbor = m_spatialHash[i].second;
+      float dst = glm::distance(pos, m_predictedPositions[neighbor]);
+      if (dst < h) {
+        fn(neighbor, dst);
+      }
+    }
+  }
+}
+
+void SlabSimulation::resolveCollisions(int index) {
+  glm::vec2 bounds = m_scene.bounds - glm::vec2(m_scene.particleSize / 2.f);
+  glm::vec3 &position = m_positions[index];
+  glm::vec3 &velocity = m_velocities[index];
+  for (int axis = 0; axis < 2; axis++) {
+    if (position[axis] < -bounds[axis]) {
+      position[axis] = -bounds[axis];
+      velocity[axis] *= -(1 - m_scene.particleDamping);
+    } else if (position[axis] > bounds[axis]) {
+      position[axis] = bounds[axis];
+      velocity[axis] *= -(1 - m_scene.particleDamping);
+    }
+  }
+}
+
+float SlabSimulation::slabMin() const { return m_slabMin; }
+
+float SlabSimulation::slabMax() const { return m_slabMax; }
+
+int SlabSimulation::particleCount() const { return m_numOwned; }
+
+int SlabSimulation::ghostCount() const {
+  return m_numLeftGhosts + m_numRightGhosts;
+}
+
+const std::vector<glm::vec3> &SlabSimulation::positions() const {
+  return m_positions;
+}
+
+const std::vector<glm::vec3> &SlabSimulation::velocities() const {
+  return m_velocities;
+}
@@ -0,0 +1,165 @@
+#include "sockettransport.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+SocketTransport::SocketTransport(int rank, int size, int left, int right)
+    : m_rank(rank), m_size(size), m_left(left), m_right(right), m_children() {
+}
+
+SocketTransport::~SocketTransport() {
+  if (m_left >= 0) {
+    close(m_left);
+  }
+  if (m_right >= 0) {
+    close(m_right);
+  }
+}
+
+std::unique_ptr<SocketTransport> SocketTransport::spawn(int count) {
+  if (count < 1) {
+    std::cerr << "Transport needs at least one process" << std::endl;
+    return nullptr;
+  }
+  // Socket pair i connects rank i, which holds the first end, and rank i + 1
+  std::vector<int> ends;
+  for (int i = 0; i + 1 < count; i++) {
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0) {
+      std::cerr << "Failed to create socket pair" << std::endl;
+      for (int end : ends) {
+        close(end);
+      }
+      return nullptr;
+    }
+    ends.push_back(pair[0]);
+    ends.push_back(pair[1]);
+  }
+
+  // Buffered output would be written once by every process otherwise
+  std::fflush(nullptr);
+  std::vector<int> children;
+  for (int rank = 1; rank < count; rank++) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      std::cerr << "Failed to start process " << rank << std::endl;
+      // The started ranks see their sockets close and give up
+      for (int end : ends) {
+        close(end);
+      }
+      for (int child : children) {
+        waitpid(child, nullptr, 0);
+      }
+      return nullptr;
+    }
+    if (pid == 0) {
+      int left = ends[2 * (rank - 1) + 1];
+      int right = rank + 1 < count ? ends[2 * rank] : -1;
+      for (int end : ends) {
+        if (end != left && end != right) {
+          close(end);
+        }
+      }
+      return std::unique_ptr<SocketTransport>(
+          new SocketTransport(rank, count, left, right));
+    }
+    children.push_back(pid);
+  }
+
+  int right = count > 1 ? ends[0] : -1;
+  for (int end : ends) {
+    if (end != right) {
+      close(end);
+    }
+  }
+  std::unique_ptr<SocketTransport> transport(
+      new SocketTransport(0, count, -1, right));
+  transport->m_children = children;
+  return transport;
+}
+
+bool SocketTransport::wait() {
+  if (m_rank != 0) {
+    std::cerr << "Only the first rank waits for the others" << std::endl;
+    return false;
+  }
+  // Closing the socket lets ranks still waiting on a message give up
+  if (m_right >= 0) {
+    close(m_right);
+    m_right = -1;
+  }
+  bool success = true;
+  for (int child : m_children) {
+    int status;
+    if (waitpid(child, &status, 0) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+      success = false;
+    }
+  }
+  m_children.clear();
+  return success;
+}
+
+int SocketTransport::rank() const { return m_rank; }
+
+int SocketTransport::size() const { return m_size; }
+
+bool SocketTransport::exchange(int peer, const std::vector<char> &send,
+                               std::vector<char> &receive) {
+  int socket = peer == m_rank - 1 ? m_left : peer == m_rank + 1 ? m_right : -1;
+  if (socket < 0) {
+    std::cerr << "Rank " << m_rank << " has no connection to rank " << peer
+              << std::endl;
+    return false;
+  }
+
+  uint64_t sendSize = send.size();
+  uint64_t receiveSize = 0;
+  auto sendMessage = [&]() {
+    return sendAll(socket, (const char *)&sendSize, sizeof(sendSize)) &&
+           sendAll(socket, send.data(), send.size());
+  };
+  auto receiveMessage = [&]() {
+    if (!receiveAll(socket, (char *)&receiveSize, sizeof(receiveSize))) {
+      return false;
+    }
+    receive.resize(receiveSize);
+    return receiveAll(socket, receive.data(), receive.size());
+  };
+  // The lower rank talks first so both ends never wait on each other
+  bool success = m_rank < peer ? sendMessage() && receiveMessage()
+                               : receiveMessage() && sendMessage();
+  if (!success) {
+    std::cerr << "Lost connection between rank " << m_rank << " and rank "
+              << peer << std::endl;
+  }
+  return success;
+}
+
+bool SocketTransport::sendAll(int socket, const char *data, size_t size) {
+  while (size > 0) {
+    ssize_t sent = ::send(socket, data, size, MSG_NOSIGNAL);
+    if (sent <= 0) {
+      return false;
+    }
+    data += sent;
+    size -= sent;
+  }
+  return true;
+}
+
+bool SocketTransport::receiveAll(int socket, char *data, size_t size) {
+  while (size > 0) {
+    ssize_t received = recv(socket, data, size, 0);
+    if (received <= 0) {
+      return false;
+    }
+    data += received;
+    size -= received;
+  }
+  return true;
+}
@@ -0,0 +1,14 @@
+#include "spatialhash.h"
+
+#include <cmath>
+
+glm::vec2 positionToCell(glm::vec3 pos, float radius) {
+  return glm::vec2(std::floor(pos.x / radius), std::floor(pos.y / radius));
+}
+
+unsigned int hashCell(glm::vec2 cell) {
+  // Through int first, negative floats don't convert to unsigned int
+  unsigned int a = (unsigned int)(int)cell.x * 15823;
+  unsigned int b = (unsigned int)(int)cell.y * 9737333;
+  return a + b;
+}
@@ -0,0 +1,363 @@
+#include "surfaceextractor.h"
+#include "flowfinity.h"
+
+#include <glm/geometric.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+// Fewest cells along each side of a tile, smaller tiles cost more in the
+// splatting of their neighbors' particles than they save
+static const int MIN_TILE_CELLS = 16;
+
+// Edges cut by the outline in each case of the corners inside it, in pairs.
+// Corners are numbered bottom-left, bottom-right, top-right, top-left and
+// edges bottom, right, top, left. The saddles 5 and 10 keep their inside
+// corners apart, when the cell center is inside they swap tables
+static const int CASE_EDGES[16][4] = {
+    {-1, -1, -1, -1}, {3, 0, -1, -1}, {0, 1, -1, -1}, {3, 1, -1, -1},
+    {1, 2, -1, -1},   {3, 0, 1, 2},   {0, 2, -1, -1}, {3, 2, -1, -1},
+    {2, 3, -1, -1},   {0, 2, -1, -1}, {0, 1, 2, 3},   {1, 2, -1, -1},
+    {1, 3, -1, -1},   {0, 1, -1, -1}, {3, 0, -1, -1}, {-1, -1, -1, -1}};
+
+SurfaceExtractor::SurfaceExtractor()
+    : m_min(0), m_cellSize(0), m_radius(0), m_threshold(0), m_tolerance(0),
+      m_cellsX(0), m_cellsY(0), m_tileCells(MIN_TILE_CELLS), m_tilesX(0),
+      m_tilesY(0), m_resetAll(true), m_activeTiles(0) {}
+
+void SurfaceExtractor::setGrid(glm::vec2 min, glm::vec2 max, float cellSize,
+                               float radius) {
+  if (cellSize <= 0) {
+    return;
+  }
+  int cellsX = std::max(1, (int)std::ceil((max.x - min.x) / cellSize));
+  int cellsY = std::max(1, (int)std::ceil((max.y - min.y) / cellSize));
+  if (min == m_min && cellSize == m_cellSize && radius == m_radius &&
+      cellsX == m_cellsX && cellsY == m_cellsY) {
+    return;
+  }
+  m_min = min;
+  m_cellSize = cellSize;
+  m_radius = radius;
+  m_cellsX = cellsX;
+  m_cellsY = cellsY;
+  // Particles only reach the grid points of their own and neighboring tiles
+  m_tileCells = std::max(MIN_TILE_CELLS, (int)std::ceil(radius / cellSize));
+  m_tilesX = (m_cellsX + m_tileCells - 1) / m_tileCells;
+  m_tilesY = (m_cellsY + m_tileCells - 1) / m_tileCells;
+  m_tiles.assign(m_tilesX * m_tilesY, Tile{{}, {}, false, false});
+  m_resetAll = true;
+}
+
+void SurfaceExtractor::setThreshold(float threshold) {
+  if (threshold != m_threshold) {
+    m_threshold = threshold;
+    m_resetAll = true;
+  }
+}
+
+void SurfaceExtractor::setTolerance(float tolerance) {
+  m_tolerance = std::max(tolerance, 0.f);
+}
+
+const std::vector<glm::vec2> &SurfaceExtractor::segments() const {
+  return m_segments;
+}
+
+int SurfaceExtractor::tileCount() const { return m_tiles.size(); }
+
+int SurfaceExtractor::activeTiles() const { return m_activeTiles; }
+
+int SurfaceExtractor::extractedTiles() const { return m_dirtyTiles.size(); }
+
+int SurfaceExtractor::tileOf(glm::vec2 pos) const {
+  glm::vec2 cell = glm::floor((pos - m_min) / m_cellSize);
+  if (!(cell.x >= 0 && cell.y >= 0 && cell.x < m_cellsX && cell.y < m_cellsY)) {
+    return -1;
+  }
+  return ((int)cell.y / m_tileCells) * m_tilesX + (int)cell.x / m_tileCells;
+}
+
+void SurfaceExtractor::markAround(int tile) {
+  if (tile < 0) {
+    return;
+  }
+  int tx = tile % m_tilesX;
+  int ty = tile / m_tilesX;
+  for (int y = std::max(ty - 1, 0); y <= std::min(ty + 1, m_tilesY - 1); y++) {
+    for (int x = std::max(tx - 1, 0); x <= std::min(tx + 1, m_tilesX - 1);
+         x++) {
+      m_tiles[y * m_tilesX + x].dirty = true;
+    }
+  }
+}
+
+bool SurfaceExtractor::extract(const glm::vec3 *positions, int count,
+                               ThreadPool &pool) {
+  int numTiles = m_tiles.size();
+  m_dirtyTiles.clear();
+  if (numTiles == 0) {
+    bool changed = !m_segments.empty();
+    m_segments.clear();
+    m_segmentEdges.clear();
+    return changed;
+  }
+
+  // Counting sort of the particles by tile. The starts are bumped past every
+  // particle placed, then shifted back by one tile
+  m_particleTiles.resize(count);
+  m_tileStart.assign(numTiles + 1, 0);
+  for (int i = 0; i < count; i++) {
+    int tile = tileOf(glm::vec2(positions[i]));
+    m_particleTiles[i] = tile;
+    if (tile >= 0) {
+      m_tileStart[tile + 1]++;
+    }
+  }
+  for (int t = 0; t < numTiles; t++) {
+    m_tileStart[t + 1] += m_tileStart[t];
+  }
+  m_tileParticles.resize(m_tileStart[numTiles]);
+  for (int i = 0; i < count; i++) {
+    if (m_particleTiles[i] >= 0) {
+      m_tileParticles[m_tileStart[m_particleTiles[i]]++] = i;
+    }
+  }
+  for (int t = numTiles; t > 0; t--) {
+    m_tileStart[t] = m_tileStart[t - 1];
+  }
+  m_tileStart[0] = 0;
+
+  // A particle that moved too far or into another tile changes the density
+  // of the tiles around where it was and where it is
+  if ((int)m_references.size() != count) {
+    m_references.resize(count);
+    m_resetAll = true;
+  }
+  for (int i = 0; i < count; i++) {
+    glm::vec2 pos(positions[i]);
+    if (m_resetAll) {
+      m_references[i] = pos;
+      continue;
+    }
+    int tile = m_particleTiles[i];
+    int referenceTile = tileOf(m_references[i]);
+    if (tile != referenceTile ||
+        glm::distance(pos, m_references[i]) > m_tolerance) {
+      markAround(referenceTile);
+      markAround(tile);
+      m_references[i] = pos;
+    }
+  }
+
+  // Only tiles with particles in or next to them can reach the threshold
+  bool changed = false;
+  m_activeTiles = 0;
+  for (int t = 0; t < numTiles; t++) {
+    Tile &tile = m_tiles[t];
+    int tx = t % m_tilesX;
+    int ty = t / m_tilesX;
+    bool active = false;
+    for (int y = std::max(ty - 1, 0);
+         y <= std::min(ty + 1, m_tilesY - 1) && !active; y++) {
+      for (int x = std::max(tx - 1, 0); x <= std::min(tx + 1, m_tilesX - 1);
+           x++) {
+        int neighbor = y * m_tilesX + x;
+        if (m_tileStart[neighbor + 1] > m_tileStart[neighbor]) {
+          active = true;
+          break;
+        }
+      }
+    }
+    if (m_resetAll || active != tile.active) {
+      tile.dirty = true;
+    }
+    tile.active = active;
+    if (active) {
+      m_activeTiles++;
+    }
+    if (!tile.dirty) {
+      continue;
+    }
+    tile.dirty = false;
+    changed = true;
+    if (active) {
+      m_dirtyTiles.push_back(t);
+    } else {
+      tile.points.clear();
+      tile.edges.clear();
+    }
+  }
+  m_resetAll = false;
+
+  if (!m_dirtyTiles.empty()) {
+    m_threadDensities.resize(pool.numThreads());
+    pool.parallelForChunks(0, m_dirtyTiles.size(),
+                           [&](int begin, int end, int thread) {
+                             for (int i = begin; i < end; i++) {
+                               extractTile(m_dirtyTiles[i], positions,
+                                           m_threadDensities[thread]);
+                             }
+                           });
+  }
+  if (!changed) {
+    return false;
+  }
+
+  m_segments.clear();
+  m_segmentEdges.clear();
+  for (const Tile &tile : m_tiles) {
+    m_segments.insert(m_segments.end(), tile.points.begin(),
+                      tile.points.end());
+    m_segmentEdges.insert(m_segmentEdges.end(), tile.edges.begin(),
+                          tile.edges.end());
+  }
+  return true;
+}
+
+void SurfaceExtractor::extractTile(int t, const glm::vec3 *positions,
+                                   std::vector<float> &densities) {
+  Tile &tile = m_tiles[t];
+  tile.points.clear();
+  tile.edges.clear();
+  int tx = t % m_tilesX;
+  int ty = t / m_tilesX;
+  int x0 = tx * m_tileCells;
+  int y0 = ty * m_tileCells;
+  int nx = std::min(m_tileCells, m_cellsX - x0);
+  int ny = std::min(m_tileCells, m_cellsY - y0);
+  int stride = nx + 1;
+  glm::vec2 origin = m_min + glm::vec2(x0, y0) * m_cellSize;
+
+  // Density at the tile's grid points, from the particles of the tile and its
+  // neighbors
+  densities.assign(stride * (ny + 1), 0.f);
+  float reach = m_radius / m_cellSize;
+  // The kernel is (radius - dst)^2 over its volume, scaled once per tile
+  float kernelScale =
+      FlowFinity::smoothingKernel(m_radius, 0) / (m_radius * m_radius);
+  float sqrRadius = m_radius * m_radius;
+  for (int y = std::max(ty - 1, 0); y <= std::min(ty + 1, m_tilesY - 1); y++) {
+    for (int x = std::max(tx - 1, 0); x <= std::min(tx + 1, m_tilesX - 1);
+         x++) {
+      int neighbor = y * m_tilesX + x;
+      for (int i = m_tileStart[neighbor]; i < m_tileStart[neighbor + 1]; i++) {
+        glm::vec2 pos(positions[m_tileParticles[i]]);
+        glm::vec2 local = (pos - origin) / m_cellSize;
+        int gx0 = std::max(0, (int)std::ceil(local.x - reach));
+        int gx1 = std::min(nx, (int)std::floor(local.x + reach));
+        int gy0 = std::max(0, (int)std::ceil(local.y - reach));
+        int gy1 = std::min(ny, (int)std::floor(local.y + reach));
+        for (int gy = gy0; gy <= gy1; gy++) {
+          for (int gx = gx0; gx <= gx1; gx++) {
+            glm::vec2 offset = origin + glm::vec2(gx, gy) * m_cellSize - pos;
+            float sqrDst = glm::dot(offset, offset);
+            if (sqrDst < sqrRadius) {
+              float falloff = m_radius - std::sqrt(sqrDst);
+              densities[gy * stride + gx] += falloff * falloff * kernelScale;
+            }
+          }
+        }
+      }
+    }
+  }
+
+  for (int cy = 0; cy < ny; cy++) {
+    for (int cx = 0; cx < nx; cx++) {
+      float values[4] = {densities[cy * stride + cx],
+                         densities[cy * stride + cx + 1],
+                         densities[(cy + 1) * stride + cx + 1],
+                         densities[(cy + 1) * stride + cx]};
+      int config = 0;
+      for (int c = 0; c < 4; c++) {
+        if (values[c] >= m_threshold) {
+          config |= 1 << c;
+        }
+      }
+      if (config == 0 || config == 15) {
+        continue;
+      }
+      if ((config == 5 || config == 10) &&
+          (values[0] + values[1] + values[2] + values[3]) / 4 >= m_threshold) {
+        config ^= 15;
+      }
+
+      int gx = x0 + cx;
+      int gy = y0 + cy;
+      glm::vec2 corners[4] = {origin + glm::vec2(cx, cy) * m_cellSize,
+                              origin + glm::vec2(cx + 1, cy) * m_cellSize,
+                              origin + glm::vec2(cx + 1, cy + 1) * m_cellSize,
+                              origin + glm::vec2(cx, cy + 1) * m_cellSize};
+      // Horizontal edges are even and vertical ones odd, numbered by the
+      // grid point at their bottom or left end
+      long long row = m_cellsX + 1;
+      long long edgeIds[4] = {((long long)gy * row + gx) * 2,
+                              ((long long)gy * row + gx + 1) * 2 + 1,
+                              ((long long)(gy + 1) * row + gx) * 2,
+                              ((long long)gy * row + gx) * 2 + 1};
+      static const int EDGE_CORNERS[4][2] = {{0, 1}, {1, 2}, {3, 2}, {0, 3}};
+      for (int i = 0; i < 4 && CASE_EDGES[config][i] >= 0; i++) {
+        int edge = CASE_EDGES[config][i];
+        int a = EDGE_CORNERS[edge][0];
+        int b = EDGE_CORNERS[edge][1];
+        float s = (m_threshold - values[a]) / (values[b] - values[a]);
+        tile.points.push_back(corners[a] + (corners[b] - corners[a]) * s);
+        tile.edges.push_back(edgeIds[edge]);
+      }
+    }
+  }
+}
+
+void SurfaceExtractor::polylines(
+    std::vector<std::vector<glm::vec2>> &lines) const {
+  lines.clear();
+  int numSegments = m_segments.size() / 2;
+  // Every grid edge is shared by at most two segments
+  std::unordered_map<long long, std::pair<int, int>> segmentsOnEdge;
+  segmentsOnEdge.reserve(m_segmentEdges.size());
+  for (int i = 0; i < (int)m_segmentEdges.size(); i++) {
+    auto found =
+        segmentsOnEdge.emplace(m_segmentEdges[i], std::make_pair(i / 2, -1));
+    if (!found.second) {
+      found.first->second.second = i / 2;
+    }
+  }
+
+  std::vector<bool> used(numSegments, false);
+  // Follow the segments from one end point of a segment until the line ends
+  // or closes
+  auto follow = [&](int segment, int end) {
+    lines.emplace_back();
+    std::vector<glm::vec2> &line = lines.back();
+    line.push_back(m_segments[2 * segment + end]);
+    while (true) {
+      used[segment] = true;
+      int far = 2 * segment + 1 - end;
+      line.push_back(m_segments[far]);
+      long long edge = m_segmentEdges[far];
+      const std::pair<int, int> &shared = segmentsOnEdge[edge];
+      int next = shared.first == segment ? shared.second : shared.first;
+      if (next < 0 || used[next]) {
+        return;
+      }
+      end = m_segmentEdges[2 * next] == edge ? 0 : 1;
+      segment = next;
+    }
+  };
+
+  // Open lines start at a segment end no other segment shares, the rest are
+  // loops
+  for (int i = 0; i < numSegments; i++) {
+    for (int end = 0; end < 2 && !used[i]; end++) {
+      if (segmentsOnEdge.at(m_segmentEdges[2 * i + end]).second < 0) {
+        follow(i, end);
+      }
+    }
+  }
+  for (int i = 0; i < numSegments; i++) {
+    if (!used[i]) {
+      follow(i, 0);
+    }
+  }
+}
@@ -0,0 +1,253 @@
+#include "threadpool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Ranges smaller than this are not worth waking the workers for
+static const int MIN_PARALLEL_RANGE = 256;
+// Chunks handed out per thread, more chunks balance uneven work better
+static const int CHUNKS_PER_THREAD = 8;
+
+// Numbers in a sysfs list like "0-3,8-11"
+static std::vector<int> parseList(const std::string &list) {
+  std::vector<int> numbers;
+  std::stringstream ranges(list);
+  std::string range;
+  while (std::getline(ranges, range, ',')) {
+    int first, last;
+    char dash;
+    std::istringstream values(range);
+    if (!(values >> first)) {
+      continue;
+    }
+    if (!(values >> dash >> last)) {
+      last = first;
+    }
+    for (int i = first; i <= last; i++) {
+      numbers.push_back(i);
+    }
+  }
+  return numbers;
+}
+
+// CPUs of every NUMA node that has any, empty if the topology can't be read
+static std::vector<std::vector<int>> readNodeCpus() {
+  std::vector<std::vector<int>> nodeCpus;
+#ifdef __linux__
+  std::ifstream online("/sys/devices/system/node/online");
+  std::string nodes;
+  if (!std::getline(online, nodes)) {
+    return nodeCpus;
+  }
+  for (int node : parseList(nodes)) {
+    std::ifstream file("/sys/devices/system/node/node" +
+                       std::to_string(node) + "/cpulist");
+    std::string cpus;
+    if (std::getline(file, cpus) && !parseList(cpus).empty()) {
+      nodeCpus.push_back(parseList(cpus));
+    }
+  }
+#endif
+  return nodeCpus;
+}
+
+#ifdef __linux__
+// Let a thread only run on the given CPUs
+static void pinThread(pthread_t thread, const std::vector<int> &cpus) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) {
+    if (cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &set);
+    }
+  }
+  pthread_setaffinity_np(thread, sizeof(set), &set);
+}
+#endif
+
+ThreadPool::ThreadPool(int numThreads)
+    : m_workers(), m_threadNodes(), m_nodeThreads(), m_nodeRanges(),
+      m_threadStats(), m_partitionSize(0), m_fn(nullptr), m_context(nullptr),
+      m_chunkSize(1), m_pending(0), m_generation(0), m_stop(false) {
+  if (numThreads <= 0) {
+    numThreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  m_threadStats.reset(new ThreadStats[numThreads]());
+  // Nodes are known before the workers start looking for work
+  std::vector<std::vector<int>> nodeCpus = readNodeCpus();
+  assignNodes(numThreads, nodeCpus);
+  // The calling thread is the first thread of the pool
+  for (int i = 1; i < numThreads; i++) {
+    m_workers.emplace_back(&ThreadPool::workerLoop, this, i);
+  }
+#ifdef __linux__
+  // Without NUMA the scheduler is left to place the threads
+  if (numNodes() > 1) {
+    pinThread(pthread_self(), nodeCpus[0]);
+    for (int i = 1; i < numThreads; i++) {
+      pinThread(m_workers[i - 1].native_handle(),
+                nodeCpus[m_threadNodes[i]]);
+    }
+  }
+#endif
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_wake.notify_all();
+  for (std::thread &worker : m_workers) {
+    worker.join();
+  }
+}
+
+int ThreadPool::numThreads() const { return (int)m_workers.size() + 1; }
+
+int ThreadPool::numNodes() const { return (int)m_nodeThreads.size(); }
+
+void ThreadPool::assignNodes(int numThreads,
+                             const std::vector<std::vector<int>> &nodeCpus) {
+  // Every node gets at least one thread, and the threads of a node are
+  // consecutive
+  int nodes = std::max(1, std::min((int)nodeCpus.size(), numThreads));
+  m_threadNodes.resize(numThreads);
+  m_nodeThreads.assign(nodes, 0);
+  for (int thread = 0; thread < numThreads; thread++) {
+    m_threadNodes[thread] = thread * nodes / numThreads;
+    m_nodeThreads[m_threadNodes[thread]]++;
+  }
+  m_nodeRanges.reset(new NodeRange[nodes]);
+  for (int node = 0; node < nodes; node++) {
+    m_nodeRanges[node].next = 0;
+    m_nodeRanges[node].end = 0;
+  }
+}
+
+void ThreadPool::setPartition(int size) { m_partitionSize = size; }
+
+int ThreadPool::partitionSize() const { return m_partitionSize; }
+
+int ThreadPool::partitionBegin(int node, int size) const {
+  // Blocks are as large as the node's share of the threads
+  int threadsBefore = 0;
+  for (int i = 0; i < node && i < numNodes(); i++) {
+    threadsBefore += m_nodeThreads[i];
+  }
+  return (int)((long long)size * threadsBefore / numThreads());
+}
+
+void ThreadPool::takeNodeStats(std::vector<NodeStats> &stats) {
+  stats.assign(numNodes(), NodeStats{0, 0, 0});
+  for (int thread = 0; thread < numThreads(); thread++) {
+    NodeStats &node = stats[m_threadNodes[thread]];
+    node.indices += m_threadStats[thread].indices;
+    node.stolen += m_threadStats[thread].stolen;
+    node.seconds += m_threadStats[thread].seconds;
+    m_threadStats[thread] = ThreadStats{0, 0, 0};
+  }
+  for (int node = 0; node < numNodes(); node++) {
+    stats[node].seconds /= m_nodeThreads[node];
+  }
+}
+
+void ThreadPool::run(ChunkFn fn, const void *context, int begin, int end) {
+  if (end <= begin) {
+    return;
+  }
+  // Small ranges run directly on the calling thread
+  if (m_workers.empty() || end - begin < MIN_PARALLEL_RANGE) {
+    auto start = std::chrono::steady_clock::now();
+    fn(context, begin, end, 0);
+    std::chrono::duration<double> time =
+        std::chrono::steady_clock::now() - start;
+    m_threadStats[0].indices += end - begin;
+    m_threadStats[0].seconds += time.count();
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_fn = fn;
+    m_context = context;
+    m_chunkSize =
+        std::max(1, (end - begin) / (numThreads() * CHUNKS_PER_THREAD));
+    // Cut the range into the blocks of the nodes, from the fixed partition if
+    // there is one
+    int size = m_partitionSize > 0 ? m_partitionSize : end - begin;
+    int offset = m_partitionSize > 0 ? 0 : begin;
+    for (int node = 0; node < numNodes(); node++) {
+      int blockBegin = node == 0 ? begin : offset + partitionBegin(node, size);
+      int blockEnd = node == numNodes() - 1
+                         ? end
+                         : offset + partitionBegin(node + 1, size);
+      blockBegin = std::clamp(blockBegin, begin, end);
+      m_nodeRanges[node].next = blockBegin;
+      m_nodeRanges[node].end = std::clamp(blockEnd, blockBegin, end);
+    }
+    m_pending = (int)m_workers.size();
+    m_generation++;
+  }
+  m_wake.notify_all();
+
+  workOn(0);
+
+  // Wait for the workers to finish their last chunks
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_done.wait(lock, [this] { return m_pending == 0; });
+}
+
+void ThreadPool::workOn(int thread) {
+  auto start = std::chrono::steady_clock::now();
+  ThreadStats &stats = m_threadStats[thread];
+  // The thread's own node first, then the others that still have work
+  int home = m_threadNodes[thread];
+  for (int i = 0; i < numNodes(); i++) {
+    NodeRange &range = m_nodeRanges[(home + i) % numNodes()];
+    int chunkBegin;
+    while ((chunkBegin = range.next.fetch_add(m_chunkSize)) < range.end) {
+      int chunkEnd = std::min(chunkBegin + m_chunkSize, range.end);
+      m_fn(m_context, chunkBegin, chunkEnd, thread);
+      stats.indices += chunkEnd - chunkBegin;
+      if (i > 0) {
+        stats.stolen += chunkEnd - chunkBegin;
+      }
+    }
+  }
+  std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+  stats.seconds += time.count();
+}
+
+void ThreadPool::workerLoop(int thread) {
+  unsigned int generation = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_wake.wait(lock,
+                  [&] { return m_stop || m_generation != generation; });
+      if (m_stop) {
+        return;
+      }
+      generation = m_generation;
+    }
+
+    workOn(thread);
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_pending--;
+      if (m_pending == 0) {
+        m_done.notify_one();
+      }
+    }
+  }
+}
@@ -0,0 +1,59 @@
+#include "timestepcontroller.h"
+
+#include <algorithm>
+#include <cmath>
+
+TimestepController::TimestepController()
+    : m_cflFactor(0.4f), m_forceFactor(0.25f), m_viscosityFactor(0.5f),
+      m_minDt(0.0005f), m_maxDt(1 / 60.f), m_maxSubsteps(8) {}
+
+TimestepController::~TimestepController() {}
+
+float TimestepController::computeDt(float smoothingRadius, float maxVelocity,
+                                    float maxAcceleration,
+                                    float viscosityRate) const {
+  float dt = m_maxDt;
+  // No particle may cross more than a fraction of its neighborhood per step
+  if (maxVelocity > 0) {
+    dt = std::min(dt, m_cflFactor * smoothingRadius / maxVelocity);
+  }
+  // Strong pressure forces need smaller steps even before particles speed up
+  if (maxAcceleration > 0) {
+    dt = std::min(dt, m_forceFactor * std::sqrt(smoothingRadius /
+                                                maxAcceleration));
+  }
+  // Explicit viscosity overshoots once a step removes more than the whole
+  // relative velocity
+  if (viscosityRate > 0) {
+    dt = std::min(dt, m_viscosityFactor / viscosityRate);
+  }
+  return std::max(dt, m_minDt);
+}
+
+float TimestepController::nextSubstep(float remaining, float stableDt) const {
+  float steps = std::ceil(remaining / stableDt);
+  return remaining / std::max(steps, 1.f);
+}
+
+void TimestepController::setCflFactor(float cflFactor) {
+  m_cflFactor = cflFactor;
+}
+
+void TimestepController::setForceFactor(float forceFactor) {
+  m_forceFactor = forceFactor;
+}
+
+void TimestepController::setViscosityFactor(float viscosityFactor) {
+  m_viscosityFactor = viscosityFactor;
+}
+
+void TimestepController::setDtLimits(float minDt, float maxDt) {
+  m_minDt = minDt;
+  m_maxDt = std::max(minDt, maxDt);
+}
+
+void TimestepController::setMaxSubsteps(int maxSubsteps) {
+  m_maxSubsteps = std::max(1, maxSubsteps);
+}
+
+int TimestepController::getMaxSubsteps() const { return m_maxSubsteps; }
@@ -1,10 +1,16 @@
 #version 150
 
 in vec4 fs_Col;
+in vec2 fs_Local;
 
 out vec4 out_Col;
 
 void main()
 {
+    // Particles drawn as quads are cut to the circle inside them, circle
+    // meshes lie within it already
+    if (dot(fs_Local, fs_Local) > 1.0) {
+        discard;
+    }
     out_Col = fs_Col;
 }
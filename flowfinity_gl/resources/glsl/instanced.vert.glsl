@@ -1,15 +1,25 @@
 #version 430
 
 uniform mat4 u_Model;
-uniform mat4 u_ViewProj;
 uniform mat3 u_ModelInvTr;
-uniform vec3 u_CamPos;
 
 uniform int u_NumInstances;
-uniform int u_Time;
-uniform float u_DeltaTime;
-uniform float u_MaxVelocity;
-uniform vec3[6] u_Colors;
+
+// Parameters shared by every draw of a frame, from one uniform buffer
+layout(std140) uniform FrameData {
+    mat4 u_ViewProj;
+    vec3 u_CamPos;
+    vec3 u_Colors[6];
+    vec3 u_PhaseColors[8];
+    float u_MaxVelocity;
+    float u_DeltaTime;
+    int u_Time;
+    int u_NumPhases;
+    // Particle radius, the shape is given at unit size
+    float u_Radius;
+    // Density the surface is drawn at
+    float u_Threshold;
+};
 
 in vec4 vs_Pos;
 in vec4 vs_Col;
@@ -22,8 +32,15 @@ layout(std430, binding = 1) buffer VelocityBuffer {
     float velocities[];
 };
 
+// One byte per instance, only filled when there is more than one phase
+layout(std430, binding = 2) buffer PhaseBuffer {
+    uint phases[];
+};
+
 out vec3 fs_Pos;
 out vec4 fs_Col;
+// Position on the unit shape, to cut the circle out of a quad
+out vec2 fs_Local;
 
 float saturate(float value) {
     return clamp(value, 0.0, 1.0);
@@ -57,11 +74,22 @@ void main() {
       mixedColor = mix(u_Colors[4], u_Colors[5], (normalizedSpeed / (interval * 5.0)));
   }
 
+  // Particles of the other phases keep their own color, lighter when fast
+  if (u_NumPhases > 1) {
+      uint instance = uint(gl_InstanceID);
+      uint phase = (phases[instance / 4u] >> (8u * (instance % 4u))) & 0xFFu;
+      if (phase > 0u) {
+          mixedColor = mix(u_PhaseColors[phase], vec3(1.0), 0.5 * normalizedSpeed);
+      }
+  }
+
   // Set the fragment's color
   fs_Col = vec4(mixedColor, 1.0);
 
+  fs_Local = vs_Pos.xy;
+
   // Adjust vertex position with the offset for this instance
-  vec4 pos = vec4(vs_Pos.xyz + vec3(positions[3 * gl_InstanceID], positions[3 * gl_InstanceID + 1], positions[3 * gl_InstanceID + 2]), 1.0);
+  vec4 pos = vec4(vs_Pos.xyz * u_Radius + vec3(positions[3 * gl_InstanceID], positions[3 * gl_InstanceID + 1], positions[3 * gl_InstanceID + 2]), 1.0);
   
   vec4 modelposition = u_Model * pos;
   fs_Pos = modelposition.xyz;
@@ -1,9 +1,23 @@
 #version 150
 
 uniform mat4 u_Model;
-uniform mat4 u_ViewProj;
 uniform mat3 u_ModelInvTr;
-uniform vec3 u_CamPos;
+
+// Parameters shared by every draw of a frame, from one uniform buffer
+layout(std140) uniform FrameData {
+    mat4 u_ViewProj;
+    vec3 u_CamPos;
+    vec3 u_Colors[6];
+    vec3 u_PhaseColors[8];
+    float u_MaxVelocity;
+    float u_DeltaTime;
+    int u_Time;
+    int u_NumPhases;
+    // Particle radius, the shape is given at unit size
+    float u_Radius;
+    // Density the surface is drawn at
+    float u_Threshold;
+};
 
 in vec4 vs_Pos;
 in vec4 vs_Col;
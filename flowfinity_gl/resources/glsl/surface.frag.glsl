@@ -0,0 +1,40 @@
+#version 150
+
+uniform sampler2D u_Density;
+
+// Parameters shared by every draw of a frame, from one uniform buffer
+layout(std140) uniform FrameData {
+    mat4 u_ViewProj;
+    vec3 u_CamPos;
+    vec3 u_Colors[6];
+    vec3 u_PhaseColors[8];
+    float u_MaxVelocity;
+    float u_DeltaTime;
+    int u_Time;
+    int u_NumPhases;
+    // Particle radius, the shape is given at unit size
+    float u_Radius;
+    // Density the surface is drawn at
+    float u_Threshold;
+};
+
+in vec2 fs_UV;
+
+out vec4 out_Col;
+
+void main() {
+  // Density relative to the mean particle density and speed
+  vec2 field = texture(u_Density, fs_UV).rg;
+  if (field.r < u_Threshold) {
+    discard;
+  }
+
+  // Same velocity gradient as the particles, evenly spaced over the colors
+  float speed = clamp(field.g / max(u_MaxVelocity, 1e-6), 0.0, 1.0) * 5.0;
+  int index = min(int(speed), 4);
+  vec3 color = mix(u_Colors[index], u_Colors[index + 1], speed - float(index));
+
+  // Darken towards the surface so the outline stands out
+  float depth = smoothstep(u_Threshold, u_Threshold * 1.6, field.r);
+  out_Col = vec4(color * mix(0.6, 1.0, depth), 1.0);
+}
@@ -0,0 +1,29 @@
+#version 150
+
+uniform mat4 u_Model;
+
+// Parameters shared by every draw of a frame, from one uniform buffer
+layout(std140) uniform FrameData {
+    mat4 u_ViewProj;
+    vec3 u_CamPos;
+    vec3 u_Colors[6];
+    vec3 u_PhaseColors[8];
+    float u_MaxVelocity;
+    float u_DeltaTime;
+    int u_Time;
+    int u_NumPhases;
+    // Particle radius, the shape is given at unit size
+    float u_Radius;
+    // Density the surface is drawn at
+    float u_Threshold;
+};
+
+in vec4 vs_Pos;
+
+out vec2 fs_UV;
+
+void main() {
+  // The square spans -1 to 1, the density grid 0 to 1
+  fs_UV = vs_Pos.xy * 0.5 + 0.5;
+  gl_Position = u_ViewProj * u_Model * vs_Pos;
+}
@@ -1,6 +1,9 @@
 #include "editor.h"
 #include "engine/drawable.h"
+#include "engine/startuptimeline.h"
 #include "flowfinity.h"
+#include "knnsearch.h"
+#include "spatialhash.h"
 
 #include <SDL.h>
 #include <SDL_events.h>
@@ -10,46 +13,112 @@
 #include <algorithm>
 #include <chrono>
 #include <climits>
+#include <cmath>
 #include <glm/ext/vector_float3.hpp>
 #include <glm/ext/vector_int3_sized.hpp>
+#include <glm/gtc/constants.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <iostream>
 
+// Where particles in free pool slots are kept, far outside of any scene
+static const glm::vec3 PARKED_POSITION(1e5f, 1e5f, 0);
+// Number of steps between checks whether the pool needs compacting
+static const int COMPACT_INTERVAL = 60;
+// Most cells a range query walks before it checks every particle instead
+static const int MAX_RANGE_CELLS = 1024;
+// Particle state a solver loop reads and writes per particle, roughly a
+// position, a velocity and a few scalars. Neighbor reads mostly hit the cache
+static const float BYTES_PER_PARTICLE =
+    2 * sizeof(glm::vec3) + 4 * sizeof(float);
+// Iterations every pressure solve takes before checking the tolerance
+static const int MIN_SOLVER_ITERATIONS = 2;
+// Segments a particle is pushed out of per step, for corners and crossings
+static const int MAX_SEGMENT_PASSES = 3;
+// Share of the partitioned range the live range may grow or shrink by before
+// the NUMA blocks are cut anew, which copies every particle array once
+static const float PARTITION_TOLERANCE = 0.125f;
+
 // Editor Constructor (Default Values)
 Editor::Editor()
-    : m_square(), m_square2(), m_circle(),
-      m_inputCircle(1, 25, glm::vec3(255, 0, 0)), m_bounds(glm::vec2(7.5, 4)),
-      m_prog_flat(), m_camera(), m_flowFinity(), m_elapsed_time(0),
+    : mp_window(nullptr), m_width(0), m_height(0), m_fixedFrameTime(0),
+      m_square(), m_square2(), m_circle(1, 40, glm::vec3(0, 150, 255)),
+      m_particleSprites(true), m_inputCircle(1, 25, glm::vec3(255, 0, 0)),
+      m_bounds(glm::vec2(7.5, 4)), m_prog_flat(), m_camera(), m_flowFinity(),
+      m_inputPoints(), m_touches(), m_inputForces(), m_inputParticles(),
+      m_elapsed_time(0),
       m_lastTime(std::chrono::high_resolution_clock::now()), m_positions(),
       m_velocities(), m_predicted_positions(), m_densities(),
+      m_nearDensities(),
       m_numInstances(10), m_particleSize(1), m_particleDamping(-0.1),
       m_particleSpacing(0), m_started(false), m_densityRadius(1),
-      m_targetDensity(2.75), m_pressureMultiplier(10), m_gravity(0),
+      m_pressureMultiplier(10), m_gravity(0),
       m_randomLocation(false), m_randomLocationGenerated(false),
-      m_spatialHash(), m_startIndices(), m_maxVelocity(0),
-      m_testClickPoint(0, 0), m_clickStrength(0), m_viscosityStrength(0),
-      m_colors() {}
+      m_spatialHash(), m_startIndices(), m_hashCount(0), m_hashCellSize(1),
+      m_hashPositions(nullptr), m_hashStale(false), m_maxVelocity(0),
+      m_testClickPoint(0, 0), m_clickStrength(0),
+      m_pool(), m_capacity(0), m_emitters(),
+      m_emitterAccumulators(), m_sinks(), m_stepCount(0), m_threadPool(),
+      m_sortOrder(), m_nodeThroughput(), m_nodeStats(),
+      m_nodeStatsTime(std::chrono::steady_clock::now()), m_resetDirty(true),
+      m_timestepController(), m_adaptiveTimestep(false),
+      m_stepMaxVelocity(0), m_maxAcceleration(0), m_maxDensity(0),
+      m_substeps(0), m_timestep(0), m_solverMode(SolverMode::WCSPH),
+      m_solverTolerance(0.01f), m_solverMaxIterations(50), m_warmStart(true),
+      m_pbfIterations(4), m_pbfRelaxation(1), m_xsphViscosity(0.01f),
+      m_solverIterations(0), m_solverError(0), m_pressures(),
+      m_divergencePressures(), m_alphas(), m_stiffness(),
+      m_pressureAccelerations(), m_positionCorrections(), m_tempVelocities(),
+      m_threadSums(m_threadPool.numThreads(), 0.f), m_activityTracker(),
+      m_sleeping(false), m_sleepVelocity(0.05f), m_sleepDensityChange(0.002f),
+      m_awake(), m_sleepDensities(), m_activeFraction(1), m_obstacles(),
+      m_sdfGrid(), m_segmentBvh(), m_obstacleMode(ObstacleMode::SDF),
+      m_obstacleCellSize(0.05f),
+      m_obstacleLines(glm::vec3(230, 230, 230)), m_bodyConfigs(), m_bodies(),
+      m_boundaryDensities(), m_coupledParticles(), m_bodyLines(), m_phases(),
+      m_restDensities(1, 2.75f), m_viscosities(1, 0.f),
+      m_phaseColors(1, glm::vec3(0)), m_phaseMasses(1, 1.f), m_phaseConfigs(),
+      m_surfaceRendering(false), m_surfaceResolution(240),
+      m_surfaceThreshold(0.5f), m_prog_surface(), m_surfaceTexture(0),
+      m_surfaceWidth(0), m_surfaceHeight(0), m_surfaceExtent(0),
+      m_surfacePoints(), m_surfaceDensities(), m_surfaceVelocities(),
+      m_surfaceTexels(), m_surfaceOutline(false), m_outlineDensity(0),
+      m_surfaceExtractor(), m_surfaceLines(glm::vec3(255, 255, 255)),
+      m_colors(), m_blocks() {}
 
 Editor::~Editor() {
   glDeleteVertexArrays(1, &vao);
+  glDeleteTextures(1, &m_surfaceTexture);
   m_square.destroy();
+  m_surfaceLines.destroy();
 }
 
 // Initialize the Editor OpenGL Context
 int Editor::initialize(SDL_Window *window, SDL_GLContext gl_context) {
   mp_window = window;
 
-  SDL_GL_GetDrawableSize(window, &m_width, &m_height);
+  // Without a window the size is the one given to resize()
+  if (window) {
+    SDL_GL_GetDrawableSize(window, &m_width, &m_height);
+  }
   m_camera = Camera(m_width, m_height);
   m_camera.TranslateAlongUp(-1);
 
   GLenum err = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+  // Offscreen contexts have no GLX display, GLEW has loaded the GL functions
+  // by the time it looks for one
+  if (!window && err == GLEW_ERROR_NO_GLX_DISPLAY) {
+    err = GLEW_OK;
+  }
+#endif
   if (err != GLEW_OK) {
     std::cout << "Failed to init GLEW" << std::endl;
-    SDL_GL_DeleteContext(gl_context);
-    SDL_DestroyWindow(window);
-    SDL_Quit();
+    if (window) {
+      SDL_GL_DeleteContext(gl_context);
+      SDL_DestroyWindow(window);
+      SDL_Quit();
+    }
     return 1;
   }
 
@@ -68,13 +137,34 @@ int Editor::initialize(SDL_Window *window, SDL_GLContext gl_context) {
   // Create a Vertex Attribute Object
   glGenVertexArrays(1, &vao);
 
-  // m_square.create();
+  m_square.create();
   // m_square2.create();
   m_circle.create();
   m_inputCircle.drawMode();
   m_inputCircle.createLines();
-  m_prog_instanced.create("instanced.vert.glsl", "instanced.frag.glsl");
-  m_prog_flat.create("passthrough.vert.glsl", "flat.frag.glsl");
+  // Every program is issued before any is waited on, so the driver can build
+  // them side by side
+  ShaderProgram::enableParallelCompile();
+  m_prog_instanced.compile("instanced.vert.glsl", "instanced.frag.glsl");
+  m_prog_flat.compile("passthrough.vert.glsl", "flat.frag.glsl");
+  m_prog_surface.compile("surface.vert.glsl", "surface.frag.glsl");
+  StartupTimeline::mark("shaders issued");
+  int cached = m_prog_instanced.finish();
+  cached += m_prog_flat.finish();
+  cached += m_prog_surface.finish();
+  StartupTimeline::mark("shaders ready (" + std::to_string(cached) +
+                        " of 3 from cache)");
+  m_frameData.create();
+  m_frameTimer.create();
+  // Filtered between the grid cells, so the surface is smooth at any grid
+  // resolution
+  glGenTextures(1, &m_surfaceTexture);
+  glBindTexture(GL_TEXTURE_2D, m_surfaceTexture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D, 0);
   initInstances();
 
   // We have to have a VAO bound in OpenGL 3.2 Core. But if we're not
@@ -88,76 +178,579 @@ int Editor::initialize(SDL_Window *window, SDL_GLContext gl_context) {
 }
 
 // Command to start the simulation
-void Editor::startSimulation() { m_started = true; }
+void Editor::startSimulation() {
+  // Make sure the instance buffers exist, the scene may start without ever
+  // being painted in the idle state
+  m_prog_instanced.setNumInstances(m_pool.capacity());
+  m_started = true;
+  resetActivity();
+  // The particles move from here on, the next reset has to rebuild them
+  m_resetDirty = true;
+  m_lastTime = std::chrono::high_resolution_clock::now();
+}
 
 // Refresh the simulation (runs every tick if simulation is not started)
 void Editor::resetSimulation() {
   m_elapsed_time = 0;
-  // if the random locations are on, and they have been generated, don't reset
-  // the offsets
-  if (!m_randomLocation || !m_randomLocationGenerated) {
-    m_positions.clear();
-  }
-  m_velocities.clear();
-  m_predicted_positions.clear();
-  m_densities.clear();
-  m_spatialHash.clear();
-  m_startIndices.clear();
   m_started = false;
   m_maxVelocity = 0;
+  m_stepMaxVelocity = 0;
+  m_maxAcceleration = 0;
+  m_maxDensity = 0;
+  // Nothing changed since the last reset, the particles are still in place
+  if (!m_resetDirty) {
+    return;
+  }
+  // Random locations generated for a different pool size can't be kept
+  if ((int)m_positions.size() != std::max(m_capacity, m_numInstances)) {
+    m_randomLocationGenerated = false;
+  }
+  m_stepCount = 0;
+  std::fill(m_emitterAccumulators.begin(), m_emitterAccumulators.end(), 0.f);
   initInstances();
+  m_resetDirty = false;
+}
+
+// Apply every parameter of a scene and rebuild the particles from it
+void Editor::loadScene(const SceneConfig &scene) {
+  m_blocks = scene.blocks;
+  m_resetDirty = true;
+  int numInstances = scene.numInstances;
+  if (!m_blocks.empty()) {
+    numInstances = 0;
+    for (const ParticleBlock &block : m_blocks) {
+      numInstances += block.count;
+    }
+  }
+  setNumInstances(numInstances);
+  setCapacity(scene.capacity);
+  m_emitters = scene.emitters;
+  m_emitterAccumulators.assign(m_emitters.size(), 0.f);
+  m_sinks = scene.sinks;
+  setParticleSize(scene.particleSize);
+  setParticleDamping(scene.particleDamping);
+  setParticleSpacing(scene.particleSpacing);
+  setDensityRadius(scene.densityRadius);
+  setTargetDensity(scene.targetDensity);
+  setPressureMultiplier(scene.pressureMultiplier);
+  setNearPressureMultiplier(scene.nearPressureMultiplier);
+  setGravity(scene.gravity);
+  setBounds(scene.bounds);
+  setRandomLocation(scene.randomLocation);
+  setRandomLocationGenerated(false);
+  setInputRadius(scene.inputRadius);
+  setInputStrengthMultiplier(scene.inputStrengthMultiplier);
+  setViscosityStrength(scene.viscosityStrength);
+  setColors(scene.colors);
+  setAdaptiveTimestep(scene.adaptiveTimestep);
+  setCflFactor(scene.cflFactor);
+  setForceFactor(scene.forceFactor);
+  setViscosityFactor(scene.viscosityFactor);
+  setTimestepLimits(scene.minTimestep, scene.maxTimestep);
+  setMaxSubsteps(scene.maxSubsteps);
+  setSolverMode(scene.solverMode);
+  setSolverTolerance(scene.solverTolerance);
+  setSolverIterations(scene.solverIterations);
+  setWarmStart(scene.warmStart);
+  setPbfIterations(scene.pbfIterations);
+  setPbfRelaxation(scene.pbfRelaxation);
+  setXsphViscosity(scene.xsphViscosity);
+  setSleeping(scene.sleeping);
+  setSleepThresholds(scene.sleepVelocity, scene.sleepDensityChange);
+  setSleepSteps(scene.sleepSteps);
+  setObstacleMode(scene.obstacleMode);
+  setObstacleCellSize(scene.obstacleCellSize);
+  setObstacles(scene.obstacles);
+  setBodies(scene.bodies);
+  setPhases(scene.phases);
+  setParticleSprites(scene.particleSprites);
+  setSurfaceRendering(scene.surfaceRendering);
+  setSurfaceResolution(scene.surfaceResolution);
+  setSurfaceThreshold(scene.surfaceThreshold);
+  setSurfaceOutline(scene.surfaceOutline);
+  setOutlineTolerance(scene.outlineTolerance);
+
+  resetSimulation();
+  if (scene.autoStart) {
+    startSimulation();
+  }
+}
+
+// Position of a particle spread evenly over the scene's particle blocks
+glm::vec3 Editor::blockPosition(int index) {
+  for (const ParticleBlock &block : m_blocks) {
+    if (index >= block.count) {
+      index -= block.count;
+      continue;
+    }
+    // Pick the grid for the block so the cells are as square as possible
+    glm::vec2 size = block.max - block.min;
+    float aspect = size.x / std::max(size.y, 1e-4f);
+    int cols = std::max(1, (int)std::round(sqrt(block.count * aspect)));
+    int rows = (block.count - 1) / cols + 1;
+    glm::vec2 cellSize = size / glm::vec2(cols, rows);
+    return glm::vec3(block.min.x + (index % cols + 0.5f) * cellSize.x,
+                     block.min.y + (index / cols + 0.5f) * cellSize.y, 0);
+  }
+  return glm::vec3(0);
 }
 
 // Run this right before starting up the simulation
 void Editor::initInstances() {
 
   // Place particles in a grid formation
-  int particlesPerRow = (int)sqrt(m_numInstances);
+  int particlesPerRow = std::max(1, (int)sqrt(m_numInstances));
   int particlesPerCol = (m_numInstances - 1) / particlesPerRow + 1;
   float spacing = m_particleSpacing + m_particleSize * 2;
 
+  // Every slot of the pool is allocated up front, only the initial particles
+  // start alive
+  int capacity = std::max(m_capacity, m_numInstances);
+  m_pool.reset(capacity, m_numInstances);
+
+  // Resizing keeps the memory of the vectors, so once they have grown to the
+  // capacity resets don't allocate anymore. The particle arrays are left
+  // unwritten here, the first write below happens on the threads of the NUMA
+  // node that owns the particle, which places its memory on that node. The
+  // solvers only run over the live range, so the nodes' blocks are cut from
+  // it instead of the capacity
+  m_threadPool.setPartition(m_numInstances);
+  m_sortOrder.resize(capacity);
+  m_positions.resize(capacity);
+  m_velocities.resize(capacity);
+  m_predicted_positions.resize(capacity);
+  m_densities.resize(capacity);
+  m_nearDensities.resize(capacity);
+  m_phases.resize(capacity);
+  m_pressures.resize(capacity);
+  m_divergencePressures.resize(capacity);
+  m_alphas.resize(capacity);
+  m_stiffness.resize(capacity);
+  m_pressureAccelerations.resize(capacity);
+  m_positionCorrections.resize(capacity);
+  m_tempVelocities.resize(capacity);
+  m_inputForces.resize(capacity);
+  m_inputParticles.reserve(capacity);
+  m_awake.resize(capacity);
+  m_sleepDensities.resize(capacity);
+  m_boundaryDensities.resize(capacity);
+  m_coupledParticles.reserve(capacity);
+  m_spatialHash.resize(capacity);
+  m_startIndices.resize(capacity);
+  m_hashCount = 0;
+
+  // if the random locations are on, and they have been generated, don't reset
+  // the offsets
+  bool keepPositions = m_randomLocation && m_randomLocationGenerated;
+
   // Give Vectors Initial Values
-  for (int i = 0; i < m_numInstances; i++) {
-    m_densities.push_back(0);
-    m_spatialHash.push_back(std::make_pair(0, 0));
-    m_startIndices.push_back(INT_MAX);
-    m_velocities.push_back(glm::vec3(0, 0, 0));
-    m_predicted_positions.push_back(glm::vec3(0, 0, 0));
-    if (!m_randomLocation) {
-      m_positions.push_back(glm::vec3((i % particlesPerRow) * spacing -
-                                          (particlesPerRow - 1) * spacing / 2.f,
-                                      (i / particlesPerRow) * spacing -
-                                          (particlesPerCol - 1) * spacing / 2.f,
-                                      0));
-    }
-    // If the random Locations havent already been generated
-    else if (!m_randomLocationGenerated) {
-      // Push back a random position within the bounds -x to x, -y to y
-      m_positions.push_back(glm::vec3(
+  m_threadPool.parallelFor(0, capacity, [&](int i) {
+    m_sortOrder[i] = i;
+    m_densities[i] = 0;
+    m_nearDensities[i] = 0;
+    m_phases[i] = 0;
+    m_pressures[i] = 0;
+    m_divergencePressures[i] = 0;
+    m_alphas[i] = 0;
+    m_stiffness[i] = 0;
+    m_pressureAccelerations[i] = glm::vec3(0);
+    m_positionCorrections[i] = glm::vec3(0);
+    m_tempVelocities[i] = glm::vec3(0);
+    m_inputForces[i] = glm::vec3(0);
+    m_awake[i] = i < m_numInstances;
+    m_sleepDensities[i] = 0;
+    m_boundaryDensities[i] = -1;
+    m_spatialHash[i] = std::make_pair(0, 0);
+    m_startIndices[i] = INT_MAX;
+    m_velocities[i] = glm::vec3(0, 0, 0);
+    m_predicted_positions[i] = glm::vec3(0, 0, 0);
+    if (i >= m_numInstances) {
+      // Free slots wait out of sight until an emitter spawns into them
+      m_positions[i] = PARKED_POSITION;
+    } else if (keepPositions || m_randomLocation) {
+      return;
+    } else if (!m_blocks.empty()) {
+      m_positions[i] = blockPosition(i);
+    } else {
+      m_positions[i] = glm::vec3((i % particlesPerRow) * spacing -
+                                     (particlesPerRow - 1) * spacing / 2.f,
+                                 (i / particlesPerRow) * spacing -
+                                     (particlesPerCol - 1) * spacing / 2.f,
+                                 0);
+    }
+  });
+
+  // If the random locations are on but have not been generated, they should be
+  // generated now. rand() is not thread safe, so this stays serial
+  if (m_randomLocation && !m_randomLocationGenerated) {
+    for (int i = 0; i < capacity; i++) {
+      if (i >= m_numInstances) {
+        m_positions[i] = PARKED_POSITION;
+        continue;
+      }
+      // A random position within the bounds -x to x, -y to y
+      m_positions[i] = glm::vec3(
           (rand() % (int)(m_bounds.x * 2 * 100) - (int)m_bounds.x * 100) /
               100.f,
           (rand() % (int)(m_bounds.y * 2 * 100) - (int)m_bounds.y * 100) /
               100.f,
-          0));
+          0);
     }
-  }
-  // If the random locations are on but have not been generated, they should be
-  // generated now
-  if (m_randomLocation && !m_randomLocationGenerated) {
     m_randomLocationGenerated = true;
   }
+
+  // Particles take the phase of the block they start in
+  int first = 0;
+  for (const ParticleBlock &block : m_blocks) {
+    int phase = std::clamp(block.phase, 0, (int)m_restDensities.size() - 1);
+    int last = std::min(first + block.count, m_numInstances);
+    std::fill(m_phases.begin() + first, m_phases.begin() + last, phase);
+    first = last;
+  }
+  resetBodies();
   m_lastTime = std::chrono::high_resolution_clock::now();
 }
 
-// Hashing Helper Functions
-glm::vec2 positionToCell(glm::vec3 pos, float radius) {
-  return glm::vec2((int)(pos.x / radius), (int)(pos.y / radius));
+// Take a particle out of the simulation, its slot is free again
+void Editor::parkParticle(int index) {
+  m_positions[index] = PARKED_POSITION;
+  m_predicted_positions[index] = PARKED_POSITION;
+  m_velocities[index] = glm::vec3(0);
+  m_densities[index] = 0;
+  m_nearDensities[index] = 0;
+  m_pressures[index] = 0;
+  m_divergencePressures[index] = 0;
+  m_pressureAccelerations[index] = glm::vec3(0);
+  m_sleepDensities[index] = 0;
+}
+
+// Spawn new particles from the emitters into free slots of the pool
+void Editor::emitParticles(float dt) {
+  for (int e = 0; e < (int)m_emitters.size(); e++) {
+    const ParticleEmitter &emitter = m_emitters[e];
+    m_emitterAccumulators[e] += emitter.rate * dt;
+    while (m_emitterAccumulators[e] >= 1) {
+      int index = m_pool.allocate();
+      if (index == -1) {
+        // The pool is full, wait for a sink to free up slots
+        m_emitterAccumulators[e] = 0;
+        break;
+      }
+      m_emitterAccumulators[e] -= 1;
+      glm::vec2 t(rand() / (float)RAND_MAX, rand() / (float)RAND_MAX);
+      glm::vec2 pos = emitter.min + (emitter.max - emitter.min) * t;
+      m_positions[index] = glm::vec3(pos, 0);
+      m_predicted_positions[index] = m_positions[index];
+      m_velocities[index] = glm::vec3(emitter.velocity, 0);
+      m_phases[index] =
+          std::clamp(emitter.phase, 0, (int)m_restDensities.size() - 1);
+      m_densities[index] = 0;
+      m_nearDensities[index] = 0;
+      m_pressures[index] = 0;
+      m_divergencePressures[index] = 0;
+      m_pressureAccelerations[index] = glm::vec3(0);
+      m_sleepDensities[index] = 0;
+      // New particles move, so the cell they appear in can't sleep
+      m_activityTracker.wakeCell(m_activityTracker.cellOf(m_positions[index]));
+    }
+  }
+}
+
+// Remove every particle that entered a sink
+void Editor::drainParticles() {
+  if (m_sinks.empty()) {
+    return;
+  }
+  m_threadPool.parallelFor(0, m_pool.highWater(), [&](int i) {
+    if (!m_pool.isAlive(i)) {
+      return;
+    }
+    for (const ParticleSink &sink : m_sinks) {
+      if (m_positions[i].x >= sink.min.x && m_positions[i].x <= sink.max.x &&
+          m_positions[i].y >= sink.min.y && m_positions[i].y <= sink.max.y) {
+        // Few particles drain per step, so the free list can take a lock
+        {
+          std::lock_guard<std::mutex> lock(m_drainMutex);
+          m_pool.release(i);
+        }
+        parkParticle(i);
+        break;
+      }
+    }
+  });
+}
+
+// Pack the live particles to the front of the pool once enough holes pile up
+void Editor::compactParticles() {
+  if (m_pool.fragmentation() < 0.25f) {
+    return;
+  }
+  m_pool.compact([this](int from, int to) {
+    m_positions[to] = m_positions[from];
+    m_predicted_positions[to] = m_predicted_positions[from];
+    m_velocities[to] = m_velocities[from];
+    m_densities[to] = m_densities[from];
+    m_nearDensities[to] = m_nearDensities[from];
+    m_phases[to] = m_phases[from];
+    m_pressures[to] = m_pressures[from];
+    m_divergencePressures[to] = m_divergencePressures[from];
+    m_sleepDensities[to] = m_sleepDensities[from];
+    parkParticle(from);
+  });
+}
+
+void Editor::sortParticles() {
+  int num = m_pool.highWater();
+  const float h = m_densityRadius;
+  int rows = std::max(1, (int)std::ceil(2 * m_bounds.y / h));
+  // The spatial hash is rebuilt at the start of every step, so it can hold
+  // the (column major cell, slot) pairs meanwhile
+  int live = 0;
+  for (int i = 0; i < num; i++) {
+    if (!m_pool.isAlive(i)) {
+      continue;
+    }
+    glm::vec2 cell = (glm::vec2(m_positions[i]) + m_bounds) / h;
+    int column = std::max(0, (int)cell.x);
+    int row = std::clamp((int)cell.y, 0, rows - 1);
+    m_spatialHash[live++] = std::make_pair(column * rows + row, i);
+  }
+  std::sort(m_spatialHash.begin(), m_spatialHash.begin() + live,
+            [](auto &left, auto &right) { return left.first < right.first; });
+
+  // The live slots take the particles in cell order, free slots stay free
+  for (int i = 0, next = 0; i < num; i++) {
+    m_sortOrder[i] = m_pool.isAlive(i) ? m_spatialHash[next++].second : i;
+  }
+  // Follow every cycle of the order, each swap moves one particle into place
+  for (int i = 0; i < num; i++) {
+    int slot = i;
+    while (m_sortOrder[slot] != i) {
+      int source = m_sortOrder[slot];
+      swapParticles(slot, source);
+      m_sortOrder[slot] = slot;
+      slot = source;
+    }
+    m_sortOrder[slot] = slot;
+  }
+}
+
+// Swap the state of two particles that lasts from one step to the next
+void Editor::swapParticles(int a, int b) {
+  std::swap(m_positions[a], m_positions[b]);
+  std::swap(m_predicted_positions[a], m_predicted_positions[b]);
+  std::swap(m_velocities[a], m_velocities[b]);
+  std::swap(m_densities[a], m_densities[b]);
+  std::swap(m_nearDensities[a], m_nearDensities[b]);
+  std::swap(m_phases[a], m_phases[b]);
+  std::swap(m_pressures[a], m_pressures[b]);
+  std::swap(m_divergencePressures[a], m_divergencePressures[b]);
+  std::swap(m_sleepDensities[a], m_sleepDensities[b]);
+}
+
+// Copy a particle array into fresh memory on the pool's threads, the first
+// write places every node's block of it on that node
+template <typename T>
+static void placeOnNodes(ThreadPool &threadPool, ParticleArray<T> &array) {
+  ParticleArray<T> placed(array.size());
+  threadPool.parallelFor(0, (int)array.size(),
+                         [&](int i) { placed[i] = array[i]; });
+  array.swap(placed);
+}
+
+void Editor::partitionParticles() {
+  int size = m_pool.highWater();
+  int current = m_threadPool.partitionSize();
+  if (current > 0 &&
+      std::abs(size - current) <= current * PARTITION_TOLERANCE) {
+    return;
+  }
+  m_threadPool.setPartition(size);
+  placeOnNodes(m_threadPool, m_sortOrder);
+  placeOnNodes(m_threadPool, m_positions);
+  placeOnNodes(m_threadPool, m_velocities);
+  placeOnNodes(m_threadPool, m_predicted_positions);
+  placeOnNodes(m_threadPool, m_densities);
+  placeOnNodes(m_threadPool, m_nearDensities);
+  placeOnNodes(m_threadPool, m_phases);
+  placeOnNodes(m_threadPool, m_pressures);
+  placeOnNodes(m_threadPool, m_divergencePressures);
+  placeOnNodes(m_threadPool, m_alphas);
+  placeOnNodes(m_threadPool, m_stiffness);
+  placeOnNodes(m_threadPool, m_pressureAccelerations);
+  placeOnNodes(m_threadPool, m_positionCorrections);
+  placeOnNodes(m_threadPool, m_tempVelocities);
+  placeOnNodes(m_threadPool, m_inputForces);
+  placeOnNodes(m_threadPool, m_awake);
+  placeOnNodes(m_threadPool, m_sleepDensities);
+  placeOnNodes(m_threadPool, m_boundaryDensities);
+}
+
+void Editor::updateNodeThroughput() {
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - m_nodeStatsTime;
+  if (elapsed.count() < 1) {
+    return;
+  }
+  m_nodeStatsTime = std::chrono::steady_clock::now();
+  m_threadPool.takeNodeStats(m_nodeStats);
+  m_nodeThroughput.resize(m_nodeStats.size());
+  for (size_t node = 0; node < m_nodeStats.size(); node++) {
+    const ThreadPool::NodeStats &stats = m_nodeStats[node];
+    float particlesPerSecond =
+        stats.seconds > 0 ? (float)(stats.indices / stats.seconds) : 0;
+    m_nodeThroughput[node] = NodeThroughput{
+        particlesPerSecond, particlesPerSecond * BYTES_PER_PARTICLE,
+        stats.indices > 0 ? (float)stats.stolen / stats.indices : 0};
+  }
+}
+
+// Fill the phase tables from the base fluid and the phases of the scene
+void Editor::rebuildPhases() {
+  float restDensity = m_restDensities[0];
+  float viscosity = m_viscosities[0];
+  m_restDensities.assign(1, restDensity);
+  m_viscosities.assign(1, viscosity);
+  m_phaseColors.assign(1, glm::vec3(0));
+  m_phaseMasses.assign(1, 1.f);
+  for (const FluidPhase &phase : m_phaseConfigs) {
+    m_restDensities.push_back(restDensity * phase.density);
+    m_viscosities.push_back(phase.viscosity);
+    m_phaseColors.push_back(phase.color);
+    // Every phase is at rest at the same number of particles per area, so
+    // the mass of its particles makes up the difference in density
+    m_phaseMasses.push_back(phase.density);
+  }
+}
+
+// Mass of a particle relative to the base fluid
+template <bool MultiPhase> float Editor::phaseMass(int index) const {
+  if constexpr (MultiPhase) {
+    return m_phaseMasses[m_phases[index]];
+  }
+  return 1;
 }
 
-unsigned int hashCell(glm::vec2 cell) {
-  unsigned int a = (unsigned int)cell.x * 15823;
-  unsigned int b = (unsigned int)cell.y * 9737333;
-  return a + b;
+template <bool MultiPhase> float Editor::phaseViscosity(int index) const {
+  if constexpr (MultiPhase) {
+    return m_viscosities[m_phases[index]];
+  }
+  return m_viscosities[0];
+}
+
+// Sample the obstacles into the distance grid or the segment BVH, and rebuild
+// their outlines
+void Editor::rebuildObstacles() {
+  // One spare cell around the bounds so particles on a wall still sample it
+  glm::vec2 padding(m_obstacleCellSize);
+  m_sdfGrid.reset(-m_bounds - padding, m_bounds + padding, m_obstacleCellSize);
+  // The distance grid only holds the obstacles in SDF mode, the outline
+  // segments are always needed for drawing
+  bool sdf = m_obstacleMode == ObstacleMode::SDF;
+  std::vector<glm::vec2> segments;
+  std::vector<float> radii;
+  for (const Obstacle &obstacle : m_obstacles) {
+    const std::vector<glm::vec2> &points = obstacle.points;
+    switch (obstacle.shape) {
+    case ObstacleShape::Circle: {
+      if (sdf) {
+        m_sdfGrid.addCircle(points[0], obstacle.size);
+      }
+      const int sides = 40;
+      for (int i = 0; i < sides; i++) {
+        float a0 = 2 * glm::pi<float>() * i / sides;
+        float a1 = 2 * glm::pi<float>() * (i + 1) / sides;
+        segments.push_back(points[0] + obstacle.size *
+                                           glm::vec2(cos(a0), sin(a0)));
+        segments.push_back(points[0] + obstacle.size *
+                                           glm::vec2(cos(a1), sin(a1)));
+      }
+      break;
+    }
+    case ObstacleShape::Box: {
+      if (sdf) {
+        m_sdfGrid.addBox(points[0], points[1]);
+      }
+      glm::vec2 corners[4] = {points[0], glm::vec2(points[1].x, points[0].y),
+                              points[1], glm::vec2(points[0].x, points[1].y)};
+      for (int i = 0; i < 4; i++) {
+        segments.push_back(corners[i]);
+        segments.push_back(corners[(i + 1) % 4]);
+      }
+      break;
+    }
+    case ObstacleShape::Polygon:
+      if (sdf) {
+        m_sdfGrid.addPolygon(points);
+      }
+      for (size_t i = 0; i < points.size(); i++) {
+        segments.push_back(points[i]);
+        segments.push_back(points[(i + 1) % points.size()]);
+      }
+      break;
+    case ObstacleShape::Polyline:
+      if (sdf) {
+        m_sdfGrid.addPolyline(points, obstacle.size);
+      }
+      for (size_t i = 1; i < points.size(); i++) {
+        segments.push_back(points[i - 1]);
+        segments.push_back(points[i]);
+      }
+      break;
+    }
+    // Only polylines are thick, the other outlines are exact
+    float radius =
+        obstacle.shape == ObstacleShape::Polyline ? obstacle.size / 2.f : 0.f;
+    radii.resize(segments.size() / 2, radius);
+  }
+  m_segmentBvh.build(sdf ? std::vector<glm::vec2>() : segments, radii);
+  m_obstacleLines.setSegments(segments);
+  m_obstacleLines.create();
+}
+
+// Rebuild the sleeping cell grid over the bounds, everything starts awake
+void Editor::resetActivity() {
+  m_activityTracker.reset(-m_bounds, m_bounds, m_densityRadius);
+  m_activeFraction = 1;
+}
+
+// Decide which particles are simulated this step, particles in sleeping cells
+// are skipped
+void Editor::updateActivity(int num) {
+  if (m_sleeping) {
+    // The mouse and the touches can move everything in their radius
+    for (const InputPoint &input : m_inputPoints) {
+      m_activityTracker.wakeRadius(input.position * 2.f, m_inputRadius);
+    }
+  }
+  m_threadPool.parallelFor(0, num, [&](int i) {
+    m_awake[i] = m_pool.isAlive(i) &&
+                 (!m_sleeping || m_activityTracker.isAwake(
+                                     m_activityTracker.cellOf(m_positions[i])));
+  });
+  float active = sumOverParticles(num, [&](int i) { return m_awake[i]; });
+  m_activeFraction = active / std::max(1, m_pool.liveCount());
+}
+
+// Keep the cells around every particle that still moves or changes density
+// awake, every other cell gets one step closer to falling asleep
+void Editor::reportActivity(int num) {
+  if (!m_sleeping) {
+    return;
+  }
+  m_threadPool.parallelFor(0, num, [&](int i) {
+    if (!m_awake[i]) {
+      return;
+    }
+    float densityChange = std::abs(m_densities[i] - m_sleepDensities[i]) /
+                          std::max(m_densities[i], 1e-6f);
+    m_sleepDensities[i] = m_densities[i];
+    if (glm::length(m_velocities[i]) > m_sleepVelocity ||
+        densityChange > m_sleepDensityChange) {
+      m_activityTracker.wakeCell(m_activityTracker.cellOf(m_positions[i]));
+    }
+  });
+  m_activityTracker.endStep();
 }
 
 unsigned int Editor::getKeyFromHash(unsigned int hash) {
@@ -166,19 +759,33 @@ unsigned int Editor::getKeyFromHash(unsigned int hash) {
 }
 
 void Editor::updateSpatialHash(float radius) {
-  for (int i = 0; i < m_positions.size(); i++) {
+  updateSpatialHash(radius, m_positions);
+}
+
+void Editor::updateSpatialHash(float radius,
+                               const ParticleArray<glm::vec3> &positions) {
+  // Range queries walk the cells of this build
+  m_hashCellSize = radius;
+  m_hashPositions = &positions;
+  m_hashStale = false;
+  // Free slots are all parked in one cell, only live particles are hashed
+  m_hashCount = 0;
+  for (int i = 0; i < m_pool.highWater(); i++) {
+    if (!m_pool.isAlive(i)) {
+      continue;
+    }
     // Gets Cell Key for each particle and updates for each index
-    glm::vec2 cell = positionToCell(m_positions[i], radius);
+    glm::vec2 cell = positionToCell(positions[i], radius);
     unsigned int hash = getKeyFromHash(hashCell(cell));
-    m_spatialHash[i] = std::make_pair(hash, i);
+    m_spatialHash[m_hashCount++] = std::make_pair(hash, i);
   }
 
   // Sort the spatial hash array by the first value in the pair, the cell key
-  std::sort(m_spatialHash.begin(), m_spatialHash.end(),
+  std::sort(m_spatialHash.begin(), m_spatialHash.begin() + m_hashCount,
             [](auto &left, auto &right) { return left.first < right.first; });
 
   // Find the start indices for each cell
-  for (int i = 0; i < m_spatialHash.size(); i++) {
+  for (int i = 0; i < m_hashCount; i++) {
     unsigned int hash = m_spatialHash[i].first;
     // If the hash is different from the previous hash, update the start index
     unsigned int hashPrev = i == 0 ? INT_MAX : m_spatialHash[i - 1].first;
@@ -203,7 +810,7 @@ glm::vec3 Editor::forEachPointInRadius(glm::vec3 pos, float radius, int caseNum,
     int cellStartIndex = m_startIndices[key];
 
     // Loop over all points that have the key
-    for (int i = cellStartIndex; i < m_spatialHash.size(); i++) {
+    for (int i = cellStartIndex; i < m_hashCount; i++) {
       // Exit if the key is different (not the correct cell)
       if (m_spatialHash[i].first != key) {
         break;
@@ -218,33 +825,24 @@ glm::vec3 Editor::forEachPointInRadius(glm::vec3 pos, float radius, int caseNum,
         float influence;
         switch (caseNum) {
         case 0:
-          // Calculate Density Sum for the given point and the specific neighbor
-          result += glm::vec3(m_flowFinity.calculateDensity(pos, index, radius),
-                              0, 0);
+          // Calculate Density and Near Density Sums for the given point and
+          // the specific neighbor
+          result += glm::vec3(
+              m_flowFinity.calculateDensity(pos, index, radius),
+              m_flowFinity.calculateNearDensity(pos, index, radius), 0);
           break;
         case 1:
           // Calculate Pressure Force Sum for the given point and the specific
           // neighbor
           result += m_flowFinity.CalulatePressureForce(posIndex, index, radius);
           break;
-        case 2:
-          // Calculate Mouse Force for the given point and the specific
-          // neighbor and set it to the velocity
-          m_velocities[index] +=
-              glm::vec3(
-                  interactionForce(index, radius, m_inputStrengthMultiplier),
-                  0) *
-              (1 / 12.f);
-          // Update the max velocity
-          m_maxVelocity =
-              std::max(m_maxVelocity, glm::length(m_velocities[index]));
-          break;
         case 3:
           // Calculate Visosity Force for the given point and the specific
           // neighbor
           dst = glm::distance(pos, m_predicted_positions[index]);
           influence = FlowFinity::smoothingKernel(radius, dst);
-          result += (m_velocities[index] - m_velocities[posIndex]) * influence;
+          result += (m_tempVelocities[index] - m_tempVelocities[posIndex]) *
+                    influence;
           break;
         case 4:
           // Code for case 4
@@ -260,10 +858,261 @@ glm::vec3 Editor::forEachPointInRadius(glm::vec3 pos, float radius, int caseNum,
   return result;
 }
 
+// Call fn(particle, offset, dst) for every particle within radius of a
+// position, offset points from the position to the particle. The spatial hash
+// has to be built with the same radius
+template <typename F>
+void Editor::forEachParticleNear(glm::vec3 pos, float radius, const F &fn) {
+  glm::vec2 cell = positionToCell(pos, radius);
+  float sqrRadius = radius * radius;
+  for (glm::vec2 cellOffset : cellOffsets) {
+    unsigned int key = getKeyFromHash(hashCell(cell + cellOffset));
+    for (int i = m_startIndices[key]; i < m_hashCount; i++) {
+      if ((unsigned int)m_spatialHash[i].first != key) {
+        break;
+      }
+      int particle = m_spatialHash[i].second;
+      glm::vec3 offset = m_positions[particle] - pos;
+      float sqrDst = glm::dot(offset, offset);
+      if (sqrDst < sqrRadius) {
+        fn(particle, offset, std::sqrt(sqrDst));
+      }
+    }
+  }
+}
+
+// Call fn(particle, offset, dst) for every particle within radius of a
+// position, offset points from the position to the particle. Any radius works
+// on the spatial hash of the last build, as many of its cells are walked as
+// the radius covers. Cells that share a key are walked once, so every particle
+// is visited once
+template <typename F>
+void Editor::forEachParticleInRange(glm::vec3 pos, float radius, const F &fn) {
+  if (!m_hashPositions) {
+    return;
+  }
+  const ParticleArray<glm::vec3> &positions = *m_hashPositions;
+  float sqrRadius = radius * radius;
+  auto visit = [&](int particle) {
+    glm::vec3 offset = positions[particle] - pos;
+    float sqrDst = glm::dot(offset, offset);
+    if (sqrDst < sqrRadius) {
+      fn(particle, offset, std::sqrt(sqrDst));
+    }
+  };
+
+  glm::vec2 low = positionToCell(pos - glm::vec3(radius, radius, 0),
+                                 m_hashCellSize);
+  glm::vec2 high = positionToCell(pos + glm::vec3(radius, radius, 0),
+                                  m_hashCellSize);
+  glm::vec2 cells = high - low + glm::vec2(1);
+  // Ranges over more cells than fit are cheaper to check particle by particle
+  unsigned int keys[MAX_RANGE_CELLS];
+  if (cells.x * cells.y > MAX_RANGE_CELLS) {
+    for (int i = 0; i < m_pool.highWater(); i++) {
+      if (m_pool.isAlive(i)) {
+        visit(i);
+      }
+    }
+    return;
+  }
+  int numKeys = 0;
+  for (float x = low.x; x <= high.x; x++) {
+    for (float y = low.y; y <= high.y; y++) {
+      keys[numKeys++] = getKeyFromHash(hashCell(glm::vec2(x, y)));
+    }
+  }
+  std::sort(keys, keys + numKeys);
+  numKeys = (int)(std::unique(keys, keys + numKeys) - keys);
+  for (int k = 0; k < numKeys; k++) {
+    for (int i = m_startIndices[keys[k]]; i < m_hashCount; i++) {
+      if ((unsigned int)m_spatialHash[i].first != keys[k]) {
+        break;
+      }
+      visit(m_spatialHash[i].second);
+    }
+  }
+}
+
+// Density of a particle with a full neighborhood on the initial particle grid
+float Editor::gridDensity() {
+  const float h = m_densityRadius;
+  float spacing = m_particleSpacing + m_particleSize * 2;
+  int extent = spacing > 0 ? (int)std::ceil(h / spacing) : 0;
+  float density = 0;
+  for (int x = -extent; x <= extent; x++) {
+    for (int y = -extent; y <= extent; y++) {
+      density += FlowFinity::smoothingKernel(
+          h, glm::length(glm::vec2(x, y)) * spacing);
+    }
+  }
+  return density;
+}
+
+// Put the rigid bodies back at their starting positions
+void Editor::resetBodies() {
+  // Particles have a mass of 1 and start one spacing apart
+  float spacing = std::max(m_particleSpacing + m_particleSize * 2, 1e-3f);
+  float fluidDensity = 1 / (spacing * spacing);
+  float restDensity = gridDensity();
+  m_bodies.clear();
+  for (const DynamicBody &config : m_bodyConfigs) {
+    m_bodies.emplace_back(config.shape, config.density * fluidDensity);
+    m_bodies.back().sampleBoundary(spacing / 2, m_densityRadius, restDensity);
+  }
+}
+
+// Two way coupling with the rigid bodies. The boundary samples of a body look
+// up the particles around them in the spatial hash, so the cost grows with
+// the particles near the bodies only. The samples add to the density of those
+// particles and push them away with the pressure that density gives them, the
+// opposite forces move the body. Particles that still end up inside a body
+// trade an impulse with it.
+void Editor::coupleRigidBodies(int num, float dt) {
+  if (m_bodies.empty()) {
+    return;
+  }
+  const float h = m_densityRadius;
+  const float radius = m_particleSize / 2.f;
+
+  // Density the boundary samples add to every particle near them
+  m_coupledParticles.clear();
+  for (const RigidBody &body : m_bodies) {
+    for (size_t s = 0; s < body.samples().size(); s++) {
+      glm::vec3 sample(body.toWorld(body.samples()[s]), 0);
+      float volume = body.sampleVolumes()[s];
+      forEachParticleNear(sample, h, [&](int i, glm::vec3, float dst) {
+        if (i >= num || !m_awake[i]) {
+          return;
+        }
+        if (m_boundaryDensities[i] < 0) {
+          m_boundaryDensities[i] = 0;
+          m_coupledParticles.push_back(i);
+        }
+        m_boundaryDensities[i] +=
+            volume * FlowFinity::smoothingKernel(h, dst);
+      });
+    }
+  }
+
+  // Pressure forces between the samples and the particles
+  for (RigidBody &body : m_bodies) {
+    for (size_t s = 0; s < body.samples().size(); s++) {
+      glm::vec3 sample(body.toWorld(body.samples()[s]), 0);
+      float volume = body.sampleVolumes()[s];
+      forEachParticleNear(sample, h, [&](int i, glm::vec3 offset, float dst) {
+        if (i >= num || !m_awake[i]) {
+          return;
+        }
+        float density =
+            std::max(m_densities[i] + m_boundaryDensities[i], 1e-6f);
+        float pressure = std::max(
+            m_pressureMultiplier * (density - m_restDensities[0]), 0.f);
+        glm::vec3 force = -volume * pressure / (density * density) *
+                          FlowFinity::smoothingKernelGradient(h, offset, dst);
+        m_velocities[i] += force / m_phaseMasses[m_phases[i]] * dt;
+        body.applyForce(glm::vec2(sample), -glm::vec2(force));
+      });
+    }
+  }
+
+  // Particles inside a body are pushed out and bounce off it, the body gets
+  // the opposite impulse
+  const float restitution = 1 - m_particleDamping;
+  for (int i : m_coupledParticles) {
+    m_boundaryDensities[i] = -1;
+    for (RigidBody &body : m_bodies) {
+      glm::vec2 pos(m_positions[i]);
+      glm::vec2 normal;
+      float distance = body.signedDistance(pos, normal);
+      if (distance >= radius) {
+        continue;
+      }
+      m_positions[i] += glm::vec3(normal, 0) * (radius - distance);
+      pos = glm::vec2(m_positions[i]);
+      float normalVelocity =
+          glm::dot(glm::vec2(m_velocities[i]) - body.velocityAt(pos), normal);
+      if (normalVelocity >= 0) {
+        continue;
+      }
+      float mass = m_phaseMasses[m_phases[i]];
+      float impulse = -(1 + restitution) * normalVelocity /
+                      (1 / mass + 1 / body.effectiveMass(pos, normal));
+      m_velocities[i] += glm::vec3(normal, 0) * impulse / mass;
+      body.applyImpulse(pos, -normal * impulse);
+    }
+  }
+
+  for (RigidBody &body : m_bodies) {
+    body.integrate(dt, m_gravity);
+    body.collideWithBounds(m_bounds, restitution);
+    if (m_sleeping) {
+      // Fluid around a body has to follow it
+      m_activityTracker.wakeRadius(body.position(), body.boundingRadius() + h);
+    }
+  }
+}
+
 // Resolve Collisions with the bounds and obstacles
-void Editor::resolveCollisions() {
-  glm::vec2 bounds = m_bounds - glm::vec2(m_particleSize / 2.f);
-  for (int i = 0; i < m_numInstances; i++) {
+void Editor::collideWithSegments(int index, float radius, float dt) {
+  glm::vec3 &pos = m_positions[index];
+  glm::vec3 &vel = m_velocities[index];
+  auto reflect = [&](glm::vec2 normal) {
+    glm::vec3 n(normal, 0);
+    float normalVelocity = glm::dot(vel, n);
+    if (normalVelocity < 0) {
+      vel -= (2 - m_particleDamping) * normalVelocity * n;
+    }
+  };
+
+  // Stop fast particles at the first segment they crossed during the step
+  glm::vec2 end(pos);
+  glm::vec2 start = end - glm::vec2(vel) * dt;
+  float t;
+  glm::vec2 normal;
+  if (m_segmentBvh.raycast(start, end, t, normal)) {
+    glm::vec2 hit = start + (end - start) * t + normal * 1e-4f;
+    pos = glm::vec3(hit, pos.z);
+    reflect(normal);
+  }
+
+  // Push the particle out of the segments it still overlaps, the closest first
+  for (int pass = 0; pass < MAX_SEGMENT_PASSES; pass++) {
+    float distance = m_segmentBvh.closest(glm::vec2(pos), radius, normal);
+    if (distance >= radius) {
+      break;
+    }
+    pos += glm::vec3(normal, 0) * (radius - distance);
+    reflect(normal);
+  }
+}
+
+void Editor::resolveCollisions(float dt) {
+  float radius = m_particleSize / 2.f;
+  glm::vec2 bounds = m_bounds - glm::vec2(radius);
+  bool obstacles = !m_sdfGrid.empty();
+  bool segments = !m_segmentBvh.empty();
+  // Every particle only moves itself, obstacles and walls are read only
+  m_threadPool.parallelFor(0, m_pool.highWater(), [&](int i) {
+    if (!m_pool.isAlive(i)) {
+      return;
+    }
+    if (segments) {
+      collideWithSegments(i, radius, dt);
+    }
+    // Push particles overlapping an obstacle out along the distance gradient
+    // and reflect the velocity into it like at the walls
+    glm::vec2 gradient;
+    float distance =
+        obstacles ? m_sdfGrid.sample(glm::vec2(m_positions[i]), gradient) : 0;
+    if (obstacles && distance < radius && glm::length(gradient) > 0) {
+      glm::vec3 normal(glm::normalize(gradient), 0);
+      m_positions[i] += normal * (radius - distance);
+      float normalVelocity = glm::dot(m_velocities[i], normal);
+      if (normalVelocity < 0) {
+        m_velocities[i] -= (2 - m_particleDamping) * normalVelocity * normal;
+      }
+    }
     if (m_positions[i].x < -bounds.x) {
       m_positions[i].x = -bounds.x;
       m_velocities[i].x *= -(1 - m_particleDamping);
@@ -278,14 +1127,15 @@ void Editor::resolveCollisions() {
       m_positions[i].y = bounds.y;
       m_velocities[i].y *= -(1 - m_particleDamping);
     }
-  }
+  });
 }
 
 // Calculate the interaction force between a particle and the input point
 // (usually the mouse)
-glm::vec2 Editor::interactionForce(int index, float radius, float strength) {
+glm::vec2 Editor::interactionForce(int index, const InputPoint &input,
+                                   float radius, float strength) {
   glm::vec2 interactionForce = glm::vec2(0);
-  glm::vec2 offset = m_testClickPoint * 2.f - glm::vec2(m_positions[index]);
+  glm::vec2 offset = input.position * 2.f - glm::vec2(m_positions[index]);
   float sqrDst = glm::dot(offset, offset);
 
   // If a particle is inside of input radius, calculate force towards input
@@ -297,7 +1147,7 @@ glm::vec2 Editor::interactionForce(int index, float radius, float strength) {
     // Value is 1 when particle is exactly at the input point, 0 at the edge
     float t = 1 - dst / radius;
     // Calculate interaction force
-    interactionForce += (dir * (float)m_clickStrength * strength -
+    interactionForce += (dir * input.strength * strength -
                          glm::vec2(m_velocities[index])) *
                         t;
   }
@@ -305,105 +1155,777 @@ glm::vec2 Editor::interactionForce(int index, float radius, float strength) {
 }
 
 // Check for interactions (clicks) and apply forces to the particles
-void Editor::checkInterations() {
-  // If there is a click, apply a force to the particles
+// The mouse and every finger on a touch screen act on the fluid together
+void Editor::gatherInputPoints() {
+  m_inputPoints.clear();
   if (m_clickStrength != 0) {
-    // Figure out the neighbors of the click point
-    updateSpatialHash(m_inputRadius);
-    glm::vec3 force = forEachPointInRadius(glm::vec3(m_testClickPoint * 2.f, 0),
-                                           m_inputRadius, 2);
-    // For each particle in the clickPoint's radius, apply a force
-    // for (int i = 0; i < m_numInstances; i++) {
-    //   glm::vec2 force =
-    //       interactionForce(i, m_inputRadius, m_inputStrengthMultiplier);
-    //   m_velocities[i] += glm::vec3(force, 0) * (1 / 12.f);
-    //   m_maxVelocity = std::max(m_maxVelocity, glm::length(m_velocities[i]));
-    // }
+    m_inputPoints.push_back(
+        InputPoint{m_testClickPoint, (float)m_clickStrength});
+  }
+  for (const auto &touch : m_touches) {
+    m_inputPoints.push_back(InputPoint{touch.second, 1});
   }
 }
 
+void Editor::checkInterations(int num) {
+  if (m_inputPoints.empty()) {
+    return;
+  }
+  // Only the particles near an input point get a force, found on the grid the
+  // solver built this step. A range visits every particle once, so the forces
+  // of one point can be added in parallel, the points go one after another
+  for (const InputPoint &input : m_inputPoints) {
+    m_inputParticles.clear();
+    forEachParticleInRange(glm::vec3(input.position * 2.f, 0), m_inputRadius,
+                           [&](int i, glm::vec3, float) {
+                             if (i < num && m_awake[i]) {
+                               m_inputParticles.push_back(i);
+                             }
+                           });
+    m_threadPool.parallelFor(0, (int)m_inputParticles.size(), [&](int p) {
+      int i = m_inputParticles[p];
+      m_inputForces[i] += glm::vec3(
+          interactionForce(i, input, m_inputRadius, m_inputStrengthMultiplier),
+          0);
+    });
+  }
+  // Apply the forces once and find the fastest particle in the same pass
+  float maxVelocity = maxOverParticles(num, [&](int i) {
+    m_velocities[i] += m_inputForces[i] * (1 / 12.f);
+    m_inputForces[i] = glm::vec3(0);
+    return glm::length(m_velocities[i]);
+  });
+  m_maxVelocity = std::max(m_maxVelocity, maxVelocity);
+}
+
 // Using Leapfrog Integration to calculate the predicted positions and
 // velocities
-void Editor::calculateOffsets(int num, float dt) {
+template <bool MultiPhase> void Editor::leapfrogStep(int num, float dt) {
   m_flowFinity.setDensities(&m_densities);
+  m_flowFinity.setNearDensities(&m_nearDensities);
   m_flowFinity.setPositions(&m_predicted_positions);
   // Apply gravity and calculate Densities
-  for (int i = 0; i < num; i++) {
+  m_threadPool.parallelFor(0, num, [&](int i) {
+    if (!m_awake[i]) {
+      return;
+    }
     // Leapfrog Step 1: Calculate half step velocity
     glm::vec3 halfStepVelocity =
         m_velocities[i] + glm::vec3(0, m_gravity, 0) * 0.5f * dt;
     m_predicted_positions[i] = m_positions[i] + halfStepVelocity * (1 / 120.f);
-  }
+  });
 
   // Update the spatial hash
   updateSpatialHash(m_densityRadius);
 
   // Update Density Map for efficiency
-  for (int i = 0; i < num; i++) {
-    m_densities[i] =
-        forEachPointInRadius(m_predicted_positions[i], m_densityRadius, 0)[0];
-  }
+  float maxDensity = maxOverParticles(num, [&](int i) {
+    if (!m_awake[i]) {
+      return 0.f;
+    }
+    glm::vec3 densities =
+        forEachPointInRadius(m_predicted_positions[i], m_densityRadius, 0);
+    m_densities[i] = densities[0];
+    m_nearDensities[i] = densities[1];
+    return m_densities[i];
+  });
+  m_maxDensity = std::max(m_maxDensity, maxDensity);
+
+  // Viscosity reads the velocities from before the step, the new ones are
+  // written while other threads still read their neighbors
+  m_threadPool.parallelFor(
+      0, num, [&](int i) { m_tempVelocities[i] = m_velocities[i]; });
 
   // Calculate and apply forces (Pressure and Viscosity)
-  for (int i = 0; i < num; i++) {
+  float maxAcceleration = maxOverParticles(num, [&](int i) {
+    if (!m_awake[i]) {
+      return 0.f;
+    }
     // Calculate Pressure Force
     glm::vec3 force =
         forEachPointInRadius(m_predicted_positions[i], m_densityRadius, 1, i);
-    glm::vec3 acceleration = force / m_densities[i];
+    glm::vec3 acceleration =
+        force / (m_densities[i] * phaseMass<MultiPhase>(i));
 
     // Leapfrog Step 2: Calculate full step velocity
     m_velocities[i] = m_velocities[i] + acceleration * dt +
                       (glm::vec3(0, m_gravity, 0) * 0.5f * dt);
-    // Update the max velocity
     // Calculate Viscosity Force
     glm::vec3 viscoscity =
         forEachPointInRadius(m_predicted_positions[i], m_densityRadius, 3, i) *
-        m_viscosityStrength;
+        phaseViscosity<MultiPhase>(i);
     if (glm::length(viscoscity) != 0.0) {
       m_velocities[i] += viscoscity * dt;
     }
-    m_maxVelocity = std::max(m_maxVelocity, glm::length(m_velocities[i]));
+    return glm::length(acceleration + glm::vec3(0, m_gravity, 0));
+  });
+  m_maxAcceleration = std::max(m_maxAcceleration, maxAcceleration);
+
+  // Update the max velocity
+  float maxVelocity = maxOverParticles(num, [&](int i) {
+    return m_awake[i] ? glm::length(m_velocities[i]) : 0.f;
+  });
+  m_maxVelocity = std::max(m_maxVelocity, maxVelocity);
+}
+
+// Call fn(neighbor, offset, dst) for every particle within radius of the
+// particle at index, offset points from the neighbor to the particle. With
+// walls the mirror images of the neighbors behind the walls close to the
+// particle are visited too, so particles at a wall are as dense as inside the
+// fluid and get pushed away from it. The spatial hash has to be built with the
+// same radius
+template <typename F>
+void Editor::forEachNeighbor(int index,
+                             const ParticleArray<glm::vec3> &positions,
+                             float radius, const F &fn, bool walls) {
+  glm::vec3 pos = positions[index];
+  glm::vec2 cell = positionToCell(pos, radius);
+  float sqrRadius = radius * radius;
+  for (glm::vec2 cellOffset : cellOffsets) {
+    unsigned int key = getKeyFromHash(hashCell(cell + cellOffset));
+    for (int i = m_startIndices[key]; i < m_hashCount; i++) {
+      if ((unsigned int)m_spatialHash[i].first != key) {
+        break;
+      }
+      int neighbor = m_spatialHash[i].second;
+      glm::vec3 offset = pos - positions[neighbor];
+      float sqrDst = glm::dot(offset, offset);
+      if (sqrDst >= sqrRadius) {
+        continue;
+      }
+      fn(neighbor, offset, std::sqrt(sqrDst));
+      if (!walls) {
+        continue;
+      }
+      // A mirror image is never closer than the neighbor itself, so only
+      // neighbors can have images in range
+      for (int axis = 0; axis < 2; axis++) {
+        float wall = pos[axis] < 0 ? -m_bounds[axis] : m_bounds[axis];
+        if (std::abs(wall - pos[axis]) >= radius) {
+          continue;
+        }
+        glm::vec3 image = positions[neighbor];
+        image[axis] = 2 * wall - image[axis];
+        glm::vec3 imageOffset = pos - image;
+        float imageSqrDst = glm::dot(imageOffset, imageOffset);
+        if (imageSqrDst < sqrRadius) {
+          fn(neighbor, imageOffset, std::sqrt(imageSqrDst));
+        }
+      }
+    }
+  }
+}
+
+// Sum fn(i) over the live particles on the thread pool
+template <typename F> float Editor::sumOverParticles(int num, const F &fn) {
+  std::fill(m_threadSums.begin(), m_threadSums.end(), 0.f);
+  m_threadPool.parallelForChunks(0, num, [&](int begin, int end, int thread) {
+    float sum = 0;
+    for (int i = begin; i < end; i++) {
+      if (m_pool.isAlive(i)) {
+        sum += fn(i);
+      }
+    }
+    m_threadSums[thread] += sum;
+  });
+  float total = 0;
+  for (float sum : m_threadSums) {
+    total += sum;
+  }
+  return total;
+}
+
+// Largest fn(i) over the live particles on the thread pool, 0 without any
+template <typename F> float Editor::maxOverParticles(int num, const F &fn) {
+  std::fill(m_threadSums.begin(), m_threadSums.end(), 0.f);
+  m_threadPool.parallelForChunks(0, num, [&](int begin, int end, int thread) {
+    float max = 0;
+    for (int i = begin; i < end; i++) {
+      if (m_pool.isAlive(i)) {
+        max = std::max(max, fn(i));
+      }
+    }
+    m_threadSums[thread] = std::max(m_threadSums[thread], max);
+  });
+  return *std::max_element(m_threadSums.begin(), m_threadSums.end());
+}
+
+// Apply gravity and viscosity to the velocities, the velocities from before
+// are kept in m_tempVelocities
+template <bool MultiPhase>
+void Editor::applyNonPressureForces(int num, float dt) {
+  const float h = m_densityRadius;
+  m_threadPool.parallelFor(0, num, [&](int i) {
+    if (!m_awake[i]) {
+      m_tempVelocities[i] = m_velocities[i];
+      return;
+    }
+    glm::vec3 viscosity(0);
+    forEachNeighbor(i, m_positions, h, [&](int j, glm::vec3, float dst) {
+      viscosity += (m_velocities[j] - m_velocities[i]) *
+                   FlowFinity::smoothingKernel(h, dst);
+    });
+    m_tempVelocities[i] =
+        m_velocities[i] + (glm::vec3(0, m_gravity, 0) +
+                           viscosity * phaseViscosity<MultiPhase>(i)) *
+                              dt;
+  });
+  std::swap(m_velocities, m_tempVelocities);
+}
+
+// Acceleration every particle gets from the PCISPH pressures. Like in the
+// original method it is taken at the current positions, only the densities
+// are predicted
+template <bool MultiPhase> void Editor::computePressureAccelerations(int num) {
+  const float h = m_densityRadius;
+  const float invSqrRestDensity =
+      1 / (m_restDensities[0] * m_restDensities[0]);
+  m_threadPool.parallelFor(0, num, [&](int i) {
+    glm::vec3 acceleration(0);
+    if (m_awake[i]) {
+      float pressure = m_pressures[i] * invSqrRestDensity;
+      forEachNeighbor(
+          i, m_positions, h,
+          [&](int j, glm::vec3 offset, float dst) {
+            acceleration -= (pressure + m_pressures[j] * invSqrRestDensity) *
+                            FlowFinity::smoothingKernelGradient(h, offset, dst);
+          },
+          true);
+    }
+    m_pressureAccelerations[i] = acceleration / phaseMass<MultiPhase>(i);
+  });
+}
+
+// Factor turning a density error into the pressure that corrects it, for
+// every particle. The factor of a particle with a full neighborhood on the
+// initial particle grid is the largest one used, particles with more
+// neighbors react more strongly to their pressure and get their own smaller
+// factor so the iteration doesn't overshoot
+template <bool MultiPhase> void Editor::pcisphScaling(int num, float dt) {
+  const float h = m_densityRadius;
+  const float beta = 2 * dt * dt / (m_restDensities[0] * m_restDensities[0]);
+  float spacing = m_particleSpacing + m_particleSize * 2;
+  int extent = spacing > 0 ? (int)std::ceil(h / spacing) : 0;
+  glm::vec3 gridGradientSum(0);
+  float gridGradientSqrSum = 0;
+  for (int x = -extent; x <= extent; x++) {
+    for (int y = -extent; y <= extent; y++) {
+      glm::vec3 offset(x * spacing, y * spacing, 0);
+      float dst = glm::length(offset);
+      if (dst >= h) {
+        continue;
+      }
+      glm::vec3 gradient = FlowFinity::smoothingKernelGradient(h, offset, dst);
+      gridGradientSum += gradient;
+      gridGradientSqrSum += glm::dot(gradient, gradient);
+    }
+  }
+  float gridDenominator =
+      beta * (glm::dot(gridGradientSum, gridGradientSum) + gridGradientSqrSum);
+
+  m_threadPool.parallelFor(0, num, [&](int i) {
+    if (!m_awake[i]) {
+      return;
+    }
+    glm::vec3 gradientSum(0);
+    float gradientSqrSum = 0;
+    forEachNeighbor(
+        i, m_positions, h,
+        [&](int, glm::vec3 offset, float dst) {
+          glm::vec3 gradient =
+              FlowFinity::smoothingKernelGradient(h, offset, dst);
+          gradientSum += gradient;
+          gradientSqrSum += glm::dot(gradient, gradient);
+        },
+        true);
+    float denominator = std::max(
+        gridDenominator,
+        beta * (glm::dot(gradientSum, gradientSum) + gradientSqrSum));
+    // A heavier particle needs a larger pressure for the same push
+    m_alphas[i] = denominator > 0 ? phaseMass<MultiPhase>(i) / denominator : 0;
+  });
+}
+
+// Predictive-corrective step: pressures are corrected until the positions
+// they lead to are within the tolerance of the target density
+template <bool MultiPhase> void Editor::pcisphStep(int num, float dt) {
+  const float h = m_densityRadius;
+  // Every phase is at rest at the same number of particles per area
+  const float restDensity = m_restDensities[0];
+  const float live = (float)std::max(1, m_pool.liveCount());
+  glm::vec2 bounds = m_bounds - glm::vec2(m_particleSize / 2.f);
+  updateSpatialHash(h);
+  applyNonPressureForces<MultiPhase>(num, dt);
+
+  if (!m_warmStart) {
+    std::fill(m_pressures.begin(), m_pressures.end(), 0.f);
+  }
+  pcisphScaling<MultiPhase>(num, dt);
+  computePressureAccelerations<MultiPhase>(num);
+
+  m_solverIterations = 0;
+  while (m_solverIterations < m_solverMaxIterations) {
+    // Predict where the particles end up with the current pressures, the
+    // walls stop them. Free slots have no velocity and stay parked
+    m_threadPool.parallelFor(0, num, [&](int i) {
+      glm::vec3 pos = m_positions[i] +
+                      (m_velocities[i] + m_pressureAccelerations[i] * dt) * dt;
+      if (m_pool.isAlive(i)) {
+        pos.x = std::clamp(pos.x, -bounds.x, bounds.x);
+        pos.y = std::clamp(pos.y, -bounds.y, bounds.y);
+      }
+      m_predicted_positions[i] = pos;
+    });
+    // Correct every pressure by the density error at its predicted position,
+    // sleeping particles keep theirs
+    float errorSum = sumOverParticles(num, [&](int i) {
+      if (!m_awake[i]) {
+        return 0.f;
+      }
+      float density = 0;
+      forEachNeighbor(
+          i, m_predicted_positions, h,
+          [&](int, glm::vec3, float dst) {
+            density += FlowFinity::smoothingKernel(h, dst);
+          },
+          true);
+      m_densities[i] = density;
+      float densityError = density - restDensity;
+      m_pressures[i] =
+          std::max(m_pressures[i] + m_alphas[i] * densityError, 0.f);
+      // Particles at the surface are allowed to be less dense
+      return std::max(densityError, 0.f);
+    });
+    computePressureAccelerations<MultiPhase>(num);
+
+    m_solverIterations++;
+    m_solverError = errorSum / (live * restDensity);
+    if (m_solverIterations >= MIN_SOLVER_ITERATIONS &&
+        m_solverError < m_solverTolerance) {
+      break;
+    }
+  }
+
+  m_threadPool.parallelFor(0, num, [&](int i) {
+    if (m_awake[i]) {
+      m_velocities[i] += m_pressureAccelerations[i] * dt;
+    }
+  });
+  trackSolverExtremes(num, dt);
+}
+
+// One DFSPH pressure solve. The divergence solve removes the rate the density
+// changes at, the density solve removes the density error the velocities
+// would cause. Returns the number of iterations taken
+template <bool MultiPhase>
+int Editor::dfsphSolve(int num, float dt, bool divergence) {
+  const float h = m_densityRadius;
+  const float restDensity = m_restDensities[0];
+  const float live = (float)std::max(1, m_pool.liveCount());
+  ParticleArray<float> &stored =
+      divergence ? m_divergencePressures : m_pressures;
+
+  // Push the particles apart by the stiffness of every particle
+  auto applyStiffness = [&](const ParticleArray<float> &stiffness) {
+    m_threadPool.parallelFor(0, num, [&](int i) {
+      if (!m_awake[i]) {
+        return;
+      }
+      float ownStiffness = stiffness[i] / m_densities[i];
+      glm::vec3 change(0);
+      forEachNeighbor(
+          i, m_positions, h,
+          [&](int j, glm::vec3 offset, float dst) {
+            change -= (ownStiffness + stiffness[j] / m_densities[j]) *
+                      FlowFinity::smoothingKernelGradient(h, offset, dst);
+          },
+          true);
+      m_velocities[i] += change / phaseMass<MultiPhase>(i) * dt;
+    });
+  };
+
+  // Density error of a particle with the current velocities
+  auto densityError = [&](int i) {
+    // Sparse particles at the surface have too few neighbors for a stable
+    // divergence correction
+    if (divergence && m_densities[i] < restDensity) {
+      return 0.f;
+    }
+    float densityChange = 0;
+    forEachNeighbor(
+        i, m_positions, h,
+        [&](int j, glm::vec3 offset, float dst) {
+          densityChange +=
+              glm::dot(m_velocities[i] - m_velocities[j],
+                       FlowFinity::smoothingKernelGradient(h, offset, dst));
+        },
+        true);
+    float error = divergence
+                      ? densityChange
+                      : m_densities[i] + densityChange * dt - restDensity;
+    // Only compression is corrected, particles at the surface are allowed to
+    // be less dense
+    return std::max(error, 0.f);
+  };
+
+  if (m_warmStart) {
+    // Only particles that are still compressed start from their last
+    // stiffness, pushing particles apart that already separate adds energy.
+    // The solve only ever adds stiffness, so half of the last total is used to
+    // let it shrink again when the fluid calms down
+    m_threadPool.parallelFor(0, num, [&](int i) {
+      if (m_awake[i]) {
+        stored[i] = densityError(i) > 0 ? stored[i] * 0.5f : 0;
+      }
+    });
+    applyStiffness(stored);
+  } else {
+    std::fill(stored.begin(), stored.end(), 0.f);
+  }
+
+  int iterations = 0;
+  float error = 0;
+  while (iterations < m_solverMaxIterations) {
+    float errorSum = sumOverParticles(num, [&](int i) {
+      // Sleeping particles don't push, they only hold their neighbors up
+      if (!m_awake[i]) {
+        m_stiffness[i] = 0;
+        return 0.f;
+      }
+      float particleError = densityError(i);
+      m_stiffness[i] =
+          particleError * m_alphas[i] / (divergence ? dt : dt * dt);
+      stored[i] += m_stiffness[i];
+      return particleError;
+    });
+    applyStiffness(m_stiffness);
+
+    iterations++;
+    error = errorSum / (live * restDensity) * (divergence ? dt : 1);
+    if (iterations >= MIN_SOLVER_ITERATIONS && error < m_solverTolerance) {
+      break;
+    }
+  }
+  if (!divergence) {
+    m_solverError = error;
+  }
+  return iterations;
+}
+
+// Divergence-free step: the velocity field is made divergence free at the
+// current positions, then the density error of the next positions is solved
+template <bool MultiPhase> void Editor::dfsphStep(int num, float dt) {
+  const float h = m_densityRadius;
+  updateSpatialHash(h);
+
+  // Densities and the factor relating stiffness to density change
+  m_threadPool.parallelFor(0, num, [&](int i) {
+    if (!m_awake[i]) {
+      return;
+    }
+    float density = 0;
+    glm::vec3 gradientSum(0);
+    float gradientSqrSum = 0;
+    forEachNeighbor(
+        i, m_positions, h,
+        [&](int, glm::vec3 offset, float dst) {
+          density += FlowFinity::smoothingKernel(h, dst);
+          glm::vec3 gradient =
+              FlowFinity::smoothingKernelGradient(h, offset, dst);
+          gradientSum += gradient;
+          gradientSqrSum += glm::dot(gradient, gradient);
+        },
+        true);
+    m_densities[i] = density;
+    float denominator = glm::dot(gradientSum, gradientSum) + gradientSqrSum;
+    m_alphas[i] = denominator > 1e-6f
+                      ? density * phaseMass<MultiPhase>(i) / denominator
+                      : 0;
+  });
+
+  dfsphSolve<MultiPhase>(num, dt, true);
+  applyNonPressureForces<MultiPhase>(num, dt);
+  m_solverIterations = dfsphSolve<MultiPhase>(num, dt, false);
+
+  trackSolverExtremes(num, dt);
+}
+
+// Position based step: the predicted positions are moved onto the density
+// constraint directly. The velocities are set so that the integration in
+// calculateOffsets lands the particles on the corrected positions
+template <bool MultiPhase> void Editor::pbfStep(int num, float dt) {
+  // Velocities come from dividing the position change by the step
+  if (dt <= 0) {
+    return;
+  }
+  const float h = m_densityRadius;
+  const float invRestDensity = 1 / m_restDensities[0];
+  const float live = (float)std::max(1, m_pool.liveCount());
+  glm::vec2 bounds = m_bounds - glm::vec2(m_particleSize / 2.f);
+
+  // Predict the positions from gravity alone. Free slots have no velocity
+  // and stay parked, sleeping particles don't fall
+  m_threadPool.parallelFor(0, num, [&](int i) {
+    m_tempVelocities[i] = m_velocities[i];
+    glm::vec3 velocity = m_velocities[i];
+    if (m_awake[i]) {
+      velocity += glm::vec3(0, m_gravity, 0) * dt;
+    }
+    m_predicted_positions[i] = m_positions[i] + velocity * dt;
+  });
+  // Neighbors are found once at the predicted positions
+  updateSpatialHash(h, m_predicted_positions);
+
+  for (m_solverIterations = 0; m_solverIterations < m_pbfIterations;
+       m_solverIterations++) {
+    // Lambda of every particle's density constraint, sleeping particles don't
+    // move their neighbors
+    float errorSum = sumOverParticles(num, [&](int i) {
+      if (!m_awake[i]) {
+        m_stiffness[i] = 0;
+        return 0.f;
+      }
+      float density = 0;
+      glm::vec3 gradientSum(0);
+      float gradientSqrSum = 0;
+      forEachNeighbor(i, m_predicted_positions, h,
+                      [&](int, glm::vec3 offset, float dst) {
+                        density += FlowFinity::smoothingKernel(h, dst);
+                        glm::vec3 gradient =
+                            FlowFinity::smoothingKernelGradient(h, offset,
+                                                                dst) *
+                            invRestDensity;
+                        gradientSum += gradient;
+                        gradientSqrSum += glm::dot(gradient, gradient);
+                      });
+      m_densities[i] = density;
+      // Only compression is corrected, particles at the surface are allowed
+      // to be less dense
+      float constraint = std::max(density * invRestDensity - 1, 0.f);
+      m_stiffness[i] = -constraint * phaseMass<MultiPhase>(i) /
+                       (glm::dot(gradientSum, gradientSum) + gradientSqrSum +
+                        m_pbfRelaxation);
+      return constraint;
+    });
+    m_solverError = errorSum / live;
+
+    // Position change from the lambdas of the particle and its neighbors
+    m_threadPool.parallelFor(0, num, [&](int i) {
+      glm::vec3 correction(0);
+      if (m_awake[i]) {
+        forEachNeighbor(
+            i, m_predicted_positions, h,
+            [&](int j, glm::vec3 offset, float dst) {
+              correction += (m_stiffness[i] + m_stiffness[j]) *
+                            FlowFinity::smoothingKernelGradient(h, offset, dst);
+            });
+      }
+      // Heavier particles give way less
+      m_positionCorrections[i] =
+          correction * invRestDensity / phaseMass<MultiPhase>(i);
+    });
+    m_threadPool.parallelFor(0, num, [&](int i) {
+      if (!m_awake[i]) {
+        return;
+      }
+      glm::vec3 &pos = m_predicted_positions[i];
+      pos += m_positionCorrections[i];
+      pos.x = std::clamp(pos.x, -bounds.x, bounds.x);
+      pos.y = std::clamp(pos.y, -bounds.y, bounds.y);
+    });
+  }
+
+  // Velocities that move the particles to their corrected positions
+  m_threadPool.parallelFor(0, num, [&](int i) {
+    if (m_awake[i]) {
+      m_velocities[i] = (m_predicted_positions[i] - m_positions[i]) / dt;
+    }
+  });
+  // XSPH smoothing pulls every velocity towards that of its neighbors
+  if (m_xsphViscosity > 0) {
+    m_threadPool.parallelFor(0, num, [&](int i) {
+      glm::vec3 smoothing(0);
+      if (m_awake[i]) {
+        forEachNeighbor(i, m_predicted_positions, h,
+                        [&](int j, glm::vec3, float dst) {
+                          smoothing += (m_velocities[j] - m_velocities[i]) *
+                                       FlowFinity::smoothingKernel(h, dst);
+                        });
+      }
+      m_positionCorrections[i] = smoothing * m_xsphViscosity;
+    });
+    m_threadPool.parallelFor(0, num, [&](int i) {
+      m_velocities[i] += m_positionCorrections[i];
+    });
   }
 
-  // Check if the mouse is interacting with the particles
-  checkInterations();
+  trackSolverExtremes(num, dt);
+}
+
+// The solvers keep the velocities from before the step in m_tempVelocities
+void Editor::trackSolverExtremes(int num, float dt) {
+  float maxAcceleration = maxOverParticles(num, [&](int i) {
+    if (!m_awake[i]) {
+      return 0.f;
+    }
+    return glm::length(m_velocities[i] - m_tempVelocities[i]) / dt;
+  });
+  m_maxAcceleration = std::max(m_maxAcceleration, maxAcceleration);
+  float maxDensity = maxOverParticles(
+      num, [&](int i) { return m_awake[i] ? m_densities[i] : 0.f; });
+  m_maxDensity = std::max(m_maxDensity, maxDensity);
+}
+
+// Advance the particles by one step of the selected pressure solver
+void Editor::calculateOffsets(int num, float dt) {
+  // Extremes of this step, they limit the size of the next one
+  m_stepMaxVelocity = 0;
+  m_maxAcceleration = 0;
+  m_maxDensity = 0;
+  gatherInputPoints();
+  updateActivity(num);
+  // A single phase fluid runs the steps without any phase lookups
+  bool multiPhase = m_restDensities.size() > 1;
+  switch (m_solverMode) {
+  case SolverMode::PCISPH:
+    multiPhase ? pcisphStep<true>(num, dt) : pcisphStep<false>(num, dt);
+    break;
+  case SolverMode::DFSPH:
+    multiPhase ? dfsphStep<true>(num, dt) : dfsphStep<false>(num, dt);
+    break;
+  case SolverMode::PBF:
+    multiPhase ? pbfStep<true>(num, dt) : pbfStep<false>(num, dt);
+    break;
+  default:
+    multiPhase ? leapfrogStep<true>(num, dt) : leapfrogStep<false>(num, dt);
+    break;
+  }
+
+  // Exchange forces with the rigid bodies while the spatial hash still holds
+  // the density radius
+  coupleRigidBodies(num, dt);
+
+  // Check if the mouse or touches are interacting with the particles
+  checkInterations(num);
 
   // Update Positions with Euler Integration and resolve collisions
-  for (int i = 0; i < num; i++) {
+  m_stepMaxVelocity = maxOverParticles(num, [&](int i) {
+    if (!m_awake[i]) {
+      // Sleeping particles hold still, whatever the solver gave them
+      m_velocities[i] = glm::vec3(0);
+      return 0.f;
+    }
     m_positions[i] += m_velocities[i] * dt;
+    return glm::length(m_velocities[i]);
+  });
+  m_maxVelocity = std::max(m_maxVelocity, m_stepMaxVelocity);
+  resolveCollisions(dt);
+  reportActivity(num);
+
+  // Drain and refill the pool, nothing here allocates
+  drainParticles();
+  emitParticles(dt);
+  m_stepCount++;
+  if (m_stepCount % COMPACT_INTERVAL == 0) {
+    compactParticles();
+    if (m_threadPool.numNodes() > 1) {
+      sortParticles();
+      partitionParticles();
+    }
+  }
+  // The particles were integrated, compacted and sorted after the hash was
+  // built, so probes and neighbor queries can't use it as it is
+  m_hashStale = true;
+}
+
+// The ring search of the neighbor queries and the cells walked by the probes
+// rely on every particle being in the cell it was hashed into
+void Editor::refreshSpatialHash() {
+  if (m_hashStale && m_hashPositions) {
+    updateSpatialHash(m_hashCellSize, m_positions);
+  }
+}
+
+// Advance the simulation by the time the last frame took
+void Editor::advance(float frameDt) {
+  // The solvers divide by the step, a frame that took no time has nothing to
+  // simulate
+  if (frameDt <= 0) {
+    return;
   }
-  resolveCollisions();
+  if (!m_adaptiveTimestep) {
+    m_substeps = 1;
+    m_timestep = frameDt;
+    calculateOffsets(m_pool.highWater(), frameDt);
+    updateNodeThroughput();
+    return;
+  }
+
+  // Split the frame into steps the fluid can take stably, calm fluid gets by
+  // with one large step while violent fluid takes several small ones
+  float remaining = frameDt;
+  m_substeps = 0;
+  // The most viscous phase limits the step
+  float viscosity =
+      *std::max_element(m_viscosities.begin(), m_viscosities.end());
+  while (remaining > 0 &&
+         m_substeps < m_timestepController.getMaxSubsteps()) {
+    float stableDt = m_timestepController.computeDt(
+        m_densityRadius, m_stepMaxVelocity, m_maxAcceleration,
+        viscosity * m_maxDensity);
+    m_timestep = m_timestepController.nextSubstep(remaining, stableDt);
+    calculateOffsets(m_pool.highWater(), m_timestep);
+    remaining -= m_timestep;
+    m_substeps++;
+  }
+  updateNodeThroughput();
 }
 
 // Main OpenGL Rendering Loop
 void Editor::paint() {
+  m_frameTimer.beginFrame();
+
   // Set Camera Position and Matrices
   m_prog_instanced.setModelMatrix(glm::mat4(1.f));
-  m_prog_instanced.setViewProjMatrix(m_camera.getViewProj());
+  m_frameData.setViewProj(m_camera.getViewProj());
+  m_frameData.setCamPos(m_camera.eye);
 
   if (m_started) {
-    // Calculate Time
-    int deltaTime = (std::chrono::high_resolution_clock::now() - m_lastTime) /
-                    std::chrono::milliseconds(1);
-    m_elapsed_time += deltaTime;
-    m_lastTime = std::chrono::high_resolution_clock::now();
+    // Calculate Time, recordings advance the same time every frame
+    auto now = std::chrono::high_resolution_clock::now();
+    float frameDt = std::chrono::duration<float>(now - m_lastTime).count();
+    if (m_fixedFrameTime > 0) {
+      frameDt = m_fixedFrameTime;
+    }
+    m_elapsed_time += frameDt * 1000;
+    m_lastTime = now;
 
     // Set Instanced Rendering Variables and Velocites
-    calculateOffsets(m_numInstances, deltaTime / 1000.f);
-    m_prog_instanced.setMaxVelocity(m_maxVelocity);
-    m_prog_instanced.setTime(m_elapsed_time);
-    m_prog_instanced.setDeltaTime(deltaTime / 1000.f);
-    m_prog_instanced.setColors(m_colors);
+    m_frameTimer.begin("Simulation", false);
+    advance(frameDt);
+    m_frameTimer.end();
+    m_frameData.setTime((int)m_elapsed_time);
+    m_frameData.setDeltaTime(frameDt);
   } else if (!m_randomLocation) {
     // Only allow change of number of instances if random locations are off
-    m_prog_instanced.setNumInstances(m_numInstances);
+    m_prog_instanced.setNumInstances(m_pool.capacity());
   }
 
-  SDL_GL_GetDrawableSize(mp_window, &m_width, &m_height);
+  if (mp_window) {
+    SDL_GL_GetDrawableSize(mp_window, &m_width, &m_height);
+  }
   m_camera.width = m_width;
   m_camera.height = m_height;
   glViewport(0, 0, m_width, m_height);
 
+  // Everything the draws below read from the frame block, sent at most once
+  m_frameData.setMaxVelocity(m_maxVelocity);
+  m_frameData.setColors(m_colors);
+  m_frameData.setPhaseColors(m_phaseColors);
+  m_frameData.setRadius(m_particleSize);
+  m_frameData.setThreshold(m_surfaceThreshold);
+  m_frameData.upload();
+
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
   // Code to draw square plane
@@ -413,17 +1935,150 @@ void Editor::paint() {
 
   // m_prog_flat.draw(m_square);
 
-  // Draw the particles with instanced rendering and send the positions and
-  // velocities to the shader
-  m_prog_instanced.drawInstanced(m_circle, m_numInstances, m_positions,
-                                 m_velocities);
+  if (m_surfaceRendering) {
+    // Draw the fluid as the area where the density grid is above the
+    // threshold, at a cost that only depends on the pixels it covers
+    m_frameTimer.begin("Surface");
+    updateSurfaceTexture();
+    m_prog_surface.setModelMatrix(glm::scale(
+        glm::mat4(1.f), glm::vec3(m_surfaceExtent.x, m_surfaceExtent.y, 1)));
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m_surfaceTexture);
+    m_prog_surface.draw(m_square);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    m_frameTimer.end();
+  } else {
+    // Draw the particles with instanced rendering and send the positions and
+    // velocities to the shader
+    // Particles of the other phases are drawn in their phase's color
+    m_frameTimer.begin("Particles");
+    bool multiPhase = m_restDensities.size() > 1;
+    // A sprite is 4 vertices instead of the 40 of the circle mesh
+    Drawable &shape =
+        m_particleSprites ? static_cast<Drawable &>(m_square) : m_circle;
+    m_prog_instanced.drawInstanced(shape, m_pool.highWater(), m_positions,
+                                   m_velocities,
+                                   multiPhase ? &m_phases : nullptr);
+    m_frameTimer.end();
+  }
+
+  // Draw the outline of the fluid over either
+  if (m_surfaceOutline) {
+    m_frameTimer.begin("Outline");
+    updateSurfaceOutline();
+    m_prog_flat.setModelMatrix(glm::mat4(1.f));
+    m_prog_flat.draw(m_surfaceLines);
+    m_frameTimer.end();
+  }
 
   // Draw the input circle around the cursor
+  m_frameTimer.begin("Input Circles");
   m_prog_flat.setModelMatrix(glm::scale(
       glm::translate(glm::mat4(1.f), glm::vec3(m_testClickPoint * 2.19f, -1)),
       glm::vec3(m_inputRadius, m_inputRadius, 0)));
-  m_prog_flat.setViewProjMatrix(m_camera.getViewProj());
   m_prog_flat.draw(m_inputCircle);
+  // And around every finger on a touch screen
+  for (const auto &touch : m_touches) {
+    m_prog_flat.setModelMatrix(glm::scale(
+        glm::translate(glm::mat4(1.f), glm::vec3(touch.second * 2.19f, -1)),
+        glm::vec3(m_inputRadius, m_inputRadius, 0)));
+    m_prog_flat.draw(m_inputCircle);
+  }
+  m_frameTimer.end();
+
+  // Draw the obstacle outlines
+  m_frameTimer.begin("Obstacles");
+  if (!m_obstacles.empty()) {
+    m_prog_flat.setModelMatrix(glm::mat4(1.f));
+    m_prog_flat.draw(m_obstacleLines);
+  }
+
+  // Draw the rigid bodies where they are now
+  for (size_t i = 0; i < m_bodies.size() && i < m_bodyLines.size(); i++) {
+    glm::vec2 position = m_bodies[i].position();
+    m_prog_flat.setModelMatrix(glm::rotate(
+        glm::translate(glm::mat4(1.f), glm::vec3(position, 0)),
+        m_bodies[i].angle(), glm::vec3(0, 0, 1)));
+    m_prog_flat.draw(m_bodyLines[i]);
+  }
+  m_frameTimer.end();
+}
+
+// Probe the density and speed at the center of every grid cell and upload
+// them, the texture is only reallocated when the grid changes size
+void Editor::updateSurfaceTexture() {
+  glm::vec2 extent = m_bounds + glm::vec2(m_densityRadius);
+  int width = std::max(m_surfaceResolution, 2);
+  int height = std::max((int)std::round(width * extent.y / extent.x), 2);
+  if (width != m_surfaceWidth || height != m_surfaceHeight ||
+      extent != m_surfaceExtent) {
+    m_surfaceWidth = width;
+    m_surfaceHeight = height;
+    m_surfaceExtent = extent;
+    m_surfacePoints.resize(width * height);
+    m_surfaceDensities.resize(width * height);
+    m_surfaceVelocities.resize(width * height);
+    m_surfaceTexels.resize(width * height);
+    glm::vec2 cellSize = 2.f * extent / glm::vec2(width, height);
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < width; x++) {
+        m_surfacePoints[y * width + x] =
+            glm::vec3(-extent + (glm::vec2(x, y) + 0.5f) * cellSize, 0);
+      }
+    }
+    glBindTexture(GL_TEXTURE_2D, m_surfaceTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, width, height, 0, GL_RG,
+                 GL_FLOAT, nullptr);
+  }
+
+  // Before the start the particles are placed anew every frame
+  if (!m_started) {
+    updateSpatialHash(m_densityRadius);
+  }
+  probeFields(m_surfacePoints.data(), m_surfacePoints.size(),
+              m_surfaceDensities.data(), nullptr,
+              m_surfaceVelocities.data());
+  // Relative to the mean density, so the threshold means the same for any
+  // kernel radius and particle spacing
+  float density = meanDensity();
+  float invDensity = density > 0 ? 1 / density : 0;
+  m_threadPool.parallelFor(0, width * height, [&](int i) {
+    m_surfaceTexels[i] = glm::vec2(m_surfaceDensities[i] * invDensity,
+                                   glm::length(m_surfaceVelocities[i]));
+  });
+  glBindTexture(GL_TEXTURE_2D, m_surfaceTexture);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RG, GL_FLOAT,
+                  m_surfaceTexels.data());
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// March the density of the particles on a grid as fine as the surface
+// texture's, only redoing the tiles around particles that moved
+void Editor::updateSurfaceOutline() {
+  glm::vec2 extent = m_bounds + glm::vec2(m_densityRadius);
+  float cellSize = 2 * extent.x / std::max(m_surfaceResolution, 2);
+  m_surfaceExtractor.setGrid(-extent, extent, cellSize, m_densityRadius);
+  // A new threshold redoes every tile, so the mean density drifting a little
+  // every step is only followed once it moved noticeably
+  float density = m_surfaceThreshold * meanDensity();
+  if (std::abs(density - m_outlineDensity) > 0.02f * density) {
+    m_outlineDensity = density;
+  }
+  m_surfaceExtractor.setThreshold(m_outlineDensity);
+  if (m_surfaceExtractor.extract(m_positions.data(), m_pool.highWater(),
+                                 m_threadPool)) {
+    m_surfaceLines.setSegments(m_surfaceExtractor.segments());
+    m_surfaceLines.create();
+  }
+}
+
+// Mean density of the live particles, or the density on the initial grid
+// before they have one
+float Editor::meanDensity() {
+  float densitySum = sumOverParticles(m_pool.highWater(),
+                                      [&](int i) { return m_densities[i]; });
+  float density = densitySum / std::max(m_pool.liveCount(), 1);
+  return density > 0 ? density : gridDensity();
 }
 
 // Helper function to go from SDL event coordinates to world coordinates
@@ -440,6 +2095,10 @@ void Editor::processEvent(const SDL_Event &event) {
   // negative
   switch (event.type) {
   case SDL_MOUSEBUTTONDOWN:
+    // Touches act on their own, not through the mouse SDL makes of them
+    if (event.button.which == SDL_TOUCH_MOUSEID) {
+      break;
+    }
     m_testClickPoint =
         screenToWorld(event.button.x, event.button.y, m_width, m_height);
     if (event.button.button == SDL_BUTTON_LEFT) {
@@ -449,6 +2108,9 @@ void Editor::processEvent(const SDL_Event &event) {
     }
     break;
   case SDL_MOUSEMOTION:
+    if (event.motion.which == SDL_TOUCH_MOUSEID) {
+      break;
+    }
     m_testClickPoint =
         screenToWorld(event.button.x, event.button.y, m_width, m_height);
     if (event.motion.state & SDL_BUTTON_LMASK) {
@@ -458,6 +2120,9 @@ void Editor::processEvent(const SDL_Event &event) {
     }
     break;
   case SDL_MOUSEBUTTONUP:
+    if (event.button.which == SDL_TOUCH_MOUSEID) {
+      break;
+    }
     m_testClickPoint =
         screenToWorld(event.button.x, event.button.y, m_width, m_height);
     if (event.button.button == SDL_BUTTON_LEFT ||
@@ -465,6 +2130,27 @@ void Editor::processEvent(const SDL_Event &event) {
       m_clickStrength = 0;
     }
     break;
+  case SDL_FINGERDOWN:
+  case SDL_FINGERMOTION:
+  case SDL_FINGERUP: {
+    // Every finger pulls the fluid towards it while it touches the screen
+    auto touch = std::find_if(
+        m_touches.begin(), m_touches.end(),
+        [&](const auto &t) { return t.first == event.tfinger.fingerId; });
+    glm::vec2 point = screenToWorld((int)(event.tfinger.x * m_width),
+                                    (int)(event.tfinger.y * m_height),
+                                    m_width, m_height);
+    if (event.type == SDL_FINGERUP) {
+      if (touch != m_touches.end()) {
+        m_touches.erase(touch);
+      }
+    } else if (touch != m_touches.end()) {
+      touch->second = point;
+    } else {
+      m_touches.push_back(std::make_pair(event.tfinger.fingerId, point));
+    }
+    break;
+  }
     // case SDL_MOUSEWHEEL:
     //   m_camera.ScaleZoom(1. - event.wheel.y * 0.1);
     //   m_camera.RecomputeAttributes();
@@ -474,16 +2160,22 @@ void Editor::processEvent(const SDL_Event &event) {
 
 // Getters and Setters
 void Editor::setNumInstances(int numInstances) {
+  m_resetDirty |= numInstances != m_numInstances;
   m_numInstances = numInstances;
 }
 
+void Editor::setCapacity(int capacity) {
+  m_resetDirty |= capacity != m_capacity;
+  m_capacity = capacity;
+}
+
 void Editor::setParticleSize(float particleSize) {
   if (particleSize == m_particleSize) {
     return;
   } else {
-    m_circle.setRadius(particleSize);
-    m_circle.create();
     m_particleSize = particleSize;
+    // The grid spacing depends on the particle size
+    m_resetDirty = true;
   }
 }
 
@@ -492,6 +2184,7 @@ void Editor::setParticleDamping(float particleDamping) {
 }
 
 void Editor::setParticleSpacing(float particleSpacing) {
+  m_resetDirty |= particleSpacing != m_particleSpacing;
   m_particleSpacing = particleSpacing;
 }
 
@@ -502,8 +2195,10 @@ void Editor::setDensityRadius(float densityRadius) {
 }
 
 void Editor::setTargetDensity(float targetDensity) {
-  m_targetDensity = targetDensity;
+  m_restDensities[0] = targetDensity;
   m_flowFinity.setTargetDensity(targetDensity);
+  // The other phases keep their density relative to the base fluid
+  rebuildPhases();
 }
 
 void Editor::setPressureMultiplier(float pressureMultiplier) {
@@ -511,15 +2206,31 @@ void Editor::setPressureMultiplier(float pressureMultiplier) {
   m_flowFinity.setPressureMultiplier(pressureMultiplier);
 }
 
+void Editor::setNearPressureMultiplier(float nearPressureMultiplier) {
+  m_flowFinity.setNearPressureMultiplier(nearPressureMultiplier);
+}
+
 void Editor::setGravity(float gravity) { m_gravity = gravity; }
 
-void Editor::setBounds(glm::vec2 bounds) { m_bounds = bounds; }
+void Editor::setBounds(glm::vec2 bounds) {
+  if (bounds == m_bounds) {
+    return;
+  }
+  // Random locations are spread over the bounds
+  m_resetDirty |= m_randomLocation;
+  m_bounds = bounds;
+  // The sleeping cells and the obstacle distances cover the bounds
+  resetActivity();
+  rebuildObstacles();
+}
 
 void Editor::setRandomLocation(bool randomLocation) {
+  m_resetDirty |= randomLocation != m_randomLocation;
   m_randomLocation = randomLocation;
 }
 
 void Editor::setRandomLocationGenerated(bool randomLocationGenerated) {
+  m_resetDirty |= randomLocationGenerated != m_randomLocationGenerated;
   m_randomLocationGenerated = randomLocationGenerated;
 }
 
@@ -530,15 +2241,245 @@ void Editor::setInputStrengthMultiplier(float inputStrengthMultiplier) {
 }
 
 void Editor::setViscosityStrength(float viscosityStrength) {
-  m_viscosityStrength = viscosityStrength;
+  m_viscosities[0] = viscosityStrength;
 }
 
 void Editor::setColors(std::vector<glm::vec3> colors) { m_colors = colors; }
 
+void Editor::setAdaptiveTimestep(bool adaptiveTimestep) {
+  m_adaptiveTimestep = adaptiveTimestep;
+}
+
+void Editor::setCflFactor(float cflFactor) {
+  m_timestepController.setCflFactor(cflFactor);
+}
+
+void Editor::setForceFactor(float forceFactor) {
+  m_timestepController.setForceFactor(forceFactor);
+}
+
+void Editor::setViscosityFactor(float viscosityFactor) {
+  m_timestepController.setViscosityFactor(viscosityFactor);
+}
+
+void Editor::setTimestepLimits(float minTimestep, float maxTimestep) {
+  m_timestepController.setDtLimits(minTimestep, maxTimestep);
+}
+
+void Editor::setMaxSubsteps(int maxSubsteps) {
+  m_timestepController.setMaxSubsteps(maxSubsteps);
+}
+
+void Editor::setSolverMode(SolverMode solverMode) {
+  m_solverMode = solverMode;
+}
+
+void Editor::setSolverTolerance(float solverTolerance) {
+  m_solverTolerance = solverTolerance;
+}
+
+void Editor::setSolverIterations(int solverIterations) {
+  m_solverMaxIterations = solverIterations;
+}
+
+void Editor::setWarmStart(bool warmStart) { m_warmStart = warmStart; }
+
+void Editor::setPbfIterations(int pbfIterations) {
+  m_pbfIterations = pbfIterations;
+}
+
+void Editor::setPbfRelaxation(float pbfRelaxation) {
+  m_pbfRelaxation = pbfRelaxation;
+}
+
+void Editor::setXsphViscosity(float xsphViscosity) {
+  m_xsphViscosity = xsphViscosity;
+}
+
+void Editor::setSleeping(bool sleeping) {
+  if (sleeping && !m_sleeping) {
+    // Counters are not kept up to date while sleeping is off
+    m_activityTracker.wakeAll();
+  }
+  m_sleeping = sleeping;
+}
+
+void Editor::setSleepThresholds(float sleepVelocity,
+                                float sleepDensityChange) {
+  m_sleepVelocity = sleepVelocity;
+  m_sleepDensityChange = sleepDensityChange;
+}
+
+void Editor::setSleepSteps(int sleepSteps) {
+  m_activityTracker.setSleepSteps(sleepSteps);
+}
+
+void Editor::setObstacles(const std::vector<Obstacle> &obstacles) {
+  m_obstacles = obstacles;
+  rebuildObstacles();
+}
+
+void Editor::setBodies(const std::vector<DynamicBody> &bodies) {
+  m_bodyConfigs = bodies;
+  // The bodies start over with the particles
+  m_resetDirty = true;
+  for (Lines &lines : m_bodyLines) {
+    if (lines.elemCount() >= 0) {
+      lines.destroy();
+    }
+  }
+  m_bodyLines.assign(bodies.size(), Lines(glm::vec3(255, 200, 60)));
+  for (size_t i = 0; i < bodies.size(); i++) {
+    std::vector<glm::vec2> outline = RigidBody(bodies[i].shape, 1).outline();
+    std::vector<glm::vec2> segments;
+    for (size_t j = 0; j < outline.size(); j++) {
+      segments.push_back(outline[j]);
+      segments.push_back(outline[(j + 1) % outline.size()]);
+    }
+    m_bodyLines[i].setSegments(segments);
+    m_bodyLines[i].create();
+  }
+}
+
+void Editor::setPhases(const std::vector<FluidPhase> &phases) {
+  m_phaseConfigs = phases;
+  rebuildPhases();
+  // Particles get their phase when they are placed
+  m_resetDirty = true;
+}
+
+void Editor::setParticleSprites(bool particleSprites) {
+  m_particleSprites = particleSprites;
+}
+
+void Editor::setSurfaceRendering(bool surfaceRendering) {
+  m_surfaceRendering = surfaceRendering;
+}
+
+void Editor::setSurfaceResolution(int surfaceResolution) {
+  m_surfaceResolution = surfaceResolution;
+}
+
+void Editor::setSurfaceThreshold(float surfaceThreshold) {
+  m_surfaceThreshold = surfaceThreshold;
+}
+
+void Editor::setSurfaceOutline(bool surfaceOutline) {
+  m_surfaceOutline = surfaceOutline;
+}
+
+void Editor::setOutlineTolerance(float outlineTolerance) {
+  m_surfaceExtractor.setTolerance(outlineTolerance);
+}
+
+void Editor::setObstacleMode(ObstacleMode obstacleMode) {
+  if (obstacleMode == m_obstacleMode) {
+    return;
+  }
+  m_obstacleMode = obstacleMode;
+  rebuildObstacles();
+}
+
+void Editor::setObstacleCellSize(float obstacleCellSize) {
+  if (obstacleCellSize == m_obstacleCellSize) {
+    return;
+  }
+  m_obstacleCellSize = obstacleCellSize;
+  rebuildObstacles();
+}
+
 // Getters
 bool Editor::getStarted() { return m_started; }
 
-float Editor::getDensity() {
-  // return m_flowFinity.calculateDensity(glm::vec3(0), m_densityRadius);
-  return 0;
+int Editor::getLiveParticles() { return m_pool.liveCount(); }
+
+int Editor::getCapacity() { return m_pool.capacity(); }
+
+int Editor::getSubsteps() { return m_substeps; }
+
+float Editor::getTimestep() { return m_timestep; }
+
+int Editor::getSolverIterations() { return m_solverIterations; }
+
+float Editor::getSolverError() { return m_solverError; }
+
+float Editor::getActiveFraction() { return m_activeFraction; }
+
+const std::vector<Editor::NodeThroughput> &Editor::getNodeThroughput() {
+  return m_nodeThroughput;
+}
+
+FrameTimer &Editor::getFrameTimer() { return m_frameTimer; }
+
+void Editor::resize(int width, int height) {
+  m_width = width;
+  m_height = height;
+  m_camera.width = width;
+  m_camera.height = height;
+}
+
+void Editor::setFixedFrameTime(float seconds) { m_fixedFrameTime = seconds; }
+
+int Editor::getNearestParticles(glm::vec3 pos, int k, int *indices,
+                                float *distances) {
+  refreshSpatialHash();
+  if (!m_hashPositions) {
+    return 0;
+  }
+  KnnSearch search(m_spatialHash, m_hashCount, m_startIndices, m_hashCellSize,
+                   m_hashPositions->data(), m_pool);
+  return search.nearest(pos, k, indices, distances);
+}
+
+void Editor::getNearestParticles(const std::vector<glm::vec3> &points, int k,
+                                 std::vector<int> &offsets,
+                                 std::vector<int> &indices,
+                                 std::vector<float> &distances) {
+  refreshSpatialHash();
+  if (!m_hashPositions) {
+    offsets.assign(points.size() + 1, 0);
+    indices.clear();
+    distances.clear();
+    return;
+  }
+  KnnSearch search(m_spatialHash, m_hashCount, m_startIndices, m_hashCellSize,
+                   m_hashPositions->data(), m_pool);
+  search.nearest(points, k, m_threadPool, offsets, indices, distances);
+}
+
+void Editor::getSurfaceOutline(std::vector<std::vector<glm::vec2>> &lines) {
+  m_surfaceExtractor.polylines(lines);
+}
+
+void Editor::probeFields(const glm::vec3 *points, int count, float *densities,
+                         float *pressures, glm::vec3 *velocities) {
+  const float h = m_densityRadius;
+  refreshSpatialHash();
+  m_threadPool.parallelFor(0, count, [&](int p) {
+    float density = 0;
+    glm::vec3 velocity(0);
+    forEachParticleInRange(points[p], h, [&](int i, glm::vec3, float dst) {
+      float influence = FlowFinity::smoothingKernel(h, dst);
+      density += influence;
+      velocity += m_velocities[i] * influence;
+    });
+    if (densities) {
+      densities[p] = density;
+    }
+    // The equation of state the rigid bodies feel, for every solver
+    if (pressures) {
+      pressures[p] =
+          std::max(m_pressureMultiplier * (density - m_restDensities[0]), 0.f);
+    }
+    // Kernel weighted average, so sparse neighborhoods keep their speed
+    if (velocities) {
+      velocities[p] = density > 0 ? velocity / density : glm::vec3(0);
+    }
+  });
+}
+
+float Editor::getDensity(glm::vec3 pos) {
+  float density = 0;
+  probeFields(&pos, 1, &density, nullptr, nullptr);
+  return density;
 }
\ No newline at end of file
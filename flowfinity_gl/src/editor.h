@@ -1,18 +1,33 @@
+#include "activitytracker.h"
 #include "engine/camera.h"
+#include "engine/framedata.h"
+#include "engine/frametimer.h"
 #include "engine/scene/circle.h"
+#include "engine/scene/lines.h"
 #include "engine/scene/square.h"
 #include "engine/shaderprogram.h"
 #include "flowfinity.h"
+#include "particlepool.h"
+#include "rigidbody.h"
+#include "sceneconfig.h"
+#include "sdfgrid.h"
+#include "segmentbvh.h"
+#include "surfaceextractor.h"
+#include "threadpool.h"
+#include "timestepcontroller.h"
 
 #include <SDL_events.h>
 #include <SDL_video.h>
 #include <chrono>
+#include <mutex>
 
 class Editor {
 public:
   Editor();
   ~Editor();
 
+  // Without a window the editor draws into whatever framebuffer is bound, at
+  // the size given to resize() before
   int initialize(SDL_Window *window, SDL_GLContext gl_context);
   void resize(int width, int height);
   void paint();
@@ -21,8 +36,11 @@ public:
   void initInstances();
   void startSimulation();
   void resetSimulation();
+  void loadScene(const SceneConfig &scene);
 
   void updateSpatialHash(float radius);
+  void updateSpatialHash(float radius,
+                         const ParticleArray<glm::vec3> &positions);
   unsigned int getKeyFromHash(unsigned int hash);
   glm::vec3 forEachPointInRadius(glm::vec3 pos, float radius, int caseNum,
                                  int posIndex);
@@ -31,12 +49,14 @@ public:
   glm::vec3 calcPressureHelper(int pos1, int pos2, float r);
 
   void setNumInstances(int numInstances);
+  void setCapacity(int capacity);
   void setParticleSize(float particleSize);
   void setParticleDamping(float particleDamping);
   void setParticleSpacing(float particleSpacing);
   void setDensityRadius(float densityRadius);
   void setTargetDensity(float targetDensity);
   void setPressureMultiplier(float pressureMultiplier);
+  void setNearPressureMultiplier(float nearPressureMultiplier);
   void setGravity(float gravity);
   void setBounds(glm::vec2 bounds);
   void setRandomLocation(bool randomLocation);
@@ -45,9 +65,82 @@ public:
   void setInputStrengthMultiplier(float inputStrengthMultiplier);
   void setViscosityStrength(float viscosityStrength);
   void setColors(std::vector<glm::vec3> colors);
+  void setAdaptiveTimestep(bool adaptiveTimestep);
+  void setCflFactor(float cflFactor);
+  void setForceFactor(float forceFactor);
+  void setViscosityFactor(float viscosityFactor);
+  void setTimestepLimits(float minTimestep, float maxTimestep);
+  void setMaxSubsteps(int maxSubsteps);
+  void setSolverMode(SolverMode solverMode);
+  void setSolverTolerance(float solverTolerance);
+  void setSolverIterations(int solverIterations);
+  void setWarmStart(bool warmStart);
+  void setPbfIterations(int pbfIterations);
+  void setPbfRelaxation(float pbfRelaxation);
+  void setXsphViscosity(float xsphViscosity);
+  void setSleeping(bool sleeping);
+  void setSleepThresholds(float sleepVelocity, float sleepDensityChange);
+  void setSleepSteps(int sleepSteps);
+  void setObstacles(const std::vector<Obstacle> &obstacles);
+  void setObstacleMode(ObstacleMode obstacleMode);
+  void setObstacleCellSize(float obstacleCellSize);
+  void setBodies(const std::vector<DynamicBody> &bodies);
+  void setPhases(const std::vector<FluidPhase> &phases);
+  void setParticleSprites(bool particleSprites);
+  void setSurfaceRendering(bool surfaceRendering);
+  void setSurfaceResolution(int surfaceResolution);
+  void setSurfaceThreshold(float surfaceThreshold);
+  void setSurfaceOutline(bool surfaceOutline);
+  void setOutlineTolerance(float outlineTolerance);
 
   bool getStarted();
-  float getDensity();
+  int getLiveParticles();
+  int getCapacity();
+  int getSubsteps();
+  float getTimestep();
+  int getSolverIterations();
+  float getSolverError();
+  float getActiveFraction();
+  // Density at a position, sampled like probeFields
+  float getDensity(glm::vec3 pos);
+  // Density, pressure and velocity of the fluid at count points, interpolated
+  // from the particles within the density radius where the last step left
+  // them. Every output holds count values, null outputs are skipped. Runs on
+  // all threads and allocates nothing
+  void probeFields(const glm::vec3 *points, int count, float *densities,
+                   float *pressures, glm::vec3 *velocities);
+  // k live particles closest to a position where the last step left them,
+  // closest first. Returns how many were found
+  int getNearestParticles(glm::vec3 pos, int k, int *indices,
+                          float *distances);
+  // k closest particles of many positions at once, the neighbors of point i
+  // in [offsets[i], offsets[i + 1]) of indices and distances
+  void getNearestParticles(const std::vector<glm::vec3> &points, int k,
+                           std::vector<int> &offsets,
+                           std::vector<int> &indices,
+                           std::vector<float> &distances);
+  // Outline of the fluid drawn in the last frame as polylines, closed ones end
+  // on their first point
+  void getSurfaceOutline(std::vector<std::vector<glm::vec2>> &lines);
+
+  /**
+   * Work of one NUMA node over the last second
+   */
+  struct NodeThroughput {
+    float particlesPerSecond;
+    // Estimated from the particle state a solver loop streams per particle
+    float bytesPerSecond;
+    // Fraction of the particles the node took over from other nodes
+    float stolenFraction;
+  };
+  const std::vector<NodeThroughput> &getNodeThroughput();
+
+  // CPU and GPU time of the phases of the frame, the caller times its own
+  // passes after paint() with it too
+  FrameTimer &getFrameTimer();
+  // Advance the simulation by this many seconds every frame instead of by the
+  // time that passed, so recorded videos play at the simulated speed
+  void setFixedFrameTime(float seconds);
 
   // Click Strength
   int m_clickStrength;
@@ -56,14 +149,22 @@ private:
   SDL_Window *mp_window;
   int m_width;
   int m_height;
+  // Simulated time per painted frame, 0 follows the wall clock
+  float m_fixedFrameTime;
 
   GLuint vao;
 
   ShaderProgram m_prog_flat;
   ShaderProgram m_prog_instanced;
+  // Per frame shader parameters shared by all the programs
+  FrameData m_frameData;
+  FrameTimer m_frameTimer;
   Square m_square;
   Square m_square2;
+  // Unit circle, scaled to the particle radius in the shader
   Circle m_circle;
+  // Draw the particles as m_square cut to a circle instead of as m_circle
+  bool m_particleSprites;
   Circle m_inputCircle;
   glm::vec2 m_bounds;
 
@@ -71,25 +172,249 @@ private:
 
   FlowFinity m_flowFinity;
 
-  void checkInterations();
-  glm::vec2 interactionForce(int index, float radius, float strength);
+  /**
+   * Point the fluid is pulled towards or pushed away from, in the coordinates
+   * of the click point
+   */
+  struct InputPoint {
+    glm::vec2 position;
+    // 1 pulls, -1 pushes
+    float strength;
+  };
+
+  void gatherInputPoints();
+  void checkInterations(int num);
+  glm::vec3 blockPosition(int index);
+  glm::vec2 interactionForce(int index, const InputPoint &input, float radius,
+                             float strength);
+  // Mouse and touch points acting on the fluid this step
+  std::vector<InputPoint> m_inputPoints;
+  // Fingers on a touch screen and where they are
+  std::vector<std::pair<SDL_FingerID, glm::vec2>> m_touches;
+  // Force of all input points on every particle, applied once per step
+  ParticleArray<glm::vec3> m_inputForces;
+  // Particles in range of the input point being applied
+  std::vector<int> m_inputParticles;
 
   // Elapsed time in milliseconds
-  int m_elapsed_time;
+  float m_elapsed_time;
   // Last time the paint function was called
   std::chrono::high_resolution_clock::time_point m_lastTime;
 
   // Velocites and Positions
-  std::vector<glm::vec3> m_positions;
-  std::vector<glm::vec3> m_velocities;
-  std::vector<glm::vec3> m_predicted_positions;
-  std::vector<float> m_densities;
-  void resolveCollisions();
+  ParticleArray<glm::vec3> m_positions;
+  ParticleArray<glm::vec3> m_velocities;
+  ParticleArray<glm::vec3> m_predicted_positions;
+  ParticleArray<float> m_densities;
+  // Density under the sharper near kernel, found in the same pass
+  ParticleArray<float> m_nearDensities;
+  void resolveCollisions(float dt);
+
+  // Particle Pool, Emitters and Sinks
+  void parkParticle(int index);
+  void emitParticles(float dt);
+  void drainParticles();
+  void compactParticles();
+  // Order the live particles along x, so every NUMA node's block of particles
+  // is one strip of the box and only the strip edges read other nodes' memory
+  void sortParticles();
+  void swapParticles(int a, int b);
+  // Cut the NUMA nodes' blocks from the live range of the pool again once it
+  // grew or shrank, and move the particle memory to the nodes' new blocks
+  void partitionParticles();
+  ParticlePool m_pool;
+  // Requested pool capacity, at least the number of instances is used
+  int m_capacity;
+  std::vector<ParticleEmitter> m_emitters;
+  // Fractional particles each emitter still owes
+  std::vector<float> m_emitterAccumulators;
+  std::vector<ParticleSink> m_sinks;
+  // Guards the pool while the sinks drain particles on several threads
+  std::mutex m_drainMutex;
+  // Steps since the last reset
+  int m_stepCount;
+
+  // Worker threads for the particle loops
+  ThreadPool m_threadPool;
+  // Slot every slot takes its particle from while sorting
+  ParticleArray<int> m_sortOrder;
+  // Throughput of every NUMA node, updated once a second
+  void updateNodeThroughput();
+  std::vector<NodeThroughput> m_nodeThroughput;
+  std::vector<ThreadPool::NodeStats> m_nodeStats;
+  std::chrono::steady_clock::time_point m_nodeStatsTime;
+  // Set when a parameter changed that the initial particle layout depends on
+  bool m_resetDirty;
+
+  // Adaptive Timestep
+  void advance(float frameDt);
+  TimestepController m_timestepController;
+  bool m_adaptiveTimestep;
+  // Fastest particle, largest acceleration and density of the last step
+  float m_stepMaxVelocity;
+  float m_maxAcceleration;
+  float m_maxDensity;
+  // Take the acceleration and density extremes of an iterative solver's step
+  void trackSolverExtremes(int num, float dt);
+  // Steps taken in the last frame and the size of the last one
+  int m_substeps;
+  float m_timestep;
+
+  // Pressure Solvers
+  template <typename F>
+  void forEachNeighbor(int index, const ParticleArray<glm::vec3> &positions,
+                       float radius, const F &fn, bool walls = false);
+  template <typename F> float sumOverParticles(int num, const F &fn);
+  template <typename F> float maxOverParticles(int num, const F &fn);
+  // The steps are instantiated for single and multi phase fluids, so a single
+  // phase fluid never looks up the phase tables
+  template <bool MultiPhase> void leapfrogStep(int num, float dt);
+  template <bool MultiPhase> void applyNonPressureForces(int num, float dt);
+  template <bool MultiPhase> void computePressureAccelerations(int num);
+  template <bool MultiPhase> void pcisphScaling(int num, float dt);
+  template <bool MultiPhase> void pcisphStep(int num, float dt);
+  template <bool MultiPhase> void dfsphStep(int num, float dt);
+  template <bool MultiPhase>
+  int dfsphSolve(int num, float dt, bool divergence);
+  template <bool MultiPhase> void pbfStep(int num, float dt);
+  SolverMode m_solverMode;
+  // Relative density error the iterative solvers stop at
+  float m_solverTolerance;
+  // Most iterations per pressure solve
+  int m_solverMaxIterations;
+  // Start each pressure solve from the pressures of the last step
+  bool m_warmStart;
+  // Constraint iterations per position based step
+  int m_pbfIterations;
+  // Softens the position based density constraint
+  float m_pbfRelaxation;
+  // XSPH velocity smoothing of the position based solver
+  float m_xsphViscosity;
+  // Iterations and remaining density error of the last pressure solve
+  int m_solverIterations;
+  float m_solverError;
+  // PCISPH pressures or DFSPH density stiffness, kept for warm starting
+  ParticleArray<float> m_pressures;
+  // DFSPH divergence stiffness, kept for warm starting
+  ParticleArray<float> m_divergencePressures;
+  // Factor relating a particle's PCISPH pressure or DFSPH stiffness to its
+  // density change
+  ParticleArray<float> m_alphas;
+  // DFSPH stiffness or PBF lambda of the current iteration
+  ParticleArray<float> m_stiffness;
+  ParticleArray<glm::vec3> m_pressureAccelerations;
+  // PBF position change of the current iteration
+  ParticleArray<glm::vec3> m_positionCorrections;
+  // Velocities before the non-pressure forces were applied
+  ParticleArray<glm::vec3> m_tempVelocities;
+  // Partial sums of each thread of the pool
+  std::vector<float> m_threadSums;
+
+  // Sleeping Cells
+  void resetActivity();
+  void updateActivity(int num);
+  void reportActivity(int num);
+  ActivityTracker m_activityTracker;
+  bool m_sleeping;
+  // Speed below which a particle counts as resting
+  float m_sleepVelocity;
+  // Relative density change per step below which a particle counts as resting
+  float m_sleepDensityChange;
+  // Particles simulated this step, live particles outside of sleeping cells
+  ParticleArray<char> m_awake;
+  // Density of every particle when its activity was last checked
+  ParticleArray<float> m_sleepDensities;
+  // Fraction of the live particles that were simulated in the last step
+  float m_activeFraction;
+
+  // Obstacles
+  void rebuildObstacles();
+  void collideWithSegments(int index, float radius, float dt);
+  std::vector<Obstacle> m_obstacles;
+  // Signed distance to the obstacles, sampled over the bounds
+  SdfGrid m_sdfGrid;
+  // Obstacle outline segments, used instead of the grid in BVH mode
+  SegmentBvh m_segmentBvh;
+  ObstacleMode m_obstacleMode;
+  float m_obstacleCellSize;
+  // Obstacle outlines
+  Lines m_obstacleLines;
+
+  // Rigid Bodies
+  template <typename F>
+  void forEachParticleNear(glm::vec3 pos, float radius, const F &fn);
+  float gridDensity();
+  void resetBodies();
+  void coupleRigidBodies(int num, float dt);
+  std::vector<DynamicBody> m_bodyConfigs;
+  std::vector<RigidBody> m_bodies;
+  // Density the boundary samples of the bodies add to each particle, -1 for
+  // particles that are not near any body
+  ParticleArray<float> m_boundaryDensities;
+  // Particles near a body in the current step
+  std::vector<int> m_coupledParticles;
+  // Body outlines around the center of mass
+  std::vector<Lines> m_bodyLines;
+
+  // Fluid Phases
+  template <bool MultiPhase> float phaseMass(int index) const;
+  template <bool MultiPhase> float phaseViscosity(int index) const;
+  void rebuildPhases();
+  // Phase of every particle, an index into the phase tables
+  ParticleArray<unsigned char> m_phases;
+  // Rest density, viscosity and color of every phase. The first phase is the
+  // base fluid, its rest density is the target density
+  std::vector<float> m_restDensities;
+  std::vector<float> m_viscosities;
+  std::vector<glm::vec3> m_phaseColors;
+  // Mass of a particle of every phase relative to the base fluid
+  std::vector<float> m_phaseMasses;
+  // Phases after the base fluid, relative to it
+  std::vector<FluidPhase> m_phaseConfigs;
+
+  // Density Surface
+  void updateSurfaceTexture();
+  void updateSurfaceOutline();
+  float meanDensity();
+  bool m_surfaceRendering;
+  int m_surfaceResolution;
+  float m_surfaceThreshold;
+  ShaderProgram m_prog_surface;
+  // Density relative to the mean particle density and speed of every grid
+  // cell, as two channels of a float texture
+  GLuint m_surfaceTexture;
+  int m_surfaceWidth;
+  int m_surfaceHeight;
+  // Half extents of the area the grid covers, the box and one density radius
+  glm::vec2 m_surfaceExtent;
+  // Cell centers the fields are probed at
+  std::vector<glm::vec3> m_surfacePoints;
+  std::vector<float> m_surfaceDensities;
+  std::vector<glm::vec3> m_surfaceVelocities;
+  std::vector<glm::vec2> m_surfaceTexels;
+  // Outline at the threshold, marched on the particles themselves so it stays
+  // sharp at any resolution
+  bool m_surfaceOutline;
+  // Density the outline is marched at, follows the mean density in steps
+  float m_outlineDensity;
+  SurfaceExtractor m_surfaceExtractor;
+  Lines m_surfaceLines;
 
   // Particle Location Hashing
   // Spatial hash stores <cell key, particle index>
   std::vector<std::pair<int, int>> m_spatialHash;
   std::vector<int> m_startIndices;
+  // Pairs in use at the front of the spatial hash, one per live particle
+  int m_hashCount;
+  // Cell size and positions of the last build
+  float m_hashCellSize;
+  const ParticleArray<glm::vec3> *m_hashPositions;
+  // The particles moved since the last build, queries between steps rebuild
+  // the hash before reading it
+  bool m_hashStale;
+  void refreshSpatialHash();
+  template <typename F>
+  void forEachParticleInRange(glm::vec3 pos, float radius, const F &fn);
 
   // Number of instances
   int m_numInstances;
@@ -103,8 +428,6 @@ private:
   bool m_started;
   // Density Radius
   float m_densityRadius;
-  // Target Density
-  float m_targetDensity;
   // Pressure Multiplier
   float m_pressureMultiplier;
   // Gravity
@@ -121,10 +444,10 @@ private:
   float m_inputRadius;
   // Input strength Multiplier
   float m_inputStrengthMultiplier;
-  // Viscosity Strength
-  float m_viscosityStrength;
   // Colors array
   std::vector<glm::vec3> m_colors;
+  // Initial particle blocks from the scene, empty for the default grid
+  std::vector<ParticleBlock> m_blocks;
 
   constexpr static const glm::vec2 cellOffsets[9] = {
       glm::vec2(-1, 1),  glm::vec2(0, 1),  glm::vec2(1, 1),
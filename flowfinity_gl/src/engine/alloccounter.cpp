@@ -0,0 +1,42 @@
+#include "alloccounter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<size_t> s_totalAllocations(0);
+static size_t s_frameStart = 0;
+static size_t s_lastFrameAllocations = 0;
+
+void AllocCounter::beginFrame() {
+  size_t total = s_totalAllocations.load(std::memory_order_relaxed);
+  s_lastFrameAllocations = total - s_frameStart;
+  s_frameStart = total;
+}
+
+size_t AllocCounter::lastFrameAllocations() { return s_lastFrameAllocations; }
+
+size_t AllocCounter::totalAllocations() {
+  return s_totalAllocations.load(std::memory_order_relaxed);
+}
+
+// Replacements of the global allocation functions, the nothrow versions of the
+// standard library forward to these
+void *operator new(std::size_t size) {
+  s_totalAllocations.fetch_add(1, std::memory_order_relaxed);
+  void *ptr = std::malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void *operator new[](std::size_t size) { return operator new(size); }
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+
+void operator delete[](void *ptr) noexcept { std::free(ptr); }
+
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+
+void operator delete[](void *ptr, std::size_t) noexcept { std::free(ptr); }
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+
+// Counts every heap allocation made through operator new, so the frame loop
+// can be checked for allocations once the app is warmed up
+namespace AllocCounter {
+// Start counting a new frame
+void beginFrame();
+// Allocations made during the last complete frame
+size_t lastFrameAllocations();
+// Allocations made since the program started
+size_t totalAllocations();
+}; // namespace AllocCounter
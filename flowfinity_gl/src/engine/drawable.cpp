@@ -14,6 +14,8 @@ Drawable::Drawable() : m_count(-1), m_attributes() {}
 Drawable::~Drawable() {}
 
 void Drawable::destroy() {
+  // Drawing needs another create() now
+  m_count = -1;
   m_attributes.idx.destroy();
   m_attributes.pos.destroy();
   m_attributes.col.destroy();
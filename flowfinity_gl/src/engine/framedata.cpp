@@ -0,0 +1,71 @@
+#include "framedata.h"
+
+#include <algorithm>
+
+FrameData::FrameData() : m_block(), m_buffer(0), m_dirty(true) {}
+
+void FrameData::create() {
+  if (m_buffer == 0) {
+    glGenBuffers(1, &m_buffer);
+  }
+  glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+  glBufferData(GL_UNIFORM_BUFFER, sizeof(Block), nullptr, GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  // Programs bind their block to the same point once they are linked
+  glBindBufferBase(GL_UNIFORM_BUFFER, BINDING, m_buffer);
+  m_dirty = true;
+}
+
+void FrameData::destroy() {
+  glDeleteBuffers(1, &m_buffer);
+  m_buffer = 0;
+}
+
+void FrameData::setViewProj(const glm::mat4 &viewProj) {
+  set(m_block.viewProj, viewProj);
+}
+
+void FrameData::setCamPos(const glm::vec3 &camPos) {
+  set(m_block.camPos, glm::vec4(camPos, 1));
+}
+
+void FrameData::setColors(const std::vector<glm::vec3> &colors) {
+  int count = std::min((int)colors.size(), 6);
+  for (int i = 0; i < count; i++) {
+    set(m_block.colors[i], glm::vec4(colors[i], 1));
+  }
+}
+
+void FrameData::setPhaseColors(const std::vector<glm::vec3> &colors) {
+  int count = std::min((int)colors.size(), 8);
+  set(m_block.numPhases, count);
+  for (int i = 0; i < count; i++) {
+    set(m_block.phaseColors[i], glm::vec4(colors[i], 1));
+  }
+}
+
+void FrameData::setMaxVelocity(float maxVelocity) {
+  set(m_block.maxVelocity, maxVelocity);
+}
+
+void FrameData::setTime(int time) { set(m_block.time, time); }
+
+void FrameData::setDeltaTime(float deltaTime) {
+  set(m_block.deltaTime, deltaTime);
+}
+
+void FrameData::setRadius(float radius) { set(m_block.radius, radius); }
+
+void FrameData::setThreshold(float threshold) {
+  set(m_block.threshold, threshold);
+}
+
+void FrameData::upload() {
+  if (!m_dirty || m_buffer == 0) {
+    return;
+  }
+  glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+  glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(Block), &m_block);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  m_dirty = false;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/mat4x4.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <vector>
+
+// Shader parameters that are the same for every draw of a frame, in one
+// uniform buffer that every program reads its FrameData block from. The
+// setters only mark the buffer dirty when a value changes, and upload() sends
+// it once before the frame is drawn
+class FrameData {
+public:
+  // Uniform buffer binding point of the FrameData block in every program
+  static const GLuint BINDING = 0;
+
+  FrameData();
+  void create();
+  void destroy();
+
+  void setViewProj(const glm::mat4 &viewProj);
+  void setCamPos(const glm::vec3 &camPos);
+  // Velocity gradient, up to 6 colors
+  void setColors(const std::vector<glm::vec3> &colors);
+  // Color of every fluid phase, up to 8
+  void setPhaseColors(const std::vector<glm::vec3> &colors);
+  void setMaxVelocity(float maxVelocity);
+  void setTime(int time);
+  void setDeltaTime(float deltaTime);
+  // Particle radius, the particle shapes are given at unit size
+  void setRadius(float radius);
+  // Density the surface is drawn at
+  void setThreshold(float threshold);
+
+  // Send the block if anything changed since the last upload
+  void upload();
+
+private:
+  // The FrameData block of the shaders in std140 layout, vec3s take the space
+  // of a vec4
+  struct Block {
+    glm::mat4 viewProj;
+    glm::vec4 camPos;
+    glm::vec4 colors[6];
+    glm::vec4 phaseColors[8];
+    float maxVelocity;
+    float deltaTime;
+    int time;
+    int numPhases;
+    float radius;
+    float threshold;
+    float padding[2];
+  };
+
+  template <typename T> void set(T &field, const T &value) {
+    if (!(field == value)) {
+      field = value;
+      m_dirty = true;
+    }
+  }
+
+  Block m_block;
+  GLuint m_buffer;
+  bool m_dirty;
+};
@@ -0,0 +1,192 @@
+#include "framerecorder.h"
+
+#include <cstring>
+#include <iostream>
+
+FrameRecorder::FrameRecorder()
+    : m_width(0), m_height(0), m_y4m(false), m_file(), m_pixelBuffers(),
+      m_fences(), m_pending(), m_nextSlot(0), m_queue(), m_queueStart(0),
+      m_queued(0), m_stop(false), m_frame(), m_framesWritten(0),
+      m_failed(false) {}
+
+FrameRecorder::~FrameRecorder() {
+  // Without close() the frames in flight are lost, but the writer still has
+  // to finish
+  if (m_writer.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_frameQueued.notify_one();
+    m_writer.join();
+  }
+}
+
+bool FrameRecorder::open(const std::string &path, int width, int height,
+                         int fps) {
+  m_file.open(path, std::ios::binary);
+  if (m_file.fail()) {
+    std::cerr << "Failed to open video file: " << path << std::endl;
+    return false;
+  }
+  m_width = width;
+  m_height = height;
+  m_y4m = path.size() >= 4 && path.compare(path.size() - 4, 4, ".y4m") == 0;
+  if (m_y4m) {
+    m_file << "YUV4MPEG2 W" << width << " H" << height << " F" << fps
+           << ":1 Ip A1:1 C444\n";
+  }
+
+  size_t frameSize = (size_t)width * height * 4;
+  glGenBuffers(RING_SIZE, m_pixelBuffers);
+  for (int i = 0; i < RING_SIZE; i++) {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pixelBuffers[i]);
+    glBufferData(GL_PIXEL_PACK_BUFFER, frameSize, nullptr, GL_STREAM_READ);
+    m_pending[i] = false;
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  m_nextSlot = 0;
+
+  m_queue.assign(QUEUE_SIZE, std::vector<unsigned char>(frameSize));
+  m_frame.resize((size_t)width * height * 3);
+  m_queueStart = 0;
+  m_queued = 0;
+  m_stop = false;
+  m_framesWritten = 0;
+  m_failed = false;
+  m_writer = std::thread(&FrameRecorder::writeFrames, this);
+  return true;
+}
+
+void FrameRecorder::capture() {
+  // The slot's last frame was read RING_SIZE frames ago
+  int slot = m_nextSlot;
+  if (m_pending[slot]) {
+    collect(slot);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pixelBuffers[slot]);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(0, 0, m_width, m_height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  m_fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  m_pending[slot] = true;
+  m_nextSlot = (slot + 1) % RING_SIZE;
+}
+
+bool FrameRecorder::close() {
+  if (!m_writer.joinable()) {
+    return false;
+  }
+  // Oldest first, so the frames stay in order
+  for (int i = 0; i < RING_SIZE; i++) {
+    int slot = (m_nextSlot + i) % RING_SIZE;
+    if (m_pending[slot]) {
+      collect(slot);
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_frameQueued.notify_one();
+  m_writer.join();
+
+  glDeleteBuffers(RING_SIZE, m_pixelBuffers);
+  m_file.close();
+  return !m_failed && !m_file.fail();
+}
+
+int FrameRecorder::framesWritten() const { return m_framesWritten; }
+
+void FrameRecorder::collect(int slot) {
+  glClientWaitSync(m_fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT,
+                   GL_TIMEOUT_IGNORED);
+  glDeleteSync(m_fences[slot]);
+  m_pending[slot] = false;
+
+  // Only the writer's frames are in [m_queueStart, m_queueStart + m_queued),
+  // the next one after them is free to fill without the lock
+  int index;
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_frameWritten.wait(lock, [&] { return m_queued < QUEUE_SIZE; });
+    index = (m_queueStart + m_queued) % QUEUE_SIZE;
+  }
+
+  std::vector<unsigned char> &frame = m_queue[index];
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pixelBuffers[slot]);
+  const void *pixels =
+      glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, frame.size(), GL_MAP_READ_BIT);
+  if (pixels == nullptr) {
+    std::cerr << "Failed to map a recorded frame" << std::endl;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    m_failed = true;
+    return;
+  }
+  std::memcpy(frame.data(), pixels, frame.size());
+  glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_queued++;
+  }
+  m_frameQueued.notify_one();
+}
+
+void FrameRecorder::writeFrames() {
+  while (true) {
+    int index;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_frameQueued.wait(lock, [&] { return m_queued > 0 || m_stop; });
+      if (m_queued == 0) {
+        return;
+      }
+      index = m_queueStart;
+    }
+
+    convert(m_queue[index]);
+    if (m_y4m) {
+      m_file << "FRAME\n";
+    }
+    m_file.write((const char *)m_frame.data(), m_frame.size());
+    if (m_file.fail()) {
+      m_failed = true;
+    }
+    m_framesWritten++;
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_queueStart = (m_queueStart + 1) % QUEUE_SIZE;
+      m_queued--;
+    }
+    m_frameWritten.notify_one();
+  }
+}
+
+void FrameRecorder::convert(const std::vector<unsigned char> &pixels) {
+  size_t planeSize = (size_t)m_width * m_height;
+  for (int y = 0; y < m_height; y++) {
+    const unsigned char *row =
+        &pixels[(size_t)(m_height - 1 - y) * m_width * 4];
+    for (int x = 0; x < m_width; x++) {
+      int r = row[4 * x];
+      int g = row[4 * x + 1];
+      int b = row[4 * x + 2];
+      size_t i = (size_t)y * m_width + x;
+      if (m_y4m) {
+        // BT.601 in studio range, what players assume for YUV4MPEG2
+        m_frame[i] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+        m_frame[planeSize + i] =
+            ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+        m_frame[2 * planeSize + i] =
+            ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+      } else {
+        m_frame[3 * i] = r;
+        m_frame[3 * i + 1] = g;
+        m_frame[3 * i + 2] = b;
+      }
+    }
+  }
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Records the frames of the bound read framebuffer to a video file. The
+// pixels are read into a ring of pixel buffer objects and only mapped once
+// the ring comes around to them again, so the GPU copy has long finished and
+// reading back doesn't stall drawing. A writer thread converts and writes the
+// frames, the render thread only waits on it when the queue is full
+class FrameRecorder {
+public:
+  // Pixel buffers frames are read into
+  static const int RING_SIZE = 3;
+  // Frames handed to the writer that it hasn't written yet
+  static const int QUEUE_SIZE = 8;
+
+  FrameRecorder();
+  ~FrameRecorder();
+
+  // Files ending in .y4m are YUV4MPEG2 with full resolution color, any other
+  // file raw RGB24 from the top row down. Needs the GL context
+  bool open(const std::string &path, int width, int height, int fps);
+  // Read the current frame of the bound read framebuffer
+  void capture();
+  // Write the frames still in flight and close the file. Returns whether
+  // every frame was written
+  bool close();
+
+  int framesWritten() const;
+
+private:
+  // Map a pixel buffer and hand its frame to the writer
+  void collect(int slot);
+  void writeFrames();
+  // Convert an RGBA frame, bottom row first as GL reads it, into m_frame
+  void convert(const std::vector<unsigned char> &pixels);
+
+  int m_width;
+  int m_height;
+  bool m_y4m;
+  std::ofstream m_file;
+
+  GLuint m_pixelBuffers[RING_SIZE];
+  GLsync m_fences[RING_SIZE];
+  bool m_pending[RING_SIZE];
+  // Slot the next frame is read into, the oldest one still pending
+  int m_nextSlot;
+
+  // Queue of frames for the writer, the oldest at m_queueStart
+  std::vector<std::vector<unsigned char>> m_queue;
+  int m_queueStart;
+  int m_queued;
+  bool m_stop;
+  std::mutex m_mutex;
+  std::condition_variable m_frameQueued;
+  std::condition_variable m_frameWritten;
+  std::thread m_writer;
+
+  // Owned by the writer thread
+  std::vector<unsigned char> m_frame;
+  int m_framesWritten;
+  // Set by either thread when a frame is lost
+  std::atomic<bool> m_failed;
+};
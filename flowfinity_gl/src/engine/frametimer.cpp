@@ -0,0 +1,115 @@
+#include "frametimer.h"
+
+#include <cstring>
+
+// Weight of the newest time in the averages, single frames vary a lot
+static const float SMOOTHING = 0.1f;
+
+static float smooth(float average, float value) {
+  return average + (value - average) * SMOOTHING;
+}
+
+FrameTimer::FrameTimer()
+    : m_phases(), m_current(-1), m_frame(0), m_supported(false), m_start() {}
+
+void FrameTimer::create() {
+  m_supported = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+}
+
+void FrameTimer::destroy() {
+  for (Phase &phase : m_phases) {
+    if (phase.gpu && m_supported) {
+      glDeleteQueries(FRAMES, phase.queries);
+    }
+  }
+  m_phases.clear();
+  m_current = -1;
+}
+
+void FrameTimer::beginFrame() {
+  m_frame = (m_frame + 1) % FRAMES;
+  for (Phase &phase : m_phases) {
+    phase.ran = false;
+    if (!phase.issued[m_frame]) {
+      continue;
+    }
+    // A result that isn't ready yet is dropped, the query is issued again
+    // this frame
+    phase.issued[m_frame] = false;
+    GLuint available = 0;
+    glGetQueryObjectuiv(phase.queries[m_frame], GL_QUERY_RESULT_AVAILABLE,
+                        &available);
+    if (available) {
+      GLuint64 elapsed = 0;
+      glGetQueryObjectui64v(phase.queries[m_frame], GL_QUERY_RESULT, &elapsed);
+      phase.gpuMs = smooth(phase.gpuMs, elapsed / 1e6f);
+    }
+  }
+}
+
+void FrameTimer::begin(const char *name, bool gpu) {
+  if (m_current >= 0) {
+    end();
+  }
+  m_current = -1;
+  for (int i = 0; i < (int)m_phases.size(); i++) {
+    if (std::strcmp(m_phases[i].name, name) == 0) {
+      m_current = i;
+      break;
+    }
+  }
+  if (m_current < 0) {
+    Phase phase = {};
+    phase.name = name;
+    phase.gpu = gpu && m_supported;
+    if (phase.gpu) {
+      glGenQueries(FRAMES, phase.queries);
+    }
+    m_current = m_phases.size();
+    m_phases.push_back(phase);
+  }
+
+  Phase &phase = m_phases[m_current];
+  if (phase.gpu) {
+    glBeginQuery(GL_TIME_ELAPSED, phase.queries[m_frame]);
+    phase.issued[m_frame] = true;
+  }
+  m_start = std::chrono::steady_clock::now();
+}
+
+void FrameTimer::end() {
+  if (m_current < 0) {
+    return;
+  }
+  Phase &phase = m_phases[m_current];
+  std::chrono::duration<float, std::milli> time =
+      std::chrono::steady_clock::now() - m_start;
+  phase.cpuMs = smooth(phase.cpuMs, time.count());
+  phase.ran = true;
+  if (phase.gpu) {
+    glEndQuery(GL_TIME_ELAPSED);
+  }
+  m_current = -1;
+}
+
+const std::vector<FrameTimer::Phase> &FrameTimer::phases() const {
+  return m_phases;
+}
+
+bool FrameTimer::hasGpuTimes() const { return m_supported; }
+
+float FrameTimer::cpuTotal() const {
+  float total = 0;
+  for (const Phase &phase : m_phases) {
+    total += phase.ran ? phase.cpuMs : 0;
+  }
+  return total;
+}
+
+float FrameTimer::gpuTotal() const {
+  float total = 0;
+  for (const Phase &phase : m_phases) {
+    total += phase.ran ? phase.gpuMs : 0;
+  }
+  return total;
+}
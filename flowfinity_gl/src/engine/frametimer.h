@@ -0,0 +1,58 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <chrono>
+#include <vector>
+
+// CPU and GPU time of the phases of a frame. The GPU time is measured with
+// GL_TIME_ELAPSED queries, two per phase used on alternate frames, and a
+// result is only read once the GPU has it, so timing never waits on the GPU
+class FrameTimer {
+public:
+  // Frames the queries of a phase take turns over
+  static const int FRAMES = 2;
+
+  struct Phase {
+    // Name given to begin(), a string literal
+    const char *name;
+    // Averages over the last frames in milliseconds
+    float cpuMs;
+    float gpuMs;
+    // Whether the phase is measured on the GPU too
+    bool gpu;
+    // Whether the phase ran in the last frame
+    bool ran;
+    GLuint queries[FRAMES];
+    // Whether the query of a frame was issued and not read yet
+    bool issued[FRAMES];
+  };
+
+  FrameTimer();
+  // Check for timer queries, needs the GL context
+  void create();
+  void destroy();
+
+  // Start a frame, reads the GPU times of the frame that last used this
+  // frame's queries if they are ready
+  void beginFrame();
+  // Time a phase until end(), phases do not nest. CPU only phases don't issue
+  // any queries
+  void begin(const char *name, bool gpu = true);
+  void end();
+
+  const std::vector<Phase> &phases() const;
+  // Whether the driver has timer queries, otherwise the GPU times stay 0
+  bool hasGpuTimes() const;
+  // Sums over the phases that ran in the last frame
+  float cpuTotal() const;
+  float gpuTotal() const;
+
+private:
+  std::vector<Phase> m_phases;
+  // Phase between begin() and end(), -1 outside of one
+  int m_current;
+  // Which of the queries of every phase this frame uses
+  int m_frame;
+  bool m_supported;
+  std::chrono::steady_clock::time_point m_start;
+};
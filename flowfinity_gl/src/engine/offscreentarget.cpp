@@ -0,0 +1,51 @@
+#include "offscreentarget.h"
+
+#include <iostream>
+
+OffscreenTarget::OffscreenTarget()
+    : m_framebuffer(0), m_color(0), m_depth(0), m_width(0), m_height(0) {}
+
+bool OffscreenTarget::create(int width, int height) {
+  destroy();
+  m_width = width;
+  m_height = height;
+
+  glGenRenderbuffers(1, &m_color);
+  glBindRenderbuffer(GL_RENDERBUFFER, m_color);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+  glGenRenderbuffers(1, &m_depth);
+  glBindRenderbuffer(GL_RENDERBUFFER, m_depth);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+  glGenFramebuffers(1, &m_framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                            GL_RENDERBUFFER, m_color);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                            GL_RENDERBUFFER, m_depth);
+  GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  if (status != GL_FRAMEBUFFER_COMPLETE) {
+    std::cerr << "Offscreen framebuffer incomplete: " << status << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void OffscreenTarget::destroy() {
+  glDeleteFramebuffers(1, &m_framebuffer);
+  glDeleteRenderbuffers(1, &m_color);
+  glDeleteRenderbuffers(1, &m_depth);
+  m_framebuffer = 0;
+  m_color = 0;
+  m_depth = 0;
+}
+
+void OffscreenTarget::bind() {
+  glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+  glReadBuffer(GL_COLOR_ATTACHMENT0);
+}
+
+int OffscreenTarget::width() const { return m_width; }
+
+int OffscreenTarget::height() const { return m_height; }
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <GL/glew.h>
+
+// Framebuffer with a color and a depth buffer to draw into without a window,
+// in the same formats as the window's
+class OffscreenTarget {
+public:
+  OffscreenTarget();
+  // Returns whether the framebuffer is complete
+  bool create(int width, int height);
+  void destroy();
+  // Draw into and read from the target
+  void bind();
+
+  int width() const;
+  int height() const;
+
+private:
+  GLuint m_framebuffer;
+  GLuint m_color;
+  GLuint m_depth;
+  int m_width;
+  int m_height;
+};
@@ -7,10 +7,12 @@
 #include <glm/vec4.hpp>
 #include <vector>
 
-Circle::Circle() : Drawable(), radius(0.25), sides(40), color(0, 150, 255) {}
+Circle::Circle()
+    : Drawable(), radius(0.25), sides(40), color(0, 150, 255),
+      mode(GL_TRIANGLES) {}
 
 Circle::Circle(float r, float s, glm::vec3 col)
-    : Drawable(), radius(r), sides(s), color(col) {}
+    : Drawable(), radius(r), sides(s), color(col), mode(GL_TRIANGLES) {}
 
 Circle::~Circle() {}
 
@@ -21,6 +23,12 @@ void Circle::setSides(float s) { sides = s; }
 void Circle::setColor(glm::vec3 c) { color = c; }
 
 void Circle::create() {
+  // Release the buffers of the last call
+  if (m_count >= 0) {
+    destroy();
+  }
+  mode = GL_TRIANGLES;
+
   std::vector<glm::vec4> pos{};
 
   // std::vector<glm::vec4> nor{};
@@ -66,6 +74,11 @@ void Circle::create() {
 }
 
 void Circle::createLines() {
+  if (m_count >= 0) {
+    destroy();
+  }
+  mode = GL_LINES;
+
   std::vector<glm::vec4> pos{};
 
   // std::vector<glm::vec4> nor{};
@@ -10,16 +10,20 @@ public:
   Circle(float r, float sides, glm::vec3 color);
   ~Circle();
 
+  // A filled fan of triangles
   void create() override;
+  // Only the outline
   void createLines();
   void setRadius(float r);
   void setSides(float s);
   void setColor(glm::vec3 c);
 
-  GLenum drawMode() override { return GL_LINES; }
+  GLenum drawMode() override { return mode; }
 
 private:
   float radius;
   float sides;
   glm::vec3 color;
+  // Triangles or lines, whichever was created last
+  GLenum mode;
 };
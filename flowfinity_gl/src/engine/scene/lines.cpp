@@ -0,0 +1,46 @@
+#include "lines.h"
+
+#include <glm/vec4.hpp>
+
+Lines::Lines()
+    : Drawable(), segments(), color(255, 255, 255), pos(), col(), idx() {}
+
+Lines::Lines(glm::vec3 c)
+    : Drawable(), segments(), color(c), pos(), col(), idx() {}
+
+Lines::~Lines() {}
+
+void Lines::setSegments(const std::vector<glm::vec2> &s) { segments = s; }
+
+void Lines::setColor(glm::vec3 c) { color = c; }
+
+void Lines::create() {
+  pos.clear();
+  col.clear();
+  idx.clear();
+  for (const glm::vec2 &point : segments) {
+    idx.push_back(pos.size());
+    pos.push_back(glm::vec4(point.x, point.y, 0, 1));
+    col.push_back(glm::vec4(color / 255.f, 1));
+  }
+
+  // The buffers of the last call are refilled
+  if (m_count < 0) {
+    m_attributes.idx.generate();
+    m_attributes.pos.generate();
+    m_attributes.col.generate();
+  }
+  m_count = idx.size();
+
+  m_attributes.idx.bind();
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, idx.size() * sizeof(GLuint), idx.data(),
+               GL_STATIC_DRAW);
+
+  m_attributes.pos.bind();
+  glBufferData(GL_ARRAY_BUFFER, pos.size() * sizeof(glm::vec4), pos.data(),
+               GL_STATIC_DRAW);
+
+  m_attributes.col.bind();
+  glBufferData(GL_ARRAY_BUFFER, col.size() * sizeof(glm::vec4), col.data(),
+               GL_STATIC_DRAW);
+}
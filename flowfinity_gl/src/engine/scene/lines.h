@@ -0,0 +1,31 @@
+#pragma once
+
+#include "../drawable.h"
+#include <GL/glew.h>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <vector>
+
+class Lines : public Drawable {
+public:
+  Lines();
+  Lines(glm::vec3 color);
+  ~Lines();
+
+  // Upload the segments, later calls refill the same buffers instead of
+  // creating new ones, for lines that change every frame
+  void create() override;
+  // Pairs of segment end points, create() has to be called again afterwards
+  void setSegments(const std::vector<glm::vec2> &segments);
+  void setColor(glm::vec3 c);
+
+  GLenum drawMode() override { return GL_LINES; }
+
+private:
+  std::vector<glm::vec2> segments;
+  glm::vec3 color;
+  // Vertex data of the last upload, kept for its storage
+  std::vector<glm::vec4> pos;
+  std::vector<glm::vec4> col;
+  std::vector<GLuint> idx;
+};
@@ -1,11 +1,15 @@
 #include "shaderprogram.h"
 #include <glm/gtc/type_ptr.hpp>
 
+#include "framedata.h"
 #include "glutil.h"
 
+#include <algorithm>
+#include <cstdio>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <iterator>
 #include <sstream>
 
 namespace fs = std::filesystem;
@@ -13,22 +17,64 @@ namespace fs = std::filesystem;
 ShaderProgram::Handles::Handles()
     : attr_pos(-1), attr_col(-1),
       // attr_nor(-1),
-      unif_model(-1), unif_modelInvTr(-1), unif_viewProj(-1), unif_camPos(-1),
-      unif_maxVelocity(-1), unif_numInstances(-1), unif_deltaTime(-1),
-      unif_time(-1), unif_colors(-1) {}
+      unif_model(-1), unif_modelInvTr(-1), unif_numInstances(-1) {}
 
 ShaderProgram::ShaderProgram()
     : m_vertShader(), m_fragShader(), m_prog(), m_ssboPositions(),
-      m_ssboVelocities(), m_handles() {}
+      m_ssboVelocities(), m_ssboPhases(), m_ssboSize(0), m_handles(),
+      m_cacheKey(0), m_fromCache(false) {}
+
+// Hash of the sources and the driver, a driver update invalidates every
+// cached binary
+static unsigned long long cacheKey(const std::string &vertSource,
+                                   const std::string &fragSource) {
+  unsigned long long hash = 14695981039346656037ull;
+  auto add = [&](const char *text) {
+    // The terminator keeps the strings from running into each other
+    for (const char *c = text ? text : "";; c++) {
+      hash = (hash ^ (unsigned char)*c) * 1099511628211ull;
+      if (*c == '\0') {
+        break;
+      }
+    }
+  };
+  add(vertSource.c_str());
+  add(fragSource.c_str());
+  add((const char *)glGetString(GL_VENDOR));
+  add((const char *)glGetString(GL_RENDERER));
+  add((const char *)glGetString(GL_VERSION));
+  return hash;
+}
+
+// Whether the driver can hand out program binaries and load them back
+static bool binariesSupported() {
+  if (!GLEW_VERSION_4_1 && !GLEW_ARB_get_program_binary) {
+    return false;
+  }
+  GLint numFormats = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+  return numFormats > 0;
+}
 
 void ShaderProgram::create(const char *vertFile, const char *fragFile) {
-  // Load and compile the vertex and fragment shaders
-  m_vertShader = glCreateShader(GL_VERTEX_SHADER);
-  m_fragShader = glCreateShader(GL_FRAGMENT_SHADER);
+  compile(vertFile, fragFile);
+  finish();
+}
+
+void ShaderProgram::compile(const char *vertFile, const char *fragFile) {
   m_prog = glCreateProgram();
 
   std::string vertSource = textFileRead(vertFile);
   std::string fragSource = textFileRead(fragFile);
+  m_cacheKey = cacheKey(vertSource, fragSource);
+  m_fromCache = loadBinary();
+  if (m_fromCache) {
+    return;
+  }
+
+  // Load and compile the vertex and fragment shaders
+  m_vertShader = glCreateShader(GL_VERTEX_SHADER);
+  m_fragShader = glCreateShader(GL_FRAGMENT_SHADER);
   const char *vertSourceC = vertSource.c_str();
   const char *fragSourceC = fragSource.c_str();
 
@@ -38,15 +84,23 @@ void ShaderProgram::create(const char *vertFile, const char *fragFile) {
   glCompileShader(m_vertShader);
   glCompileShader(m_fragShader);
 
-  GLUtil::printShaderCompileInfoLog(m_vertShader);
-  GLUtil::printShaderCompileInfoLog(m_fragShader);
-
-  // Link the vertex and fragment shader into a shader program
+  // Link the vertex and fragment shader into a shader program. Nothing is
+  // queried yet, so the driver doesn't have to finish the compiles here
   glAttachShader(m_prog, m_vertShader);
   glAttachShader(m_prog, m_fragShader);
+  if (binariesSupported()) {
+    glProgramParameteri(m_prog, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  }
   glLinkProgram(m_prog);
+}
 
-  GLUtil::printLinkInfoLog(m_prog);
+bool ShaderProgram::finish() {
+  if (!m_fromCache) {
+    GLUtil::printShaderCompileInfoLog(m_vertShader);
+    GLUtil::printShaderCompileInfoLog(m_fragShader);
+    GLUtil::printLinkInfoLog(m_prog);
+    saveBinary();
+  }
 
   // Get the locations of the attributes in the shader program
   m_handles.attr_pos = glGetAttribLocation(m_prog, "vs_Pos");
@@ -56,13 +110,22 @@ void ShaderProgram::create(const char *vertFile, const char *fragFile) {
   // Gets uniform locations in shader program
   m_handles.unif_model = glGetUniformLocation(m_prog, "u_Model");
   m_handles.unif_modelInvTr = glGetUniformLocation(m_prog, "u_ModelInvTr");
-  m_handles.unif_viewProj = glGetUniformLocation(m_prog, "u_ViewProj");
-  m_handles.unif_camPos = glGetUniformLocation(m_prog, "u_CamPos");
-  m_handles.unif_maxVelocity = glGetUniformLocation(m_prog, "u_MaxVelocity");
   m_handles.unif_numInstances = glGetUniformLocation(m_prog, "u_NumInstances");
-  m_handles.unif_time = glGetUniformLocation(m_prog, "u_Time");
-  m_handles.unif_deltaTime = glGetUniformLocation(m_prog, "u_DeltaTime");
-  m_handles.unif_colors = glGetUniformLocation(m_prog, "u_Colors");
+
+  // Per frame parameters come from the shared uniform buffer
+  GLuint frameBlock = glGetUniformBlockIndex(m_prog, "FrameData");
+  if (frameBlock != GL_INVALID_INDEX) {
+    glUniformBlockBinding(m_prog, frameBlock, FrameData::BINDING);
+  }
+  return m_fromCache;
+}
+
+void ShaderProgram::enableParallelCompile() {
+#ifdef GL_KHR_parallel_shader_compile
+  if (GLEW_KHR_parallel_shader_compile) {
+    glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+  }
+#endif
 }
 
 void ShaderProgram::useMe() { glUseProgram(m_prog); }
@@ -90,8 +153,9 @@ void ShaderProgram::draw(Drawable &drawable) {
 }
 
 void ShaderProgram::drawInstanced(Drawable &drawable, int numInstances,
-                                  const std::vector<glm::vec3> &offsets,
-                                  const std::vector<glm::vec3> &velocities) {
+                                  const ParticleArray<glm::vec3> &offsets,
+                                  const ParticleArray<glm::vec3> &velocities,
+                                  const ParticleArray<unsigned char> *phases) {
   GLUtil::printGLErrorLog();
   if (drawable.elemCount() < 0) {
     throw std::invalid_argument(
@@ -113,6 +177,14 @@ void ShaderProgram::drawInstanced(Drawable &drawable, int numInstances,
                   sizeof(glm::vec3) * offsets.size(), velocities.data());
   glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
+  // And the phases, one byte per instance
+  if (phases) {
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_ssboPhases);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, phases->size(),
+                    phases->data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  }
+
   bindDrawable(drawable);
 
   // Bind the index buffer and then draw shapes from it.
@@ -138,35 +210,22 @@ void ShaderProgram::setModelMatrix(const glm::mat4 &model) {
   }
 }
 
-void ShaderProgram::setViewProjMatrix(const glm::mat4 &viewProj) {
-  useMe();
-  if (m_handles.unif_viewProj != -1) {
-    glUniformMatrix4fv(m_handles.unif_viewProj, 1, GL_FALSE, &viewProj[0][0]);
-  }
-}
-
-void ShaderProgram::setCamPos(const glm::vec3 &cp) {
-  useMe();
-  if (m_handles.unif_camPos != -1) {
-    glUniform3fv(m_handles.unif_camPos, 1, &cp[0]);
-  }
-}
-
-void ShaderProgram::setMaxVelocity(float maxVelocity) {
-  useMe();
-  if (m_handles.unif_maxVelocity != -1) {
-    glUniform1f(m_handles.unif_maxVelocity, maxVelocity);
-  }
-}
-
 void ShaderProgram::setNumInstances(int numInstances) {
   useMe();
   if (m_handles.unif_numInstances != -1) {
     glUniform1i(m_handles.unif_numInstances, numInstances);
   }
 
-  // Create the SSBO for positions
-  glGenBuffers(1, &m_ssboPositions);
+  // The SSBOs already have the right size, this runs every idle frame
+  if (numInstances == m_ssboSize) {
+    return;
+  }
+  m_ssboSize = numInstances;
+
+  // Create the SSBO for positions, or resize the existing one
+  if (m_ssboPositions == 0) {
+    glGenBuffers(1, &m_ssboPositions);
+  }
   glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_ssboPositions);
   glBufferData(GL_SHADER_STORAGE_BUFFER, numInstances * sizeof(glm::vec3),
                nullptr, GL_DYNAMIC_DRAW);
@@ -174,33 +233,24 @@ void ShaderProgram::setNumInstances(int numInstances) {
   glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
   // Create the SSBO for velocities
-  glGenBuffers(1, &m_ssboVelocities);
+  if (m_ssboVelocities == 0) {
+    glGenBuffers(1, &m_ssboVelocities);
+  }
   glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_ssboVelocities);
   glBufferData(GL_SHADER_STORAGE_BUFFER, numInstances * sizeof(glm::vec3),
                nullptr, GL_DYNAMIC_DRAW);
   glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_ssboVelocities);
   glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-}
-
-void ShaderProgram::setTime(int time) {
-  useMe();
-  if (m_handles.unif_time != -1) {
-    glUniform1i(m_handles.unif_time, time);
-  }
-}
 
-void ShaderProgram::setDeltaTime(float deltaTime) {
-  useMe();
-  if (m_handles.unif_deltaTime != -1) {
-    glUniform1f(m_handles.unif_deltaTime, deltaTime);
-  }
-}
-
-void ShaderProgram::setColors(const std::vector<glm::vec3> &colors) {
-  useMe();
-  if (m_handles.unif_colors != -1) {
-    glUniform3fv(m_handles.unif_colors, colors.size(), &colors[0][0]);
+  // Create the SSBO for phases, the shader reads them four to a uint
+  if (m_ssboPhases == 0) {
+    glGenBuffers(1, &m_ssboPhases);
   }
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_ssboPhases);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, (numInstances + 3) / 4 * 4, nullptr,
+               GL_DYNAMIC_DRAW);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_ssboPhases);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 }
 
 void ShaderProgram::bindDrawable(Drawable &drawable) {
@@ -249,4 +299,72 @@ std::string ShaderProgram::textFileRead(const char *filename) {
   std::stringstream buffer;
   buffer << file.rdbuf();
   return buffer.str();
-}
\ No newline at end of file
+}
+
+std::string ShaderProgram::cachePath() const {
+  char name[32];
+  std::snprintf(name, sizeof(name), "%016llx.bin", m_cacheKey);
+  return (fs::current_path() / "shadercache" / name).string();
+}
+
+bool ShaderProgram::loadBinary() {
+  if (!binariesSupported()) {
+    return false;
+  }
+  std::ifstream file(cachePath(), std::ios::binary);
+  if (file.fail()) {
+    return false;
+  }
+  GLenum format = 0;
+  if (!file.read((char *)&format, sizeof(format))) {
+    return false;
+  }
+  std::vector<char> binary((std::istreambuf_iterator<char>(file)),
+                           std::istreambuf_iterator<char>());
+  if (binary.empty()) {
+    return false;
+  }
+
+  // A format the driver no longer knows would be an error, not just a failed
+  // load
+  GLint numFormats = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+  std::vector<GLint> formats(numFormats);
+  glGetIntegerv(GL_PROGRAM_BINARY_FORMATS, formats.data());
+  if (std::find(formats.begin(), formats.end(), (GLint)format) ==
+      formats.end()) {
+    return false;
+  }
+
+  // The driver may still reject it, then the program is built from source
+  glProgramBinary(m_prog, format, binary.data(), binary.size());
+  GLint linked = GL_FALSE;
+  glGetProgramiv(m_prog, GL_LINK_STATUS, &linked);
+  return linked == GL_TRUE;
+}
+
+void ShaderProgram::saveBinary() {
+  if (!binariesSupported()) {
+    return;
+  }
+  GLint length = 0;
+  glGetProgramiv(m_prog, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0) {
+    return;
+  }
+  std::vector<char> binary(length);
+  GLenum format = 0;
+  glGetProgramBinary(m_prog, length, &length, &format, binary.data());
+
+  // Without a cache the next start only compiles again
+  fs::path path = cachePath();
+  std::error_code error;
+  fs::create_directories(path.parent_path(), error);
+  std::ofstream file(path, std::ios::binary);
+  if (file.fail()) {
+    std::cerr << "Failed to write shader cache: " << path << std::endl;
+    return;
+  }
+  file.write((const char *)&format, sizeof(format));
+  file.write(binary.data(), length);
+}
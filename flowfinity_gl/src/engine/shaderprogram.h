@@ -1,6 +1,7 @@
 #pragma once
 
 #include "drawable.h"
+#include "particlearray.h"
 
 #include <GL/glew.h>
 #include <glm/mat4x4.hpp>
@@ -21,20 +22,8 @@ class ShaderProgram {
     int unif_model;
     // uniform mat4 => inverse transpose model matrix
     int unif_modelInvTr;
-    // uniform mat4 => combined projection and view matrices
-    int unif_viewProj;
-    // uniform vec3 => camera position
-    int unif_camPos;
-    // uniform float => max velocity
-    int unif_maxVelocity;
     // uniform int => number of instances
     int unif_numInstances;
-    // uniform int -> time
-    int unif_time;
-    // uniform float -> deltaTime
-    int unif_deltaTime;
-    // uniform float array -> 5 colors
-    int unif_colors;
   };
 
 public:
@@ -50,35 +39,40 @@ public:
   GLuint m_ssboPositions;
   // Second Shader Storage Buffer for velocities
   GLuint m_ssboVelocities;
+  // Third Shader Storage Buffer for the fluid phase of every instance
+  GLuint m_ssboPhases;
+  // Number of instances the SSBOs are allocated for
+  int m_ssboSize;
 
   ShaderProgram();
+  // Compile and link the shaders, waiting for the driver to finish
   void create(const char *vertFile, const char *fragFile);
+  // Start building the program, from the binary cache if it has an entry for
+  // these sources and this driver. Issue every compile before finishing any
+  // of them so the driver can build them in parallel
+  void compile(const char *vertFile, const char *fragFile);
+  // Wait for the program, check it and store it in the binary cache, and bind
+  // its FrameData block. Returns whether it was loaded from the cache
+  bool finish();
+  // Let the driver compile shaders on as many threads as it likes, where
+  // KHR_parallel_shader_compile is available
+  static void enableParallelCompile();
   void useMe();
 
   // Draw the given object to our screen using this ShaderProgram's shaders
   void draw(Drawable &drawable);
 
-  // Draw the given object instanced
+  // Draw the given object instanced, phases are only uploaded for fluids with
+  // more than one phase
   void drawInstanced(Drawable &drawable, int numInstances,
-                     const std::vector<glm::vec3> &offsets,
-                     const std::vector<glm::vec3> &velocities);
+                     const ParticleArray<glm::vec3> &offsets,
+                     const ParticleArray<glm::vec3> &velocities,
+                     const ParticleArray<unsigned char> *phases = nullptr);
 
   // Pass model matrix to this shader on the GPU
   void setModelMatrix(const glm::mat4 &model);
-  // Pass Projection * View matrix to this shader on the GPU
-  void setViewProjMatrix(const glm::mat4 &vp);
-  // Pass camera position to this shader on the GPU
-  void setCamPos(const glm::vec3 &cp);
-  // Pass velocites array to this shader on the GPU
-  void setMaxVelocity(float maxVelocity);
   // Pass number of instances to this shader on the GPU
   void setNumInstances(int numInstances);
-  // Pass time to this shader on the GPU
-  void setTime(int time);
-  // Pass deltaTime to this shader on the GPU
-  void setDeltaTime(float deltaTime);
-  // Pass colors to this shader on the GPU
-  void setColors(const std::vector<glm::vec3> &colors);
 
 private:
   // Utility functions used by draw()
@@ -87,4 +81,14 @@ private:
 
   // Utility function used in create()
   std::string textFileRead(const char *);
+
+  // Program binaries are cached in shadercache/<key>.bin, as the binary
+  // format followed by the binary
+  std::string cachePath() const;
+  bool loadBinary();
+  void saveBinary();
+
+  // Hash of the sources and the driver the program is built with
+  unsigned long long m_cacheKey;
+  bool m_fromCache;
 };
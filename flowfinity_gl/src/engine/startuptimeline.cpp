@@ -0,0 +1,30 @@
+#include "startuptimeline.h"
+
+#include <chrono>
+#include <cstdio>
+#include <utility>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+static std::vector<std::pair<std::string, Clock::time_point>> s_stages;
+
+void StartupTimeline::mark(const std::string &stage) {
+  s_stages.push_back(std::make_pair(stage, Clock::now()));
+}
+
+void StartupTimeline::print() {
+  if (s_stages.empty()) {
+    return;
+  }
+  std::printf("Startup timeline:\n");
+  Clock::time_point start = s_stages[0].second;
+  Clock::time_point last = start;
+  for (auto &stage : s_stages) {
+    std::chrono::duration<double, std::milli> total = stage.second - start;
+    std::chrono::duration<double, std::milli> delta = stage.second - last;
+    std::printf("  %9.1f ms  (+%8.1f ms)  %s\n", total.count(), delta.count(),
+                stage.first.c_str());
+    last = stage.second;
+  }
+}
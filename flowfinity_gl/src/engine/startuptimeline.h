@@ -0,0 +1,12 @@
+#pragma once
+
+#include <string>
+
+// Wall clock stages of startup, so the time to the first frame can be read
+// from the log
+namespace StartupTimeline {
+// Record that a stage finished, the first call starts the clock
+void mark(const std::string &stage);
+// Log every stage with the time since startup and since the stage before
+void print();
+}; // namespace StartupTimeline
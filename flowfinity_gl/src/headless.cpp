@@ -0,0 +1,112 @@
+#include "headless.h"
+#include "editor.h"
+#include "engine/framerecorder.h"
+#include "engine/offscreentarget.h"
+#include "engine/startuptimeline.h"
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+// Display without any window system, Mesa's surfaceless platform when the
+// driver has it
+static EGLDisplay openDisplay() {
+  const char *extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+  if (extensions && std::strstr(extensions, "EGL_MESA_platform_surfaceless")) {
+    auto getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress(
+            "eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay) {
+      EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+                                              EGL_DEFAULT_DISPLAY, nullptr);
+      if (display != EGL_NO_DISPLAY) {
+        return display;
+      }
+    }
+  }
+  return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+int runHeadless(const SceneConfig &scene, const HeadlessOptions &options) {
+  EGLDisplay display = openDisplay();
+  if (display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr)) {
+    printf("Error: no EGL display\n");
+    return -1;
+  }
+  eglBindAPI(EGL_OPENGL_API);
+  // The instanced shader reads shader storage buffers, which need 4.3
+  EGLint configAttributes[] = {EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE};
+  EGLConfig config = nullptr;
+  EGLint numConfigs = 0;
+  eglChooseConfig(display, configAttributes, &config, 1, &numConfigs);
+  EGLint contextAttributes[] = {EGL_CONTEXT_MAJOR_VERSION,
+                                4,
+                                EGL_CONTEXT_MINOR_VERSION,
+                                3,
+                                EGL_CONTEXT_OPENGL_PROFILE_MASK,
+                                EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                                EGL_NONE};
+  EGLContext context =
+      eglCreateContext(display, numConfigs > 0 ? config : EGL_NO_CONFIG_KHR,
+                       EGL_NO_CONTEXT, contextAttributes);
+  if (context == EGL_NO_CONTEXT ||
+      !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+    printf("Error: no surfaceless OpenGL 4.3 context: 0x%x\n",
+           eglGetError());
+    eglTerminate(display);
+    return -1;
+  }
+  StartupTimeline::mark("context created");
+
+  int result = 0;
+  {
+    OffscreenTarget target;
+    Editor editor;
+    editor.resize(options.width, options.height);
+    editor.setFixedFrameTime(1.f / options.fps);
+    if (!target.create(options.width, options.height) ||
+        editor.initialize(nullptr, nullptr) != 0) {
+      result = -1;
+    } else {
+      editor.loadScene(scene);
+      editor.startSimulation();
+      StartupTimeline::mark("scene built");
+
+      FrameRecorder recorder;
+      if (!recorder.open(options.output, options.width, options.height,
+                         options.fps)) {
+        result = -1;
+      } else {
+        auto start = std::chrono::steady_clock::now();
+        for (int frame = 0; frame < options.frames; frame++) {
+          target.bind();
+          editor.paint();
+          recorder.capture();
+          if (frame == 0) {
+            StartupTimeline::mark("first frame");
+            StartupTimeline::print();
+          }
+          if ((frame + 1) % options.fps == 0) {
+            printf("Frame %d / %d\n", frame + 1, options.frames);
+          }
+        }
+        if (!recorder.close()) {
+          result = -1;
+        }
+        std::chrono::duration<double> time =
+            std::chrono::steady_clock::now() - start;
+        printf("Wrote %d frames to %s in %.1f s (%.1f frames/s)\n",
+               recorder.framesWritten(), options.output.c_str(), time.count(),
+               recorder.framesWritten() / time.count());
+      }
+    }
+    target.destroy();
+  }
+
+  eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  eglDestroyContext(display, context);
+  eglTerminate(display);
+  return result;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "sceneconfig.h"
+
+#include <string>
+
+/**
+ * A run of a scene without a window, recorded to a video file
+ */
+struct HeadlessOptions {
+  // .y4m for YUV4MPEG2, anything else raw RGB24
+  std::string output;
+  int frames = 600;
+  int width = 1280;
+  int height = 720;
+  // Frames per second of the video, every frame advances the simulation by
+  // one over this
+  int fps = 60;
+};
+
+// Run the scene on an EGL context without any surface, drawing into an
+// offscreen framebuffer. Works on servers without a display with Mesa's
+// llvmpipe. Returns the exit code for main
+int runHeadless(const SceneConfig &scene, const HeadlessOptions &options);
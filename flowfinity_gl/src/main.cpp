@@ -10,12 +10,20 @@
 // - Introduction, links and more at the top of imgui.cpp
 
 #include "editor.h"
+#include "engine/alloccounter.h"
+#include "engine/startuptimeline.h"
+#include "headless.h"
+#include "sceneconfig.h"
 
 #include "imgui.h"
 #include "imgui_impl_opengl3.h"
 #include "imgui_impl_sdl2.h"
 #include <GL/glew.h>
 #include <SDL.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
 
 #if defined(IMGUI_IMPL_OPENGL_ES2)
 #include <SDL_opengles2.h>
@@ -30,7 +38,45 @@
 #endif
 
 // Main code
-int main(int, char **) {
+int main(int argc, char **argv) {
+  StartupTimeline::mark("start");
+
+  // Load the scene given on the command line, or the default scene. With
+  // --headless the scene is recorded to a video file instead of shown
+  std::string scenePath = "resources/scenes/default.scene";
+  bool sceneGiven = false;
+  HeadlessOptions headless;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "--headless" && hasValue) {
+      headless.output = argv[++i];
+    } else if (arg == "--frames" && hasValue) {
+      headless.frames = std::max(std::atoi(argv[++i]), 1);
+    } else if (arg == "--size" && hasValue) {
+      std::sscanf(argv[++i], "%dx%d", &headless.width, &headless.height);
+    } else if (arg == "--fps" && hasValue) {
+      headless.fps = std::max(std::atoi(argv[++i]), 1);
+    } else {
+      scenePath = arg;
+      sceneGiven = true;
+    }
+  }
+  SceneConfig scene;
+  if (!scene.load(scenePath) && sceneGiven) {
+    return -1;
+  }
+  StartupTimeline::mark("scene loaded");
+
+  if (!headless.output.empty()) {
+#ifdef FLOWFINITY_HEADLESS
+    return runHeadless(scene, headless);
+#else
+    printf("Error: built without EGL, --headless is not available\n");
+    return -1;
+#endif
+  }
+
   // Setup SDL
   if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER | SDL_INIT_GAMECONTROLLER) !=
       0) {
@@ -87,6 +133,7 @@ int main(int, char **) {
   SDL_GLContext gl_context = SDL_GL_CreateContext(window);
   SDL_GL_MakeCurrent(window, gl_context);
   SDL_GL_SetSwapInterval(1); // Enable vsync
+  StartupTimeline::mark("window and context created");
 
   // Setup Dear ImGui context
   IMGUI_CHECKVERSION();
@@ -105,6 +152,7 @@ int main(int, char **) {
   // Setup Platform/Renderer backends
   ImGui_ImplSDL2_InitForOpenGL(window, gl_context);
   ImGui_ImplOpenGL3_Init(glsl_version);
+  StartupTimeline::mark("imgui initialized");
 
   // Load Fonts
   // - If no fonts are loaded, dear imgui will use the default font. You can
@@ -144,9 +192,12 @@ int main(int, char **) {
   if (success != 0) {
     return success;
   }
+  editor.loadScene(scene);
+  StartupTimeline::mark("scene built");
 
   // Main loop
   bool done = false;
+  bool firstFrame = true;
 #ifdef __EMSCRIPTEN__
   // For an Emscripten build we are disabling file-system access, so let's not
   // attempt to do a fopen() of the imgui.ini file. You may manually call
@@ -157,6 +208,8 @@ int main(int, char **) {
   while (!done)
 #endif
   {
+    AllocCounter::beginFrame();
+
     // Poll and handle events (inputs, window resize, etc.)
     // You can read the io.WantCaptureMouse, io.WantCaptureKeyboard flags to
     // tell if dear imgui wants to use your inputs.
@@ -190,30 +243,6 @@ int main(int, char **) {
     // 2. Show a simple window that we create ourselves. We use a Begin/End pair
     // to create a named window.
     {
-      static int instances = 2000;
-      static float size = 0.04f;
-      static float damping = 0.96f;
-      static float spacing = 0.05f;
-      static float density = 0.26f;
-      static float targetDensity = 1.2f;
-      static float pressureMultiplier = 19.5f;
-      static float gravity = -9.8f;
-      static float inputRadius = 1.0f;
-      static float inputStrengthMultiplier = 6.0f;
-      static float viscosity = 0.075f;
-      static bool randomLocationGenerated = false;
-      static bool randomLocation = false;
-      static float bounds[2]{7.5f, 4.0f};
-      static int numColors = 6;
-
-      // Colors
-      static float color1[3]{0.03f, 0.29f, 0.86f};
-      static float color2[3]{0.26f, 0.75f, 0.87f};
-      static float color3[3]{0.19f, 0.79f, 0.62f};
-      static float color4[3]{0.6f, 0.98f, 0.49f};
-      static float color5[3]{0.99f, 0.82f, 0.03f};
-      static float color6[3]{0.68f, 0.12f, 0.07f};
-
       ImGui::Begin("Particle Fluid Sim!"); // Create a window called "Hello,
                                            // world!" and append into it.
 
@@ -223,35 +252,258 @@ int main(int, char **) {
               : "Edit the Live Parameters, or Reset!"); // Display some text
                                                         // (you can use a format
                                                         // strings too)
-      ImGui::SliderFloat("Particle Radius", &size, 0.00f,
-                         0.1f); // Edit 1 float using a slider from 0.0f to 1.0f
-      ImGui::SliderFloat("Gravity", &gravity, -10.0f, 10.0f);
+
+      // Widgets return true when they were edited this frame, so parameters
+      // are only sent to the editor when they actually change
+      if (ImGui::SliderFloat("Particle Radius", &scene.particleSize, 0.00f,
+                             0.1f)) {
+        editor.setParticleSize(scene.particleSize);
+      }
+      if (ImGui::SliderFloat("Gravity", &scene.gravity, -10.0f, 10.0f)) {
+        editor.setGravity(scene.gravity);
+      }
       if (!editor.getStarted()) {
-        ImGui::SliderInt("Number of Particles", &instances, 1, 4000);
-        ImGui::SliderFloat("Particle Spacing", &spacing, 0.0f, 1.0f);
-        ImGui::Checkbox("Random Location", &randomLocation);
+        // Block scenes derive the particle count from their blocks
+        if (scene.blocks.empty() &&
+            ImGui::SliderInt("Number of Particles", &scene.numInstances, 1,
+                             4000)) {
+          editor.setNumInstances(scene.numInstances);
+        }
+        if (ImGui::SliderFloat("Particle Spacing", &scene.particleSpacing,
+                               0.0f, 1.0f)) {
+          editor.setParticleSpacing(scene.particleSpacing);
+        }
+        if (ImGui::Checkbox("Random Location", &scene.randomLocation)) {
+          // If the random location is being turned off, tell the editor to
+          // regenerate
+          if (!scene.randomLocation) {
+            editor.setRandomLocationGenerated(false);
+          }
+          editor.setRandomLocation(scene.randomLocation);
+        }
       } else {
-        ImGui::SliderFloat("Input Radius", &inputRadius, 0.0f, 5.0f);
-        ImGui::SliderFloat("Input Strength Multiplier",
-                           &inputStrengthMultiplier, 0.0f, 25.0f);
-        ImGui::SliderFloat2("Bounds", bounds, 0.0f, 10.0f);
+        if (ImGui::SliderFloat("Input Radius", &scene.inputRadius, 0.0f,
+                               5.0f)) {
+          editor.setInputRadius(scene.inputRadius);
+        }
+        if (ImGui::SliderFloat("Input Strength Multiplier",
+                               &scene.inputStrengthMultiplier, 0.0f, 25.0f)) {
+          editor.setInputStrengthMultiplier(scene.inputStrengthMultiplier);
+        }
+        if (ImGui::SliderFloat2("Bounds", (float *)&scene.bounds, 0.0f,
+                                10.0f)) {
+          editor.setBounds(scene.bounds);
+        }
       }
       if (ImGui::CollapsingHeader("Colors")) {
         ImGui::Text("Choose the Velocity Color Gradient!");
-        ImGui::ColorEdit3("Color 1", (float *)&color1);
-        ImGui::ColorEdit3("Color 2", (float *)&color2);
-        ImGui::ColorEdit3("Color 3", (float *)&color3);
-        ImGui::ColorEdit3("Color 4", (float *)&color4);
-        ImGui::ColorEdit3("Color 5", (float *)&color5);
-        ImGui::ColorEdit3("Color 6", (float *)&color6);
+        bool colorsChanged = false;
+        for (int i = 0; i < (int)scene.colors.size(); i++) {
+          std::string label = "Color " + std::to_string(i + 1);
+          colorsChanged |=
+              ImGui::ColorEdit3(label.c_str(), (float *)&scene.colors[i]);
+        }
+        if (colorsChanged) {
+          editor.setColors(scene.colors);
+        }
       }
       if (ImGui::CollapsingHeader("Advanced Settings")) {
-        ImGui::SliderFloat("Density Radius", &density, 0.0f, 2.0f);
-        ImGui::SliderFloat("Target Density", &targetDensity, 0.0f, 10.0f);
-        ImGui::SliderFloat("Particle Damping", &damping, -1.0f, 1.0f);
-        ImGui::SliderFloat("Viscosity", &viscosity, 0.0f, 0.3f);
-        ImGui::SliderFloat("Pressure Multiplier", &pressureMultiplier, 0.0f,
-                           75.0f);
+        // The density radius is picked up on the next reset
+        if (ImGui::SliderFloat("Density Radius", &scene.densityRadius, 0.0f,
+                               2.0f) &&
+            !editor.getStarted()) {
+          editor.setDensityRadius(scene.densityRadius);
+        }
+        // The iterative solvers need a target density above what a single
+        // particle already has on its own, so the range is wide
+        if (ImGui::SliderFloat("Target Density", &scene.targetDensity, 0.0f,
+                               200.0f, "%.2f", ImGuiSliderFlags_Logarithmic)) {
+          editor.setTargetDensity(scene.targetDensity);
+        }
+        if (ImGui::SliderFloat("Particle Damping", &scene.particleDamping,
+                               -1.0f, 1.0f)) {
+          editor.setParticleDamping(scene.particleDamping);
+        }
+        if (ImGui::SliderFloat("Viscosity", &scene.viscosityStrength, 0.0f,
+                               0.3f)) {
+          editor.setViscosityStrength(scene.viscosityStrength);
+        }
+        if (ImGui::SliderFloat("Pressure Multiplier", &scene.pressureMultiplier,
+                               0.0f, 75.0f)) {
+          editor.setPressureMultiplier(scene.pressureMultiplier);
+        }
+        if (ImGui::SliderFloat("Near Pressure Multiplier",
+                               &scene.nearPressureMultiplier, 0.0f, 50.0f)) {
+          editor.setNearPressureMultiplier(scene.nearPressureMultiplier);
+        }
+      }
+      if (ImGui::CollapsingHeader("Pressure Solver")) {
+        const char *solverNames[] = {"WCSPH", "PCISPH", "DFSPH", "PBF"};
+        int solverMode = (int)scene.solverMode;
+        if (ImGui::Combo("Solver", &solverMode, solverNames,
+                         IM_ARRAYSIZE(solverNames))) {
+          scene.solverMode = (SolverMode)solverMode;
+          editor.setSolverMode(scene.solverMode);
+        }
+        if (scene.solverMode == SolverMode::PBF) {
+          if (ImGui::SliderInt("Constraint Iterations", &scene.pbfIterations,
+                               1, 20)) {
+            editor.setPbfIterations(scene.pbfIterations);
+          }
+          if (ImGui::SliderFloat("Constraint Relaxation", &scene.pbfRelaxation,
+                                 0.01f, 100.0f, "%.2f",
+                                 ImGuiSliderFlags_Logarithmic)) {
+            editor.setPbfRelaxation(scene.pbfRelaxation);
+          }
+          if (ImGui::SliderFloat("XSPH Viscosity", &scene.xsphViscosity, 0.0f,
+                                 0.05f, "%.4f")) {
+            editor.setXsphViscosity(scene.xsphViscosity);
+          }
+        } else {
+          if (ImGui::SliderFloat("Solver Tolerance", &scene.solverTolerance,
+                                 0.001f, 0.1f, "%.3f",
+                                 ImGuiSliderFlags_Logarithmic)) {
+            editor.setSolverTolerance(scene.solverTolerance);
+          }
+          if (ImGui::SliderInt("Max Solver Iterations",
+                               &scene.solverIterations, 1, 100)) {
+            editor.setSolverIterations(scene.solverIterations);
+          }
+          if (ImGui::Checkbox("Warm Start", &scene.warmStart)) {
+            editor.setWarmStart(scene.warmStart);
+          }
+        }
+        if (scene.solverMode != SolverMode::WCSPH) {
+          ImGui::Text("%d iterations, %.2f%% density error last step",
+                      editor.getSolverIterations(),
+                      editor.getSolverError() * 100);
+        }
+      }
+      if (ImGui::CollapsingHeader("Sleeping")) {
+        if (ImGui::Checkbox("Sleeping Cells", &scene.sleeping)) {
+          editor.setSleeping(scene.sleeping);
+        }
+        bool thresholdsChanged = ImGui::SliderFloat(
+            "Sleep Velocity", &scene.sleepVelocity, 0.0f, 0.5f, "%.3f");
+        thresholdsChanged |= ImGui::SliderFloat("Sleep Density Change",
+                                                &scene.sleepDensityChange, 0.0f,
+                                                0.02f, "%.4f");
+        if (thresholdsChanged) {
+          editor.setSleepThresholds(scene.sleepVelocity,
+                                    scene.sleepDensityChange);
+        }
+        if (ImGui::SliderInt("Sleep Steps", &scene.sleepSteps, 1, 240)) {
+          editor.setSleepSteps(scene.sleepSteps);
+        }
+        ImGui::Text("%.1f%% of the particles active last step",
+                    editor.getActiveFraction() * 100);
+      }
+      if (ImGui::CollapsingHeader("Obstacles")) {
+        ImGui::Text("%d obstacles", (int)scene.obstacles.size());
+        const char *obstacleModeNames[] = {"Distance Grid", "Segment BVH"};
+        int obstacleMode = (int)scene.obstacleMode;
+        if (ImGui::Combo("Collision", &obstacleMode, obstacleModeNames,
+                         IM_ARRAYSIZE(obstacleModeNames))) {
+          scene.obstacleMode = (ObstacleMode)obstacleMode;
+          editor.setObstacleMode(scene.obstacleMode);
+        }
+        if (scene.obstacleMode == ObstacleMode::SDF &&
+            ImGui::SliderFloat("Distance Grid Cell Size",
+                               &scene.obstacleCellSize, 0.01f, 0.25f)) {
+          editor.setObstacleCellSize(scene.obstacleCellSize);
+        }
+      }
+      if (ImGui::CollapsingHeader("Phases")) {
+        ImGui::Text("%d phases besides the base fluid",
+                    (int)scene.phases.size());
+        bool phasesChanged = false;
+        for (int i = 0; i < (int)scene.phases.size(); i++) {
+          FluidPhase &phase = scene.phases[i];
+          ImGui::PushID(i);
+          ImGui::Text("Phase %d", i + 1);
+          phasesChanged |= ImGui::ColorEdit3("Color", (float *)&phase.color);
+          phasesChanged |=
+              ImGui::SliderFloat("Density", &phase.density, 0.1f, 3.0f);
+          phasesChanged |=
+              ImGui::SliderFloat("Viscosity", &phase.viscosity, 0.0f, 0.3f);
+          ImGui::PopID();
+        }
+        if (phasesChanged) {
+          editor.setPhases(scene.phases);
+        }
+      }
+      if (ImGui::CollapsingHeader("Timestep")) {
+        if (ImGui::Checkbox("Adaptive Timestep", &scene.adaptiveTimestep)) {
+          editor.setAdaptiveTimestep(scene.adaptiveTimestep);
+        }
+        if (ImGui::SliderFloat("CFL Factor", &scene.cflFactor, 0.05f, 1.0f)) {
+          editor.setCflFactor(scene.cflFactor);
+        }
+        if (ImGui::SliderFloat("Force Factor", &scene.forceFactor, 0.05f,
+                               1.0f)) {
+          editor.setForceFactor(scene.forceFactor);
+        }
+        if (ImGui::SliderFloat("Viscosity Factor", &scene.viscosityFactor,
+                               0.05f, 1.0f)) {
+          editor.setViscosityFactor(scene.viscosityFactor);
+        }
+        bool limitsChanged = ImGui::SliderFloat(
+            "Min Timestep", &scene.minTimestep, 0.0001f, 0.01f, "%.4f");
+        limitsChanged |= ImGui::SliderFloat("Max Timestep", &scene.maxTimestep,
+                                            0.001f, 0.05f, "%.4f");
+        if (limitsChanged) {
+          editor.setTimestepLimits(scene.minTimestep, scene.maxTimestep);
+        }
+        if (ImGui::SliderInt("Max Substeps", &scene.maxSubsteps, 1, 32)) {
+          editor.setMaxSubsteps(scene.maxSubsteps);
+        }
+        ImGui::Text("%d steps of %.4f s last frame", editor.getSubsteps(),
+                    editor.getTimestep());
+      }
+      if (ImGui::CollapsingHeader("Rendering")) {
+        if (ImGui::Checkbox("Particle Sprites", &scene.particleSprites)) {
+          editor.setParticleSprites(scene.particleSprites);
+        }
+        if (ImGui::Checkbox("Density Surface", &scene.surfaceRendering)) {
+          editor.setSurfaceRendering(scene.surfaceRendering);
+        }
+        if (ImGui::SliderInt("Surface Resolution", &scene.surfaceResolution,
+                             32, 1024)) {
+          editor.setSurfaceResolution(scene.surfaceResolution);
+        }
+        if (ImGui::SliderFloat("Surface Threshold", &scene.surfaceThreshold,
+                               0.05f, 1.5f)) {
+          editor.setSurfaceThreshold(scene.surfaceThreshold);
+        }
+        if (ImGui::Checkbox("Outline", &scene.surfaceOutline)) {
+          editor.setSurfaceOutline(scene.surfaceOutline);
+        }
+        if (ImGui::SliderFloat("Outline Tolerance", &scene.outlineTolerance,
+                               0.f, 0.2f)) {
+          editor.setOutlineTolerance(scene.outlineTolerance);
+        }
+      }
+      if (ImGui::CollapsingHeader("Frame Timing")) {
+        // The GPU times are read a frame later, once the GPU has them
+        const FrameTimer &timer = editor.getFrameTimer();
+        for (const FrameTimer::Phase &phase : timer.phases()) {
+          if (!phase.ran) {
+            continue;
+          }
+          if (phase.gpu) {
+            ImGui::Text("%-14s CPU %6.2f ms  GPU %6.2f ms", phase.name,
+                        phase.cpuMs, phase.gpuMs);
+          } else {
+            ImGui::Text("%-14s CPU %6.2f ms", phase.name, phase.cpuMs);
+          }
+        }
+        if (timer.hasGpuTimes()) {
+          ImGui::Text("CPU %.2f ms, GPU %.2f ms, %s bound", timer.cpuTotal(),
+                      timer.gpuTotal(),
+                      timer.gpuTotal() > timer.cpuTotal() ? "GPU" : "CPU");
+        } else {
+          ImGui::Text("CPU %.2f ms, no GPU timer queries", timer.cpuTotal());
+        }
       }
       // ImGui::ColorEdit3(
       //     "clear color",
@@ -268,56 +520,29 @@ int main(int, char **) {
           editor.startSimulation();
         } else {
           editor.resetSimulation();
+          editor.setDensityRadius(scene.densityRadius);
         }
       }
+      ImGui::SameLine();
+      if (ImGui::Button("Save Scene")) {
+        scene.save(scenePath);
+      }
 
       ImGui::Text("Application average %.3f ms/frame (%.1f FPS)",
                   1000.0f / io.Framerate, io.Framerate);
-      ImGui::End();
-
-      // Set Variables
-      if (!editor.getStarted()) {
-        editor.setNumInstances(instances);
-        editor.setParticleSpacing(spacing);
-        editor.setDensityRadius(density);
-
-        // If the random location status has changed
-        if (randomLocation != randomLocationGenerated) {
-          // If the random location is being turned off, tell the editor to
-          // regenerate
-          if (!randomLocation && randomLocationGenerated) {
-            editor.setRandomLocationGenerated(false);
-          }
-          // Tell the editor about the new status
-          editor.setRandomLocation(randomLocation);
-          // Save the previous status
-          randomLocationGenerated = randomLocation;
-        }
-      }
-      // Set these even when started
-      editor.setParticleSize(size);
-      editor.setParticleDamping(damping);
-      editor.setTargetDensity(targetDensity);
-      editor.setPressureMultiplier(pressureMultiplier);
-      editor.setGravity(gravity);
-      editor.setInputRadius(inputRadius);
-      editor.setInputStrengthMultiplier(inputStrengthMultiplier);
-      editor.setViscosityStrength(viscosity);
-      editor.setBounds(glm::vec2(bounds[0], bounds[1]));
-
-      // Set Colors
-      if (editor.getStarted()) {
-        std::vector<glm::vec3> colors;
-
-        colors.push_back(glm::vec3(color1[0], color1[1], color1[2]));
-        colors.push_back(glm::vec3(color2[0], color2[1], color2[2]));
-        colors.push_back(glm::vec3(color3[0], color3[1], color3[2]));
-        colors.push_back(glm::vec3(color4[0], color4[1], color4[2]));
-        colors.push_back(glm::vec3(color5[0], color5[1], color5[2]));
-        colors.push_back(glm::vec3(color6[0], color6[1], color6[2]));
-
-        editor.setColors(colors);
+      ImGui::Text("Live particles %d / %d", editor.getLiveParticles(),
+                  editor.getCapacity());
+      ImGui::Text("Heap allocations %zu per frame",
+                  AllocCounter::lastFrameAllocations());
+      const std::vector<Editor::NodeThroughput> &nodes =
+          editor.getNodeThroughput();
+      for (size_t node = 0; nodes.size() > 1 && node < nodes.size(); node++) {
+        ImGui::Text("Node %d: %.1f M particles/s, ~%.1f GB/s, %.0f%% stolen",
+                    (int)node, nodes[node].particlesPerSecond / 1e6f,
+                    nodes[node].bytesPerSecond / 1e9f,
+                    nodes[node].stolenFraction * 100);
       }
+      ImGui::End();
     }
 
     // Rendering
@@ -329,8 +554,15 @@ int main(int, char **) {
     }
     editor.paint();
 
+    editor.getFrameTimer().begin("ImGui");
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+    editor.getFrameTimer().end();
     SDL_GL_SwapWindow(window);
+    if (firstFrame) {
+      StartupTimeline::mark("first frame");
+      StartupTimeline::print();
+      firstFrame = false;
+    }
   }
 #ifdef __EMSCRIPTEN__
   EMSCRIPTEN_MAINLOOP_END;